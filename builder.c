@@ -1,20 +1,119 @@
 // builder.c
 // Orange Pi 5 Plus Linux Kernel Builder with Mali G610 GPU Support
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <sched.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/file.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <grp.h>
 
 #define VERSION "1.0.0"
 #define BUILD_DIR "/tmp/kernel_build"
 #define LOG_FILE "/tmp/kernel_build.log"
+#define LOG_RING_SIZE (1 << 20)          // Bytes queued for the log writer thread
+#define LOG_MAX_BYTES (64LL * 1024 * 1024) // Rotate the build log beyond this
+#define LOG_KEEP 4                       // Rotated logs: LOG_FILE.1, then .2.zst up to .4.zst
+#define CACHE_DIR "/var/cache/builder"
+#define STATE_FILE ".builder-state"
+#define MAX_STAGES 24
+#define FNV_OFFSET_BASIS 1469598103934665603ULL
+#define MALI_DIR "/tmp/mali_install"
+#define BLOB_MANIFEST "mali-blobs.sha256"
+#define MAX_DOWNLOADS 8
+#define DPKG_STATUS "/var/lib/dpkg/status"
+#define APT_LISTS_DIR "/var/lib/apt/lists"
+#define APT_UPDATE_STAMP "apt-update.stamp"
+#define BUILD_DEP_STAMP "apt-build-dep.stamp"
+#define APT_TTL_HOURS 24
+#define MAX_PACKAGES 64
+#define MAX_BUILD_HOSTS 16
+#define DEFAULT_HOST_SLOTS 4
+#define DISTCC_PORT 3632
+#define ICECC_PORT 10245
+#define HOST_PROBE_TIMEOUT_MS 1000
+#define BUNDLE_DIR "bundles"
+#define DEB_DIR "debs"
+#define MODULES_DIR "/lib/modules"
+#define DEBUG_DIR "debug"
+#define DAEMON_SOCKET "/run/builder.sock"
+#define DAEMON_DIR "/var/lib/builder" // Warm build tree and job logs of --daemon
+#define DAEMON_GROUP "builder"         // Group allowed to --submit
+#define MAX_QUEUED_JOBS 32
+#define MAX_JOB_WAITERS 16
+#define ARTIFACT_CACHE_DIR "kernel-artifacts"
+#define PROGRESS_HISTORY "build-throughput.tsv"
+#define PROGRESS_HISTORY_RUNS 5   // Recent cold builds the slowdown check compares against
+#define PROGRESS_SLOWDOWN_PCT 20.0
+#define PROGRESS_INTERVAL_MS 500
+#define PROGRESS_BAR_WIDTH 24
+#define ARTIFACT_CACHE_KEEP 8   // Newest entries kept per cache directory
+#define BUILD_IDENTITY "builder" // KBUILD_BUILD_USER/HOST of reproducible builds
+#define DEPLOY_DIR "deploy"
+#define REMOTE_BUNDLE_DIR "/var/tmp/kernel-bundles"
+#define DEPLOY_SSH "ssh -o BatchMode=yes -o ConnectTimeout=10"
+#define MAX_DEPLOY_HOSTS 64
+#define DEFAULT_DEPLOY_JOBS 4
+#define STAGE_LOG_DIR ".stage-logs"
+#define OBJ_DIR "out"
+#define SCRATCH_DIR "scratch"
+#define ARTIFACT_DIR "artifacts"
+#define SCRATCH_ESTIMATE_MB 6144  // Object directory of an arm64 defconfig with modules
+#define SCRATCH_HEADROOM_MB 1024  // RAM left to the rest of the system
+#define SCRATCH_SPILL_MB 256      // Free space below which a failed build is retried on disk
+#define MAX_PROFILES 4
+#define MAX_USER_FRAGMENTS 4
+#define MAX_FRAGMENTS 8
+#define TUNE_CPU_FLAGS "-mcpu=cortex-a76"
+#define CONFIG_CANDIDATE ".config.candidate"
+#define REPORT_FILE "build-report.json"
+#define BENCH_DIR "bench"
+#define BENCH_BASELINE "bench-baseline.tsv"
+#define MAX_BENCH_RUNS 50
+#define BENCH_REGRESSION_PCT 5.0
+#define GPU_DEVFREQ "/sys/class/devfreq/fb000000.gpu"
+#define GPU_BASELINE "gpu-baseline.tsv"
+#define GPU_REGRESSION_PCT 10.0
+#define GPU_BENCH_SECONDS 1.0 // Minimum timed duration per GPU test
+#define GPU_SGEMM_N 1024
+#define GPU_COPY_MB 64
+#define GPU_COMPUTE_INVOCATIONS (1 << 18) // A multiple of the shader's local size (64)
+#define GPU_COMPUTE_ITERATIONS 4096
+#define NPU_DEVFREQ "/sys/class/devfreq/fdab0000.npu"
+#define TUNE_SCRIPT "/usr/local/sbin/builder-tune"
+#define TUNE_SERVICE "builder-tune.service"
+#define TUNE_UNIT "/etc/systemd/system/" TUNE_SERVICE
+#define TUNE_IRQ_PATTERN "nvme|eth|enP|r8169|r8125" // NVMe queues and the RTL8125 NICs
+#define MAX_STAGE_DEPS 3
+#define JOBS_AUTO -1
+#define MB_PER_JOB 512        // Peak RSS of a typical arm64 kernel compile job
+#define MB_PER_JOB_HEAVY 1024 // With BTF or LTO enabled
+#define MB_PER_LINK_JOB 1024  // Module final link (modpost, .ko link) in --low-memory mode
+#define MEMORY_SAMPLE_MS 500
 #define MAX_CMD_LEN 2048
 #define MAX_PATH_LEN 512
+#define MAX_ARGS 64
 
 // Color codes for output
 #define COLOR_RESET   "\033[0m"
@@ -26,795 +125,7926 @@
 #define COLOR_CYAN    "\033[36m"
 #define COLOR_BOLD    "\033[1m"
 
+// Named list of Kconfig options, written out as <objdir>/fragments/<name>.config
+typedef struct {
+    const char *name;
+    const char *const *options;
+} config_fragment_t;
+
+// Remote compile host from --build-hosts ("name[:port][/slots]")
+typedef struct {
+    char name[128];
+    int port;
+    int slots;
+} build_host_t;
+
+// Kernel flavour with its own object directory (make O=<build_dir>/out/<name>)
+typedef struct {
+    const char *name;
+    const char *description;
+    const config_fragment_t *fragments[3]; // Merged over the defconfig in order
+    const char *localversion;      // Appended to the kernel release
+    const char *image_suffix;      // /boot/vmlinuz-<version><suffix>
+    int gpu;                       // Uses the Mali GPU userspace stack
+} build_profile_t;
+
 // Structure to hold configuration
 typedef struct {
     char kernel_version[64];
     char build_dir[MAX_PATH_LEN];
+    char cache_dir[MAX_PATH_LEN];
     char cross_compile[128];
     char arch[16];
     char defconfig[64];
     int jobs;
+    double load_limit;
     int verbose;
     int clean_build;
     int install_gpu_blobs;
     int enable_opencl;
     int enable_vulkan;
+    int incremental;
+    char compiler_cache[16];
+    char compiler_cache_dir[MAX_PATH_LEN];
+    char compiler_cache_size[16];
+    int single_make;
+    char blob_manifest[MAX_PATH_LEN];
+    int record_blob_pins;          // Pin blobs that have no pin yet to what was downloaded
+    char report_file[MAX_PATH_LEN];
+    char kernel_ref[64];
+    int bench_runs;
+    char bench_baseline[MAX_PATH_LEN];
+    char gpu_baseline[MAX_PATH_LEN]; // --gpu-bench baseline (default <cache-dir>/gpu-baseline.tsv)
+    char runtime_tune[16];         // "", performance, balanced or powersave
+    int low_memory;                // Native build on a small board: see --low-memory
+    int link_jobs;                 // make -j for the module link step in low-memory mode
+    char zram_swap[16];            // --zram-swap size in MB, "auto" or "" (none)
+    char zram_device[32];          // Swap device created for this run, removed at exit
+    char artifact_cache[MAX_PATH_LEN]; // Built kernels by input hash, "none" to disable
+    char profiles[128];            // Comma-separated profile names from --profile
+    const build_profile_t *profile_list[MAX_PROFILES];
+    int profile_count;
+    int parallel_profiles;         // Build profiles concurrently, splitting -j
+    const build_profile_t *profile; // Profile the current stage builds
+    const config_fragment_t *preempt; // --preempt override, merged after the profile
+    const config_fragment_t *debug_info; // --debug-info override (NULL keeps the defconfig's)
+    int tune_cpu;                  // KCFLAGS tuned for the Cortex-A76 cores
+    char toolchain[8];             // gcc or llvm (LLVM=1 with ThinLTO)
+    char pgo[16];                  // "", instrument or use (Clang AutoFDO)
+    char pgo_profile[MAX_PATH_LEN]; // AutoFDO profile for --pgo use
+    char objdir[MAX_PATH_LEN + 64];
+    char scratch[MAX_PATH_LEN];    // --scratch: disk, auto, tmpfs or a directory
+    char scratch_root[MAX_PATH_LEN + 32]; // Parent of the per-profile object directories
+    int scratch_tmpfs;             // scratch_root is a RAM-backed tmpfs
+    double apt_ttl_hours;          // Package lists younger than this skip apt update
+    char distributed[8];           // "", distcc or icecc
+    char build_hosts_spec[512];    // --build-hosts list
+    build_host_t build_hosts[MAX_BUILD_HOSTS + 1]; // Reachable hosts, then localhost
+    int build_host_count;
+    int bundle;                    // Package the primary profile as a versioned bundle
+    char deploy_hosts[MAX_CMD_LEN]; // --deploy: host list or @file
+    int deploy_jobs;               // Boards installed concurrently
+    int deb;                       // Package with bindeb-pkg and install through dpkg
+    char deb_compress[8];          // KDEB_COMPRESS: zstd, xz, gzip or none
+    char initramfs_compress[8];    // "" (system default), lz4, zstd, gzip or xz
+    char initramfs_modules[8];     // "" (system default), most, dep or loaded
+    int module_strip;              // INSTALL_MOD_STRIP: drop debug info from installed modules
+    char module_compress[8];       // Installed module compression: zstd, xz or none
+    char user_fragments[MAX_USER_FRAGMENTS][MAX_PATH_LEN]; // --config-fragment files
+    int user_fragment_count;
 } build_config_t;
 
+// --gpu-bench results; zero where a test did not run
+typedef struct {
+    char opencl_device[128];
+    char vulkan_device[128];
+    double sgemm_gflops;
+    double opencl_gbs;             // Copy kernel bandwidth, read plus write
+    double vulkan_gbs;             // vkCmdCopyBuffer bandwidth, read plus write
+    double vulkan_gflops;          // Compute shader multiply-add throughput
+    long freq_seen_mhz;            // Highest devfreq clock sampled during the runs
+} gpu_bench_t;
+
+// Wall time and resource usage of one finished process (or stage)
+typedef struct {
+    double wall_seconds;
+    double user_seconds;
+    double sys_seconds;
+    long max_rss_kb;
+} resource_usage_t;
+
+// Mali artifact fetched into MALI_DIR and pinned by SHA-256
+typedef struct {
+    const char *file;
+    const char *url;
+    const char *sha256;  // Shipped pin; NULL until one has been recorded
+    const char *description;
+    int required;      // Failure aborts the build
+    int vulkan_only;   // Only fetched with Vulkan enabled
+} mali_blob_t;
+
+// Download running in a background process (blob is NULL for the
+// libmali-src clone)
+typedef struct {
+    pid_t pid;
+    const mali_blob_t *blob;
+} download_job_t;
+
+// Pipeline stage states
+typedef enum {
+    STAGE_PENDING,
+    STAGE_RUNNING,
+    STAGE_DONE,
+    STAGE_SKIPPED,
+    STAGE_FAILED
+} stage_state_t;
+
+// Node of the build pipeline dependency graph
+typedef struct {
+    const char *name;
+    const char *deps[MAX_STAGE_DEPS];
+    int (*run)(build_config_t *config);
+    int inline_stage;   // Runs in the main process because it updates config
+    int tracked;        // Recorded in the stage manifest for --incremental
+    int enabled;
+    stage_state_t state;
+    pid_t pid;
+    char log_path[MAX_PATH_LEN + 64];
+    int profile;        // Index into profile_list (0 = primary profile)
+    FILE *log;          // Stage output being echoed to the terminal
+    struct timespec started;
+    resource_usage_t usage;
+} pipeline_stage_t;
+
+// Incremental SHA-256 state
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t used;
+} sha256_ctx_t;
+
+// Compiler cache hit/miss counters
+typedef struct {
+    long hits;
+    long misses;
+} compiler_cache_stats_t;
+
+// Message levels, lowest first. The terminal shows messages at or above
+// the console level; the build log gets everything.
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_SUCCESS,
+    LOG_PROGRESS, // Per-stage progress, shown by --quiet
+    LOG_WARNING,
+    LOG_ERROR
+} log_level_t;
+
+// Per-stage input digest as recorded in the build directory state manifest
+typedef struct {
+    char name[32];
+    unsigned long long digest;
+} stage_record_t;
+
+typedef struct {
+    stage_record_t records[MAX_STAGES];
+    int count;
+} stage_manifest_t;
+
 // Function prototypes
+void log_message(const char *level, const char *message);
+void log_write(const char *data, size_t len);
+int log_open(const char *path);
+void log_start_writer(void);
+void log_flush(void);
+void log_close(void);
+void log_set_quiet(int quiet);
+int log_quiet(void);
+void log_status(const char *line);
+void log_clear_status(void);
+void progress_feed(const char *data, size_t len);
 int execute_command(const char *cmd, int show_output);
+int find_in_path(const char *name);
+int run_command(char *const argv[], int show_output, resource_usage_t *usage);
+void record_command_usage(const char *cmd, int status, const resource_usage_t *usage);
+void record_downloaded_bytes(long long bytes);
+long long directory_size(const char *path);
+long long tree_size(const char *path);
+int write_build_report(build_config_t *config, pipeline_stage_t *stages, int count,
+                       double wall_seconds, int success);
+int copy_file(const char *src, const char *dest);
+int files_identical(const char *a, const char *b);
+int force_symlink(const char *target, const char *link_path);
 int check_root_permissions(void);
-int setup_build_environment(void);
-int install_prerequisites(void);
+int prepare_build_directory(build_config_t *config);
+int setup_build_environment(build_config_t *config);
+int install_prerequisites(build_config_t *config);
+int missing_prerequisites(const char **missing, int max);
+double package_lists_age_hours(build_config_t *config);
 int download_kernel_source(build_config_t *config);
-int download_ubuntu_rockchip_patches(void);
+int download_ubuntu_rockchip_patches(build_config_t *config);
+int fetch_cached_repo(build_config_t *config, const char *url, const char *ref, const char *dest);
 int download_mali_blobs(build_config_t *config);
+int start_mali_blob_downloads(build_config_t *config);
+int finish_mali_blob_downloads(build_config_t *config);
+int download_file_resumable(const char *url, const char *dest);
+int read_blob_pin(build_config_t *config, const mali_blob_t *blob, char *pin);
+int record_blob_pin(build_config_t *config, const char *file, const char *hex);
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const unsigned char *data, size_t len);
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[32]);
+int sha256_file(const char *path, char *hex);
 int install_mali_drivers(build_config_t *config);
 int setup_opencl_support(build_config_t *config);
 int setup_vulkan_support(build_config_t *config);
 int configure_kernel(build_config_t *config);
 int build_kernel(build_config_t *config);
 int install_kernel(build_config_t *config);
+int stage_modules(build_config_t *config, const char *root, const char *release);
+int swap_modules(const char *staged, const char *live);
+int kernel_release(build_config_t *config, char *release, size_t size);
+int bundle_path(build_config_t *config, char *path, size_t size);
+int create_bundle(build_config_t *config);
+int export_debug_info(build_config_t *config);
+int build_kernel_packages(build_config_t *config);
+int install_kernel_packages(build_config_t *config);
+void initramfs_script(build_config_t *config, const char *release, const char *image, char *script, size_t size);
+int generate_initramfs(build_config_t *config, const char *release, const char *image);
+int deploy_bundle(build_config_t *config);
 int cleanup_build(build_config_t *config);
+int setup_compiler_cache(build_config_t *config);
+int read_compiler_cache_stats(build_config_t *config, compiler_cache_stats_t *stats);
+void print_compiler_cache_summary(build_config_t *config, compiler_cache_stats_t *before);
+void build_make_command(build_config_t *config, char *cmd, size_t size, const char *targets);
+int probe_tcp_host(const char *host, int port, int timeout_ms, double *latency_ms);
+int setup_distributed_build(build_config_t *config);
+void finish_build_host_monitor(build_config_t *config);
+void start_memory_monitor(pid_t *pid, int *fd);
+void finish_memory_monitor(pid_t pid, int fd);
+int setup_zram_swap(build_config_t *config);
+void remove_zram_swap(build_config_t *config);
+int kernel_config_enabled(build_config_t *config, const char *symbol);
+long read_meminfo_mb(const char *key);
+int read_cgroup_cpu_limit(void);
+void auto_tune_jobs(build_config_t *config);
+void apply_low_memory(build_config_t *config);
+void set_reproducible_env(build_config_t *config);
+int artifact_key(build_config_t *config, char *key);
+int run_daemon(const char *socket_path, int argc, char *argv[]);
+int submit_build(const char *socket_path, int argc, char *argv[]);
+int check_job_options(char *const args[], int count, char *error, size_t size);
+int restore_artifacts(build_config_t *config, const char *key);
+int store_artifacts(build_config_t *config, const char *key);
+long free_space_mb(const char *path);
+int find_mount(const char *path, char *device, size_t device_size,
+               char *mount_point, size_t mount_size, char *fstype, size_t fstype_size);
+int setup_scratch(build_config_t *config);
+int spill_scratch(build_config_t *config);
+int preserve_artifacts(build_config_t *config);
+double elapsed_seconds(const struct timespec *start);
+double seconds_until_mtime(const char *path, const struct timespec *start);
+double target_completion_time(const char *target, const struct timespec *start);
+void report_build_timing(build_config_t *config, const struct timespec *wall_start,
+                         const double *make_seconds, double total);
 void print_usage(const char *program_name);
 void print_header(void);
 void log_message(const char *level, const char *message);
 int create_directory(const char *path);
 int check_dependencies(void);
 int verify_gpu_installation(void);
+int run_gpu_benchmark(build_config_t *config);
+int write_tuning_profile(build_config_t *config, const char *root);
+int install_tuning_profile(build_config_t *config);
+int enter_kernel_tree(build_config_t *config);
+int parse_profiles(build_config_t *config);
+void select_profile(build_config_t *config, int index);
+int get_source_commit(build_config_t *config, char *commit, size_t size);
+unsigned long long fnv1a_hash(const char *data);
+unsigned long long digest_string(unsigned long long hash, const char *data);
+unsigned long long digest_int(unsigned long long hash, long value);
+unsigned long long digest_file(unsigned long long hash, const char *path);
+unsigned long long compute_stage_digest(build_config_t *config, const char *stage);
+int load_stage_manifest(build_config_t *config);
+int save_stage_manifest(build_config_t *config);
+int stage_needs_run(build_config_t *config, const char *stage, const char *output);
+void stage_completed(build_config_t *config, const char *stage);
+void stage_output_path(build_config_t *config, const char *stage, char *path, size_t size);
+int run_pipeline(build_config_t *config, int no_install, int verify_gpu);
+int run_benchmark(build_config_t *config, int argc, char *argv[]);
 
 // Global variables
-FILE *log_fp = NULL;
+stage_manifest_t stage_manifest = {0};
+compiler_cache_stats_t compiler_cache_baseline = {0};
+char telemetry_file[MAX_PATH_LEN + 64] = ""; // Per-stage command/download records
+pid_t build_host_monitor = 0;          // distccmon-text sampler, see setup_distributed_build()
+int build_host_monitor_fd = -1;
+download_job_t download_jobs[MAX_DOWNLOADS];
+int download_job_count = 0;
 
-// Logging function
-void log_message(const char *level, const char *message) {
-    time_t now;
-    char *timestamp;
+// A blob is only installed when it matches its pin, taken from
+// --blob-manifest or else from this table. Fill a missing pin from a trusted
+// download: --record-blob-pins writes what it fetched into the manifest.
+static const mali_blob_t mali_blobs[] = {
+    { "mali_csffw.bin",
+      "https://github.com/JeffyCN/mirrors/raw/libmali/firmware/g610/mali_csffw.bin",
+      NULL,
+      "Mali CSF firmware", 1, 0 },
+    { "libmali-valhall-g610-g6p0-x11-wayland-gbm.so",
+      "https://github.com/JeffyCN/mirrors/raw/libmali/lib/aarch64-linux-gnu/libmali-valhall-g610-g6p0-x11-wayland-gbm.so",
+      NULL,
+      "Mali userspace driver", 1, 0 },
+    { "libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so",
+      "https://github.com/JeffyCN/mirrors/raw/libmali/lib/aarch64-linux-gnu/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so",
+      NULL,
+      "Mali Vulkan-enabled driver", 0, 1 },
+    { NULL, NULL, NULL, NULL, 0, 0 }
+};
+
+// Build log. Messages and command output are queued in a ring buffer and
+// written by a background thread, so a slow SD card never stalls the build.
+// A forked child has no writer thread and writes synchronously until it
+// calls log_start_writer(). The fork handlers drain the ring first, so
+// nothing is written twice.
+static struct {
+    pthread_mutex_t lock;       // Ring state
+    pthread_mutex_t write_lock; // Held while writing to fd; always taken before lock
+    pthread_cond_t queued;
+    pthread_cond_t drained;
+    char ring[LOG_RING_SIZE];
+    size_t head, tail;          // Bytes ever queued/written; the ring index is % LOG_RING_SIZE
+    int fd;
+    int writer;                 // A writer thread runs in this process
+    int stop;
+    pthread_t thread;
+    struct timespec epoch;      // Monotonic timestamps in the log count from here
+    log_level_t console_level;
+    char path[MAX_PATH_LEN];
+} build_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .write_lock = PTHREAD_MUTEX_INITIALIZER,
+    .queued = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+    .console_level = LOG_INFO
+};
+
+static log_level_t log_level_of(const char *name) {
+    switch (name[0]) {
+    case 'D': return LOG_DEBUG;
+    case 'S': return LOG_SUCCESS;
+    case 'P': return LOG_PROGRESS;
+    case 'W': return LOG_WARNING;
+    case 'E': return LOG_ERROR;
+    default:  return LOG_INFO;
+    }
+}
+
+static void log_write_all(const char *data, size_t len) {
+    ssize_t written;
     
-    time(&now);
-    timestamp = ctime(&now);
-    timestamp[strlen(timestamp) - 1] = '\0'; // Remove newline
+    while (len > 0) {
+        written = write(build_log.fd, data, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Called with write_lock held after each write. Once the log passes
+// LOG_MAX_BYTES it becomes LOG_FILE.1; the previous .1 is compressed in the
+// background (a process that still has it open may yet append to .1). The
+// flock makes one process rotate; the others see the new inode and reopen.
+static void log_rotate(void) {
+    char from[MAX_PATH_LEN + 16], to[MAX_PATH_LEN + 16];
+    char cmd[MAX_CMD_LEN];
+    struct stat st, current;
+    char *argv[] = { "/bin/sh", "-c", cmd, NULL };
+    pid_t pid;
+    int i;
     
-    printf("[%s%s%s] %s%s%s\n", 
-           COLOR_CYAN, timestamp, COLOR_RESET,
-           strcmp(level, "ERROR") == 0 ? COLOR_RED : 
-           strcmp(level, "SUCCESS") == 0 ? COLOR_GREEN :
-           strcmp(level, "WARNING") == 0 ? COLOR_YELLOW : COLOR_RESET,
-           message, COLOR_RESET);
+    if (fstat(build_log.fd, &st) != 0) {
+        return;
+    }
+    if (stat(build_log.path, &current) == 0 && current.st_ino == st.st_ino) {
+        if (st.st_size < LOG_MAX_BYTES || flock(build_log.fd, LOCK_EX) != 0) {
+            return;
+        }
+        if (stat(build_log.path, &current) == 0 && current.st_ino == st.st_ino) {
+            for (i = LOG_KEEP - 1; i >= 2; i--) {
+                snprintf(from, sizeof(from), "%s.%d.zst", build_log.path, i);
+                snprintf(to, sizeof(to), "%s.%d.zst", build_log.path, i + 1);
+                rename(from, to);
+            }
+            snprintf(from, sizeof(from), "%s.1", build_log.path);
+            snprintf(to, sizeof(to), "%s.2", build_log.path);
+            if (rename(from, to) == 0) {
+                // posix_spawn runs no fork handlers, so this is safe here
+                snprintf(cmd, sizeof(cmd), "zstd -q --rm -f %s -o %s.zst 2>/dev/null &", to, to);
+                if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) == 0) {
+                    waitpid(pid, NULL, 0);
+                }
+            }
+            rename(build_log.path, from);
+        }
+        flock(build_log.fd, LOCK_UN);
+    }
     
-    if (log_fp) {
-        fprintf(log_fp, "[%s] [%s] %s\n", timestamp, level, message);
-        fflush(log_fp);
+    // Rotated, by us or another process
+    i = open(build_log.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (i >= 0) {
+        dup2(i, build_log.fd);
+        close(i);
     }
 }
 
-// Execute command with logging
-int execute_command(const char *cmd, int show_output) {
-    char log_cmd[MAX_CMD_LEN + 100];
-    int result;
+static void *log_writer(void *arg) {
+    size_t start, len;
     
-    if (show_output) {
-        printf("%s%s%s\n", COLOR_BLUE, cmd, COLOR_RESET);
-        snprintf(log_cmd, sizeof(log_cmd), "%s 2>&1 | tee -a %s", cmd, LOG_FILE);
-    } else {
-        snprintf(log_cmd, sizeof(log_cmd), "%s >> %s 2>&1", cmd, LOG_FILE);
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&build_log.lock);
+        while (build_log.head == build_log.tail && !build_log.stop) {
+            pthread_cond_wait(&build_log.queued, &build_log.lock);
+        }
+        if (build_log.head == build_log.tail) {
+            pthread_mutex_unlock(&build_log.lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&build_log.lock);
+        
+        // Producers only append at head, so [tail, head) is stable unlocked
+        pthread_mutex_lock(&build_log.write_lock);
+        pthread_mutex_lock(&build_log.lock);
+        start = build_log.tail % LOG_RING_SIZE;
+        len = build_log.head - build_log.tail;
+        if (start + len > LOG_RING_SIZE) {
+            len = LOG_RING_SIZE - start;
+        }
+        pthread_mutex_unlock(&build_log.lock);
+        
+        log_write_all(build_log.ring + start, len);
+        
+        pthread_mutex_lock(&build_log.lock);
+        build_log.tail += len;
+        pthread_cond_broadcast(&build_log.drained);
+        pthread_mutex_unlock(&build_log.lock);
+        log_rotate();
+        pthread_mutex_unlock(&build_log.write_lock);
     }
+}
+
+// Append raw bytes to the build log. Blocks only while the ring is full.
+void log_write(const char *data, size_t len) {
+    size_t start, room, chunk;
     
-    result = system(log_cmd);
+    if (build_log.fd < 0 || len == 0) {
+        return;
+    }
+    if (!build_log.writer) {
+        pthread_mutex_lock(&build_log.write_lock);
+        log_write_all(data, len);
+        log_rotate();
+        pthread_mutex_unlock(&build_log.write_lock);
+        return;
+    }
     
-    if (result != 0) {
-        log_message("ERROR", "Command failed");
-        return -1;
+    pthread_mutex_lock(&build_log.lock);
+    while (len > 0) {
+        while (build_log.head - build_log.tail == LOG_RING_SIZE) {
+            pthread_cond_wait(&build_log.drained, &build_log.lock);
+        }
+        start = build_log.head % LOG_RING_SIZE;
+        room = LOG_RING_SIZE - (build_log.head - build_log.tail);
+        chunk = len < room ? len : room;
+        if (chunk > LOG_RING_SIZE - start) {
+            chunk = LOG_RING_SIZE - start;
+        }
+        memcpy(build_log.ring + start, data, chunk);
+        build_log.head += chunk;
+        data += chunk;
+        len -= chunk;
+        pthread_cond_signal(&build_log.queued);
     }
+    pthread_mutex_unlock(&build_log.lock);
+}
+
+// Fork handlers: no writer mid-chunk, and an empty ring on both sides
+static void log_before_fork(void) {
+    size_t start, len;
     
-    return 0;
+    pthread_mutex_lock(&build_log.write_lock);
+    pthread_mutex_lock(&build_log.lock);
+    while (build_log.fd >= 0 && build_log.head != build_log.tail) {
+        start = build_log.tail % LOG_RING_SIZE;
+        len = build_log.head - build_log.tail;
+        if (start + len > LOG_RING_SIZE) {
+            len = LOG_RING_SIZE - start;
+        }
+        log_write_all(build_log.ring + start, len);
+        build_log.tail += len;
+    }
+    build_log.tail = build_log.head;
 }
 
-// Check if running as root
-int check_root_permissions(void) {
-    if (geteuid() != 0) {
-        log_message("ERROR", "This tool requires root privileges. Please run with sudo.");
+static void log_after_fork_parent(void) {
+    pthread_cond_broadcast(&build_log.drained);
+    pthread_mutex_unlock(&build_log.lock);
+    pthread_mutex_unlock(&build_log.write_lock);
+}
+
+static void log_after_fork_child(void) {
+    build_log.writer = 0;
+    build_log.stop = 0;
+    pthread_mutex_unlock(&build_log.lock);
+    pthread_mutex_unlock(&build_log.write_lock);
+}
+
+// Open (append to) the build log and start its writer thread
+int log_open(const char *path) {
+    static int handlers_installed = 0;
+    char header[MAX_PATH_LEN + 96];
+    char when[64];
+    time_t now = time(NULL);
+    int len;
+    
+    snprintf(build_log.path, sizeof(build_log.path), "%s", path);
+    build_log.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (build_log.fd < 0) {
         return -1;
     }
+    if (!handlers_installed) {
+        pthread_atfork(log_before_fork, log_after_fork_parent, log_after_fork_child);
+        // Every return from main drains the ring, not just the ones that
+        // remember to call log_close()
+        atexit(log_close);
+        handlers_installed = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &build_log.epoch);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S %Z", localtime(&now));
+    len = snprintf(header, sizeof(header), "=== builder %s, pid %d, started %s ===\n", VERSION, (int)getpid(), when);
+    log_write(header, len);
+    log_start_writer();
     return 0;
 }
 
-// Create directory if it doesn't exist
-int create_directory(const char *path) {
-    struct stat st = {0};
-    
-    if (stat(path, &st) == -1) {
-        if (mkdir(path, 0755) != 0) {
-            char error_msg[512];
-            snprintf(error_msg, sizeof(error_msg), "Failed to create directory: %s", path);
-            log_message("ERROR", error_msg);
-            return -1;
-        }
+// Give this process its own writer thread (forked children start without)
+void log_start_writer(void) {
+    if (build_log.fd < 0 || build_log.writer) {
+        return;
+    }
+    if (pthread_create(&build_log.thread, NULL, log_writer, NULL) == 0) {
+        build_log.writer = 1;
     }
-    return 0;
 }
 
-// Setup build environment
-int setup_build_environment(void) {
-    log_message("INFO", "Setting up build environment...");
+// Wait until everything queued so far is on disk
+void log_flush(void) {
+    if (!build_log.writer) {
+        return;
+    }
+    pthread_mutex_lock(&build_log.lock);
+    while (build_log.tail != build_log.head) {
+        pthread_cond_wait(&build_log.drained, &build_log.lock);
+    }
+    pthread_mutex_unlock(&build_log.lock);
+}
+
+void log_close(void) {
+    if (build_log.writer) {
+        pthread_mutex_lock(&build_log.lock);
+        build_log.stop = 1;
+        pthread_cond_signal(&build_log.queued);
+        pthread_mutex_unlock(&build_log.lock);
+        pthread_join(build_log.thread, NULL);
+        build_log.writer = 0;
+    }
+    if (build_log.fd >= 0) {
+        close(build_log.fd);
+        build_log.fd = -1;
+    }
+}
+
+// Single status line at the bottom of the terminal (the build progress
+// bar). Anything else printed to the terminal clears it first.
+static int status_shown = 0;
+
+void log_status(const char *line) {
+    printf("\r\033[K%s", line);
+    fflush(stdout);
+    status_shown = 1;
+}
+
+void log_clear_status(void) {
+    if (status_shown) {
+        printf("\r\033[K");
+        status_shown = 0;
+    }
+}
+
+// --quiet: the terminal only shows progress, warnings and errors
+void log_set_quiet(int quiet) {
+    build_log.console_level = quiet ? LOG_PROGRESS : LOG_INFO;
+}
+
+int log_quiet(void) {
+    return build_log.console_level > LOG_INFO;
+}
+
+// Logging function
+void log_message(const char *level, const char *message) {
+    static const char *const colors[] = { COLOR_RESET, COLOR_RESET, COLOR_GREEN, COLOR_BOLD, COLOR_YELLOW, COLOR_RED };
+    static const char *const names[] = { "DEBUG", "INFO", "SUCCESS", "PROGRESS", "WARNING", "ERROR" };
+    static time_t shown = 0;
+    static char timestamp[32];
+    log_level_t value = log_level_of(level);
+    char line[MAX_CMD_LEN + 128];
+    struct timespec now;
+    time_t wall = time(NULL);
+    int len;
     
-    // Create build directory
-    if (create_directory(BUILD_DIR) != 0) {
-        return -1;
+    if (value >= build_log.console_level) {
+        // Formatted once per second
+        if (wall != shown) {
+            strftime(timestamp, sizeof(timestamp), "%a %b %e %H:%M:%S %Y", localtime(&wall));
+            shown = wall;
+        }
+        log_clear_status();
+        printf("[%s%s%s] %s%s%s\n", COLOR_CYAN, timestamp, COLOR_RESET, colors[value], message, COLOR_RESET);
     }
     
-    // Open log file
-    log_fp = fopen(LOG_FILE, "a");
-    if (!log_fp) {
-        log_message("WARNING", "Could not open log file");
+    if (build_log.fd >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        len = snprintf(line, sizeof(line), "[+%.3f] [%s] %s\n",
+                       (now.tv_sec - build_log.epoch.tv_sec) + (now.tv_nsec - build_log.epoch.tv_nsec) / 1e9,
+                       names[value], message);
+        log_write(line, len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1);
     }
+}
+
+// Run argv directly (no shell), streaming its stdout/stderr into the build
+// log and, when show_output is set, the terminal. Returns the exit status,
+// 128+signal if it was killed, or -1 if it could not be started. usage, if
+// given, receives the command's wall time and rusage.
+int run_command(char *const argv[], int show_output, resource_usage_t *usage) {
+    posix_spawn_file_actions_t actions;
+    struct timespec start;
+    struct rusage ru;
+    char buffer[4096];
+    char msg[MAX_PATH_LEN];
+    ssize_t bytes;
+    pid_t pid;
+    int pipefd[2];
+    int status, err;
     
-    // Update package lists
-    if (execute_command("apt update", 1) != 0) {
-        log_message("ERROR", "Failed to update package lists");
+    if (pipe(pipefd) != 0) {
+        log_message("ERROR", "Failed to create command output pipe");
         return -1;
     }
     
-    log_message("SUCCESS", "Build environment setup completed");
-    return 0;
-}
-
-// Install build prerequisites
-int install_prerequisites(void) {
-    log_message("INFO", "Installing build prerequisites...");
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipefd[1]);
     
-    const char *packages[] = {
-        // Basic build tools
-        "build-essential",
-        "gcc-aarch64-linux-gnu",
-        "g++-aarch64-linux-gnu",
-        "libncurses-dev",
-        "gawk",
-        "flex",
-        "bison",
-        "openssl",
-        "libssl-dev",
-        "dkms",
-        "libelf-dev",
-        "libudev-dev",
-        "libpci-dev",
-        "libiberty-dev",
-        "autoconf",
-        "llvm",
-        // Additional tools
-        "git",
-        "wget",
-        "curl",
-        "bc",
-        "rsync",
-        "kmod",
-        "cpio",
-        "python3",
-        "python3-pip",
-        "device-tree-compiler",
-        // Ubuntu kernel build dependencies
-        "fakeroot",
-        "kernel-package",
-        "pkg-config-dbgsym",
-        // Mali GPU and OpenCL/Vulkan support
-        "mesa-opencl-icd",
-        "vulkan-tools",
-        "vulkan-utils",
-        "vulkan-validationlayers",
-        "libvulkan-dev",
-        "ocl-icd-opencl-dev",
-        "opencl-headers",
-        "clinfo",
-        // Media and hardware acceleration
-        "va-driver-all",
-        "vdpau-driver-all",
-        "mesa-va-drivers",
-        "mesa-vdpau-drivers",
-        // Development libraries
-        "libegl1-mesa-dev",
-        "libgles2-mesa-dev",
-        "libgl1-mesa-dev",
-        "libdrm-dev",
-        "libgbm-dev",
-        "libwayland-dev",
-        "libx11-dev",
-        "meson",
-        "ninja-build",
-        NULL
-    };
+    fflush(stdout);
+    show_output = show_output && !log_quiet();
     
-    char cmd[MAX_CMD_LEN * 2];
-    int i;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
     
-    // Install all packages at once
-    strcpy(cmd, "DEBIAN_FRONTEND=noninteractive apt install -y");
-    for (i = 0; packages[i] != NULL; i++) {
-        strcat(cmd, " ");
-        strcat(cmd, packages[i]);
+    if (err != 0) {
+        close(pipefd[0]);
+        snprintf(msg, sizeof(msg), "Failed to start %s: %s", argv[0], strerror(err));
+        log_message("ERROR", msg);
+        return -1;
     }
     
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to install prerequisites");
-        return -1;
+    while ((bytes = read(pipefd[0], buffer, sizeof(buffer))) != 0) {
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        log_write(buffer, bytes);
+        progress_feed(buffer, bytes);
+        if (show_output) {
+            fwrite(buffer, 1, bytes, stdout);
+            fflush(stdout);
+        }
     }
+    close(pipefd[0]);
     
-    // Install additional Ubuntu kernel build dependencies
-    if (execute_command("apt build-dep -y linux linux-image-unsigned-$(uname -r)", 1) != 0) {
-        log_message("WARNING", "Failed to install some kernel build dependencies");
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            log_message("ERROR", "Failed to wait for command");
+            return -1;
+        }
     }
     
-    log_message("SUCCESS", "Prerequisites installed successfully");
+    if (WIFEXITED(status)) {
+        status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        status = 128 + WTERMSIG(status);
+    }
+    
+    if (usage) {
+        usage->wall_seconds = elapsed_seconds(&start);
+        usage->user_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        usage->sys_seconds = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        usage->max_rss_kb = ru.ru_maxrss;
+    }
+    
+    bytes = snprintf(msg, sizeof(msg), "[exit %d after %.1fs] %s\n", status, elapsed_seconds(&start), argv[0]);
+    log_write(msg, bytes < (ssize_t)sizeof(msg) ? (size_t)bytes : sizeof(msg) - 1);
+    
+    return status;
+}
+
+// Check whether an executable is on PATH without forking a shell
+int find_in_path(const char *name) {
+    char path[MAX_PATH_LEN];
+    const char *dirs = getenv("PATH");
+    const char *end;
+    size_t len;
+    
+    if (!dirs) {
+        dirs = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+    }
+    while (*dirs) {
+        end = strchr(dirs, ':');
+        len = end ? (size_t)(end - dirs) : strlen(dirs);
+        // Entries too long to hold are skipped rather than probed truncated
+        if (snprintf(path, sizeof(path), "%.*s/%s", (int)len, len ? dirs : ".", name) < (int)sizeof(path) &&
+            access(path, X_OK) == 0) {
+            return 1;
+        }
+        dirs += len + (end ? 1 : 0);
+    }
     return 0;
 }
 
-// Download kernel source
-int download_kernel_source(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
-    char source_dir[MAX_PATH_LEN];
+// Execute command with logging. Plain commands are split on whitespace and
+// spawned directly; anything using shell syntax goes through /bin/sh -c.
+int execute_command(const char *cmd, int show_output) {
+    char buffer[MAX_CMD_LEN];
+    char msg[MAX_CMD_LEN + 64];
+    char *argv[MAX_ARGS];
+    const char *first_space;
+    char *token;
+    resource_usage_t usage;
+    int argc = 0;
+    int result;
     
-    log_message("INFO", "Downloading kernel source...");
+    if (show_output && !log_quiet()) {
+        printf("%s%s%s\n", COLOR_BLUE, cmd, COLOR_RESET);
+    }
+    log_write("$ ", 2);
+    log_write(cmd, strlen(cmd));
+    log_write("\n", 1);
     
-    snprintf(source_dir, sizeof(source_dir), "%s/linux", config->build_dir);
+    // Shell metacharacters, or a leading VAR=value assignment
+    first_space = strpbrk(cmd, " \t");
+    if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]{}~#\n") ||
+        (strchr(cmd, '=') && (!first_space || strchr(cmd, '=') < first_space)) ||
+        strlen(cmd) >= sizeof(buffer)) {
+        argv[argc++] = "/bin/sh";
+        argv[argc++] = "-c";
+        argv[argc++] = (char *)cmd;
+    } else {
+        strcpy(buffer, cmd);
+        for (token = strtok(buffer, " \t"); token && argc < MAX_ARGS - 1; token = strtok(NULL, " \t")) {
+            argv[argc++] = token;
+        }
+        // More words than argv holds: let the shell split them
+        if (token) {
+            argc = 0;
+            argv[argc++] = "/bin/sh";
+            argv[argc++] = "-c";
+            argv[argc++] = (char *)cmd;
+        }
+    }
+    argv[argc] = NULL;
     
-    // Change to build directory
-    if (chdir(config->build_dir) != 0) {
-        log_message("ERROR", "Failed to change to build directory");
-        return -1;
+    if (argc == 0) {
+        return 0;
     }
     
-    // Clone Ubuntu Rockchip kernel source with Mali GPU support
-    snprintf(cmd, sizeof(cmd), 
-             "git clone --depth 1 --branch ubuntu-rockchip-6.8-opi5 "
-             "https://github.com/Joshua-Riek/linux-rockchip.git linux");
+    result = run_command(argv, show_output, &usage);
+    if (result >= 0) {
+        record_command_usage(cmd, result, &usage);
+    }
     
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to clone Ubuntu Rockchip kernel, trying mainline...");
-        
-        // Fallback to mainline kernel
-        snprintf(cmd, sizeof(cmd),
-                 "git clone --depth 1 --branch v%s "
-                 "https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git linux",
-                 config->kernel_version);
-        
-        if (execute_command(cmd, 1) != 0) {
-            log_message("ERROR", "Failed to download kernel source");
-            return -1;
-        }
+    if (result != 0) {
+        snprintf(msg, sizeof(msg), "Command failed with exit code %d: %s", result, cmd);
+        log_message("ERROR", msg);
+        return -1;
     }
     
-    log_message("SUCCESS", "Kernel source downloaded successfully");
     return 0;
 }
 
-// Download Ubuntu Rockchip patches
-int download_ubuntu_rockchip_patches(void) {
-    char cmd[MAX_CMD_LEN];
-    
-    log_message("INFO", "Downloading Ubuntu Rockchip patches...");
+// Append one command's usage to the current stage's telemetry file. Stage
+// processes (and the download workers they fork) share the file, so each
+// record is a single short append.
+void record_command_usage(const char *cmd, int status, const resource_usage_t *usage) {
+    char line[512];
+    FILE *fp;
+    size_t i;
     
-    // Clone Ubuntu Rockchip repository for patches and configs
-    snprintf(cmd, sizeof(cmd),
-             "git clone --depth 1 "
-             "https://github.com/Joshua-Riek/ubuntu-rockchip.git ubuntu-rockchip");
+    if (telemetry_file[0] == '\0') {
+        return;
+    }
     
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to download Ubuntu Rockchip patches");
-        return 0; // Non-critical
+    snprintf(line, sizeof(line), "%s", cmd);
+    for (i = 0; line[i]; i++) {
+        if (line[i] == '\t' || line[i] == '\n') {
+            line[i] = ' ';
+        }
     }
     
-    log_message("SUCCESS", "Ubuntu Rockchip patches downloaded");
-    return 0;
+    fp = fopen(telemetry_file, "a");
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "cmd\t%d\t%.3f\t%.3f\t%.3f\t%ld\t%s\n", status, usage->wall_seconds,
+            usage->user_seconds, usage->sys_seconds, usage->max_rss_kb, line);
+    fclose(fp);
 }
 
-// Download Mali GPU blobs and libraries
-int download_mali_blobs(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
+// Count network bytes fetched by the current stage
+void record_downloaded_bytes(long long bytes) {
+    FILE *fp;
     
-    log_message("INFO", "Downloading Mali G610 GPU blobs and libraries...");
+    if (telemetry_file[0] == '\0' || bytes <= 0) {
+        return;
+    }
     
-    // Create Mali directory
-    if (create_directory("/tmp/mali_install") != 0) {
-        return -1;
+    fp = fopen(telemetry_file, "a");
+    if (!fp) {
+        return;
     }
+    fprintf(fp, "download\t%lld\n", bytes);
+    fclose(fp);
+}
+
+// Total size of the regular files directly inside path
+long long directory_size(const char *path) {
+    char entry_path[MAX_PATH_LEN];
+    struct dirent *entry;
+    struct stat st;
+    long long total = 0;
+    DIR *dir = opendir(path);
     
-    if (chdir("/tmp/mali_install") != 0) {
-        log_message("ERROR", "Failed to change to Mali install directory");
-        return -1;
+    if (!dir) {
+        return 0;
     }
+    while ((entry = readdir(dir)) != NULL) {
+        snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+        if (stat(entry_path, &st) == 0 && S_ISREG(st.st_mode)) {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+// Total size of the regular files below path, not following symlinks
+long long tree_size(const char *path) {
+    char entry_path[MAX_PATH_LEN];
+    struct dirent *entry;
+    struct stat st;
+    long long total = 0;
+    DIR *dir = opendir(path);
     
-    // Download Mali firmware blob
-    log_message("INFO", "Downloading Mali CSF firmware...");
-    snprintf(cmd, sizeof(cmd),
-             "wget -O mali_csffw.bin "
-             "https://github.com/JeffyCN/mirrors/raw/libmali/firmware/g610/mali_csffw.bin");
+    if (!dir) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+        if (lstat(entry_path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            total += tree_size(entry_path);
+        } else if (S_ISREG(st.st_mode)) {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+// Write s as a JSON string literal
+static void json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", *s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// Write the JSON telemetry report: per-stage wall/CPU/peak RSS/downloads,
+// with the commands each stage ran
+int write_build_report(build_config_t *config, pipeline_stage_t *stages, int count,
+                       double wall_seconds, int success) {
+    static const char *state_names[] = { "pending", "running", "done", "skipped", "failed" };
+    char stats_path[MAX_PATH_LEN + 64];
+    char tmp_path[MAX_PATH_LEN + 8];
+    char line[1024];
+    char timestamp[32];
+    char *field[7];
+    long long downloaded, total_downloaded = 0;
+    long max_rss = 0;
+    time_t now = time(NULL);
+    FILE *fp, *stats;
+    int i, n, first;
     
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to download Mali firmware");
+    if (config->report_file[0] == '\0' &&
+        snprintf(config->report_file, sizeof(config->report_file), "%s/%s",
+                 config->build_dir, REPORT_FILE) >= (int)sizeof(config->report_file)) {
+        log_message("WARNING", "Build directory path is too long for the build report");
         return -1;
     }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config->report_file);
     
-    // Download Mali userspace driver library
-    log_message("INFO", "Downloading Mali userspace driver...");
-    snprintf(cmd, sizeof(cmd),
-             "wget -O libmali-valhall-g610-g6p0-x11-wayland-gbm.so "
-             "https://github.com/JeffyCN/mirrors/raw/libmali/lib/aarch64-linux-gnu/libmali-valhall-g610-g6p0-x11-wayland-gbm.so");
-    
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to download Mali userspace driver");
+    fp = fopen(tmp_path, "w");
+    if (!fp) {
+        log_message("WARNING", "Failed to write build report");
         return -1;
     }
     
-    // Download OpenCL/Vulkan capable version if requested
-    if (config->enable_vulkan) {
-        log_message("INFO", "Downloading Mali Vulkan-enabled driver...");
-        snprintf(cmd, sizeof(cmd),
-                 "wget -O libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so "
-                 "https://github.com/JeffyCN/mirrors/raw/libmali/lib/aarch64-linux-gnu/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so");
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"builder_version\": \"%s\",\n", VERSION);
+    fprintf(fp, "  \"kernel_version\": ");
+    json_string(fp, config->kernel_version);
+    fprintf(fp, ",\n  \"finished\": \"%s\",\n", timestamp);
+    fprintf(fp, "  \"result\": \"%s\",\n", success ? "success" : "failed");
+    fprintf(fp, "  \"jobs\": %d,\n", config->jobs);
+    fprintf(fp, "  \"wall_seconds\": %.3f,\n", wall_seconds);
+    fprintf(fp, "  \"stages\": [\n");
+    
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "    {\n      \"name\": \"%s\",\n", stages[i].name);
+        fprintf(fp, "      \"status\": \"%s\",\n", stages[i].enabled ? state_names[stages[i].state] : "disabled");
+        fprintf(fp, "      \"wall_seconds\": %.3f,\n", stages[i].usage.wall_seconds);
+        fprintf(fp, "      \"user_seconds\": %.3f,\n", stages[i].usage.user_seconds);
+        fprintf(fp, "      \"sys_seconds\": %.3f,\n", stages[i].usage.sys_seconds);
+        fprintf(fp, "      \"max_rss_kb\": %ld,\n", stages[i].usage.max_rss_kb);
+        fprintf(fp, "      \"commands\": [");
+        if (stages[i].usage.max_rss_kb > max_rss) {
+            max_rss = stages[i].usage.max_rss_kb;
+        }
         
-        if (execute_command(cmd, 1) != 0) {
-            log_message("WARNING", "Failed to download Mali Vulkan driver, using standard version");
+        downloaded = 0;
+        first = 1;
+        snprintf(stats_path, sizeof(stats_path), "%s/%s/%s.stats", config->build_dir, STAGE_LOG_DIR, stages[i].name);
+        stats = stages[i].state != STAGE_PENDING ? fopen(stats_path, "r") : NULL;
+        while (stats && fgets(line, sizeof(line), stats)) {
+            line[strcspn(line, "\n")] = '\0';
+            field[0] = strtok(line, "\t");
+            for (n = 1; n < 7 && (field[n] = strtok(NULL, n == 6 ? "" : "\t")) != NULL; n++) {
+            }
+            if (field[0] && strcmp(field[0], "download") == 0 && n >= 2) {
+                downloaded += atoll(field[1]);
+            } else if (field[0] && strcmp(field[0], "cmd") == 0 && n == 7) {
+                fprintf(fp, "%s\n        {\"command\": ", first ? "" : ",");
+                json_string(fp, field[6]);
+                fprintf(fp, ", \"exit\": %s, \"wall_seconds\": %s, \"user_seconds\": %s, "
+                        "\"sys_seconds\": %s, \"max_rss_kb\": %s}",
+                        field[1], field[2], field[3], field[4], field[5]);
+                first = 0;
+            }
         }
+        if (stats) {
+            fclose(stats);
+        }
+        total_downloaded += downloaded;
+        
+        fprintf(fp, "%s],\n", first ? "" : "\n      ");
+        fprintf(fp, "      \"downloaded_bytes\": %lld\n", downloaded);
+        fprintf(fp, "    }%s\n", i + 1 < count ? "," : "");
     }
     
-    // Clone libmali repository for additional components
-    log_message("INFO", "Downloading additional Mali components...");
-    snprintf(cmd, sizeof(cmd),
-             "git clone --depth 1 --branch libmali "
-             "https://github.com/tsukumijima/libmali-rockchip.git libmali-src");
+    fprintf(fp, "  ],\n");
+    fprintf(fp, "  \"downloaded_bytes\": %lld,\n", total_downloaded);
+    fprintf(fp, "  \"max_rss_kb\": %ld\n", max_rss);
+    fprintf(fp, "}\n");
     
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to download additional Mali components");
+    if (fclose(fp) != 0 || rename(tmp_path, config->report_file) != 0) {
+        unlink(tmp_path);
+        log_message("WARNING", "Failed to write build report");
+        return -1;
     }
     
-    log_message("SUCCESS", "Mali GPU blobs downloaded successfully");
+    snprintf(line, sizeof(line), "Build report written to %s", config->report_file);
+    log_message("INFO", line);
     return 0;
 }
 
-// Install Mali drivers and setup
-int install_mali_drivers(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
-    
-    log_message("INFO", "Installing Mali G610 drivers and firmware...");
+// Returns 1 when both files exist and have identical contents
+int files_identical(const char *a, const char *b) {
+    char buf_a[65536], buf_b[65536];
+    size_t len_a, len_b;
+    int same = 1;
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
     
-    // Install Mali firmware
-    if (execute_command("cp /tmp/mali_install/mali_csffw.bin /lib/firmware/", 1) != 0) {
-        log_message("ERROR", "Failed to install Mali firmware");
-        return -1;
+    if (!fa || !fb) {
+        same = 0;
     }
-    
-    // Install Mali userspace driver
-    if (execute_command("cp /tmp/mali_install/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/", 1) != 0) {
-        log_message("ERROR", "Failed to install Mali userspace driver");
-        return -1;
+    while (same) {
+        len_a = fread(buf_a, 1, sizeof(buf_a), fa);
+        len_b = fread(buf_b, 1, sizeof(buf_b), fb);
+        if (len_a != len_b || memcmp(buf_a, buf_b, len_a) != 0) {
+            same = 0;
+        } else if (len_a == 0) {
+            break;
+        }
     }
+    if (fa) {
+        fclose(fa);
+    }
+    if (fb) {
+        fclose(fb);
+    }
+    return same;
+}
+
+// Copy a file, replacing the destination atomically. dest may be a directory.
+int copy_file(const char *src, const char *dest) {
+    char path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN + 8];
+    char buffer[65536];
+    const char *base;
+    struct stat st;
+    ssize_t bytes;
+    int in_fd, out_fd;
     
-    // Create symbolic links for different APIs
-    log_message("INFO", "Creating Mali driver symbolic links...");
-    
-    const char *mali_links[] = {
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libMali.so",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libMali.so.1",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libmali.so",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libmali.so.1",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libEGL.so.1",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libGLESv1_CM.so.1",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libGLESv2.so.2",
-        "ln -sf /usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so /usr/lib/libgbm.so.1",
-        NULL
-    };
+    if (stat(dest, &st) == 0 && S_ISDIR(st.st_mode)) {
+        base = strrchr(src, '/');
+        snprintf(path, sizeof(path), "%s/%s", dest, base ? base + 1 : src);
+    } else {
+        snprintf(path, sizeof(path), "%s", dest);
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
     
-    int i;
-    for (i = 0; mali_links[i] != NULL; i++) {
-        if (execute_command(mali_links[i], 0) != 0) {
-            log_message("WARNING", "Failed to create some Mali symbolic links");
-        }
+    in_fd = open(src, O_RDONLY);
+    if (in_fd < 0) {
+        return -1;
+    }
+    if (fstat(in_fd, &st) != 0) {
+        close(in_fd);
+        return -1;
+    }
+    out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (out_fd < 0) {
+        close(in_fd);
+        return -1;
     }
     
-    // Install Vulkan driver if requested
-    if (config->enable_vulkan) {
-        if (access("/tmp/mali_install/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", F_OK) == 0) {
-            log_message("INFO", "Installing Mali Vulkan driver...");
-            if (execute_command("cp /tmp/mali_install/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so /usr/lib/", 1) != 0) {
-                log_message("WARNING", "Failed to install Mali Vulkan driver");
-            } else {
-                // Create Vulkan-specific links
-                execute_command("ln -sf /usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so /usr/lib/libvulkan_mali.so", 0);
-            }
+    while ((bytes = read(in_fd, buffer, sizeof(buffer))) > 0) {
+        if (write(out_fd, buffer, bytes) != bytes) {
+            bytes = -1;
+            break;
         }
     }
+    close(in_fd);
     
-    // Update library cache
-    if (execute_command("ldconfig", 1) != 0) {
-        log_message("WARNING", "Failed to update library cache");
+    if (close(out_fd) != 0 || bytes < 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
     }
     
-    log_message("SUCCESS", "Mali drivers installed successfully");
     return 0;
 }
 
-// Setup OpenCL support
-int setup_opencl_support(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
+// Equivalent of ln -sf, swapping the link in with a rename
+int force_symlink(const char *target, const char *link_path) {
+    char tmp_path[MAX_PATH_LEN + 8];
     
-    if (!config->enable_opencl) {
-        return 0;
-    }
-    
-    log_message("INFO", "Setting up OpenCL support for Mali G610...");
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", link_path);
+    unlink(tmp_path);
     
-    // Create OpenCL vendor directory
-    if (create_directory("/etc/OpenCL/vendors") != 0) {
+    if (symlink(target, tmp_path) != 0) {
         return -1;
     }
-    
-    // Create Mali OpenCL ICD file
-    FILE *icd_file = fopen("/etc/OpenCL/vendors/mali.icd", "w");
-    if (icd_file) {
-        fprintf(icd_file, "/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so\n");
-        fclose(icd_file);
-    } else {
-        log_message("ERROR", "Failed to create Mali OpenCL ICD file");
+    if (rename(tmp_path, link_path) != 0) {
+        unlink(tmp_path);
         return -1;
     }
     
-    // Set permissions
-    execute_command("chmod 644 /etc/OpenCL/vendors/mali.icd", 0);
+    return 0;
+}
+
+// Check if running as root
+int check_root_permissions(void) {
+    if (geteuid() != 0) {
+        log_message("ERROR", "This tool requires root privileges. Please run with sudo.");
+        return -1;
+    }
+    return 0;
+}
+
+// Create directory (and any missing parents) if it doesn't exist
+int create_directory(const char *path) {
+    struct stat st = {0};
+    char parent[MAX_PATH_LEN];
+    char *slash;
     
-    log_message("SUCCESS", "OpenCL support configured successfully");
+    if (stat(path, &st) == -1) {
+        strncpy(parent, path, sizeof(parent) - 1);
+        parent[sizeof(parent) - 1] = '\0';
+        slash = strrchr(parent, '/');
+        if (slash && slash != parent) {
+            *slash = '\0';
+            if (create_directory(parent) != 0) {
+                return -1;
+            }
+        }
+        
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            char error_msg[512];
+            snprintf(error_msg, sizeof(error_msg), "Failed to create directory: %s", path);
+            log_message("ERROR", error_msg);
+            return -1;
+        }
+    }
     return 0;
 }
 
-// Setup Vulkan support  
-int setup_vulkan_support(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
+// Create the build directory and open the log file
+int prepare_build_directory(build_config_t *config) {
+    // Create build directory
+    if (create_directory(config->build_dir) != 0) {
+        return -1;
+    }
     
-    if (!config->enable_vulkan) {
-        return 0;
+    // Open log file
+    if (log_open(LOG_FILE) != 0) {
+        log_message("WARNING", "Could not open log file");
     }
     
-    log_message("INFO", "Setting up Vulkan support for Mali G610...");
+    return 0;
+}
+
+// Packages required to build the kernel and Mali userspace support. Every
+// entry must be installable on current Ubuntu, or missing_prerequisites()
+// never reaches zero and apt runs on every build.
+static const char *prerequisite_packages[] = {
+    // Basic build tools
+    "build-essential",
+    "gcc-aarch64-linux-gnu",
+    "g++-aarch64-linux-gnu",
+    "libncurses-dev",
+    "gawk",
+    "flex",
+    "bison",
+    "openssl",
+    "libssl-dev",
+    "dkms",
+    "libelf-dev",
+    "libudev-dev",
+    "libpci-dev",
+    "libiberty-dev",
+    "autoconf",
+    "llvm",
+    "clang",
+    "lld",
+    // Additional tools
+    "git",
+    "wget",
+    "curl",
+    "bc",
+    "rsync",
+    "openssh-client",
+    "kmod",
+    "cpio",
+    "lz4",
+    "zstd",
+    "python3",
+    "python3-pip",
+    "device-tree-compiler",
+    // Ubuntu kernel build dependencies
+    "fakeroot",
+    // Mali GPU and OpenCL/Vulkan support
+    "mesa-opencl-icd",
+    "vulkan-tools",
+    "vulkan-validationlayers",
+    "libvulkan-dev",
+    "ocl-icd-opencl-dev",
+    "opencl-headers",
+    "clinfo",
+    // Media and hardware acceleration
+    "va-driver-all",
+    "vdpau-driver-all",
+    "mesa-va-drivers",
+    "mesa-vdpau-drivers",
+    // Development libraries
+    "libegl1-mesa-dev",
+    "libgles2-mesa-dev",
+    "libgl1-mesa-dev",
+    "libdrm-dev",
+    "libgbm-dev",
+    "libwayland-dev",
+    "libx11-dev",
+    "meson",
+    "ninja-build",
+    // Compiler cache
+    "ccache",
+    NULL
+};
+
+// Collect the prerequisite packages that are not installed, reading the dpkg
+// status database directly (a package also counts as present when an
+// installed package provides it). Returns the count, or -1 if the database
+// cannot be read.
+int missing_prerequisites(const char **missing, int max) {
+    char line[4096];
+    char package[256] = "";
+    char provides[4096] = "";
+    char *name;
+    int installed = 0, found[MAX_PACKAGES] = { 0 };
+    int i, count = 0;
+    FILE *fp = fopen(DPKG_STATUS, "r");
     
-    // Create Vulkan ICD directory
-    if (create_directory("/usr/share/vulkan/icd.d") != 0) {
+    if (!fp) {
         return -1;
     }
     
-    // Create Mali Vulkan ICD file
-    FILE *icd_file = fopen("/usr/share/vulkan/icd.d/mali.json", "w");
-    if (icd_file) {
-        fprintf(icd_file, "{\n");
-        fprintf(icd_file, "    \"file_format_version\": \"1.0.0\",\n");
-        fprintf(icd_file, "    \"ICD\": {\n");
+    // Records are separated by blank lines; the trailing one is flushed by a
+    // final pass with an empty line
+    for (;;) {
+        int eof = !fgets(line, sizeof(line), fp);
         
-        if (access("/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", F_OK) == 0) {
-            fprintf(icd_file, "        \"library_path\": \"/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so\",\n");
-        } else {
-            fprintf(icd_file, "        \"library_path\": \"/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so\",\n");
+        if (eof || line[0] == '\n') {
+            if (installed) {
+                for (i = 0; prerequisite_packages[i] != NULL && i < MAX_PACKAGES; i++) {
+                    if (strcmp(package, prerequisite_packages[i]) == 0) {
+                        found[i] = 1;
+                    }
+                }
+                for (name = strtok(provides, ", \n"); name; name = strtok(NULL, ", \n")) {
+                    for (i = 0; prerequisite_packages[i] != NULL && i < MAX_PACKAGES; i++) {
+                        if (strcmp(name, prerequisite_packages[i]) == 0) {
+                            found[i] = 1;
+                        }
+                    }
+                }
+            }
+            if (eof) {
+                break;
+            }
+            package[0] = provides[0] = '\0';
+            installed = 0;
+        } else if (strncmp(line, "Package: ", 9) == 0) {
+            sscanf(line + 9, "%255s", package);
+        } else if (strncmp(line, "Status: ", 8) == 0) {
+            installed = strstr(line, " installed\n") != NULL;
+        } else if (strncmp(line, "Provides: ", 10) == 0) {
+            // Drop version constraints: "a (= 1.0), b" -> "a , b"
+            char *out = provides;
+            int depth = 0;
+            for (name = line + 10; *name; name++) {
+                depth += (*name == '(') - (*name == ')');
+                if (depth == 0 && *name != ')') {
+                    *out++ = *name;
+                }
+            }
+            *out = '\0';
         }
-        
-        fprintf(icd_file, "        \"api_version\": \"1.2.131\"\n");
-        fprintf(icd_file, "    }\n");
-        fprintf(icd_file, "}\n");
-        fclose(icd_file);
-    } else {
-        log_message("ERROR", "Failed to create Mali Vulkan ICD file");
-        return -1;
     }
+    fclose(fp);
     
-    // Set permissions
-    execute_command("chmod 644 /usr/share/vulkan/icd.d/mali.json", 0);
-    
-    log_message("SUCCESS", "Vulkan support configured successfully");
-    return 0;
+    for (i = 0; prerequisite_packages[i] != NULL && i < MAX_PACKAGES; i++) {
+        if (!found[i] && count < max) {
+            missing[count++] = prerequisite_packages[i];
+        }
+    }
+    return count;
 }
 
-// Configure kernel with Mali GPU support
-int configure_kernel(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
-    char kernel_dir[MAX_PATH_LEN];
+// Age of the apt package lists in hours: the newer of the list files and the
+// stamp left by our own last successful apt update
+double package_lists_age_hours(build_config_t *config) {
+    char path[MAX_PATH_LEN + 32];
+    struct stat st;
+    struct dirent *entry;
+    time_t newest = 0;
+    DIR *dir;
     
-    log_message("INFO", "Configuring kernel with Mali GPU support...");
+    snprintf(path, sizeof(path), "%s/%s", config->cache_dir, APT_UPDATE_STAMP);
+    if (stat(path, &st) == 0) {
+        newest = st.st_mtime;
+    }
     
-    snprintf(kernel_dir, sizeof(kernel_dir), "%s/linux", config->build_dir);
+    dir = opendir(APT_LISTS_DIR);
+    if (dir) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (strstr(entry->d_name, "Release") == NULL) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", APT_LISTS_DIR, entry->d_name);
+            if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime > newest) {
+                newest = st.st_mtime;
+            }
+        }
+        closedir(dir);
+    }
     
-    if (chdir(kernel_dir) != 0) {
-        log_message("ERROR", "Failed to change to kernel directory");
+    if (newest == 0) {
         return -1;
     }
+    return difftime(time(NULL), newest) / 3600.0;
+}
+
+// Setup build environment. apt update only runs when a package has to be
+// installed and the package lists are older than the TTL.
+int setup_build_environment(build_config_t *config) {
+    const char *missing[MAX_PACKAGES];
+    char path[MAX_PATH_LEN + 32];
+    char msg[128];
+    double age;
+    int count;
     
-    // Set environment variables for cross-compilation
-    setenv("ARCH", config->arch, 1);
-    setenv("CROSS_COMPILE", config->cross_compile, 1);
+    log_message("INFO", "Setting up build environment...");
     
-    // Clean previous build artifacts if requested
-    if (config->clean_build) {
-        log_message("INFO", "Cleaning previous build artifacts...");
-        if (execute_command("make mrproper", 1) != 0) {
-            log_message("WARNING", "Failed to clean build artifacts");
+    count = missing_prerequisites(missing, MAX_PACKAGES);
+    age = package_lists_age_hours(config);
+    if (count == 0) {
+        log_message("INFO", "All prerequisite packages are installed; skipping apt update");
+    } else if (age >= 0 && age < config->apt_ttl_hours) {
+        snprintf(msg, sizeof(msg), "Package lists are %.1fh old (TTL %.0fh); skipping apt update",
+                 age, config->apt_ttl_hours);
+        log_message("INFO", msg);
+    } else {
+        // Update package lists
+        if (execute_command("apt update", 1) != 0) {
+            log_message("ERROR", "Failed to update package lists");
+            return -1;
         }
+        snprintf(path, sizeof(path), "%s/%s", config->cache_dir, APT_UPDATE_STAMP);
+        create_directory(config->cache_dir);
+        close(open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
     }
     
-    // Use Orange Pi 5 Plus specific defconfig
-    snprintf(cmd, sizeof(cmd), "make %s", config->defconfig);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to use specific defconfig, trying generic...");
-        
-        // Fallback to generic arm64 defconfig
-        if (execute_command("make defconfig", 1) != 0) {
-            log_message("ERROR", "Failed to configure kernel");
-            return -1;
+    log_message("SUCCESS", "Build environment setup completed");
+    return 0;
+}
+
+// Install build prerequisites. Only missing packages are installed, and the
+// kernel build dependencies are fetched once per running kernel release.
+int install_prerequisites(build_config_t *config) {
+    const char *missing[MAX_PACKAGES];
+    char cmd[MAX_CMD_LEN * 2];
+    char path[MAX_PATH_LEN + 32];
+    char release[128] = "";
+    char stamp[128] = "";
+    char msg[128];
+    struct utsname uts;
+    FILE *fp;
+    int i, count;
+    
+    log_message("INFO", "Installing build prerequisites...");
+    
+    count = missing_prerequisites(missing, MAX_PACKAGES);
+    if (count < 0) {
+        // No readable dpkg database: install everything
+        for (count = 0; prerequisite_packages[count] != NULL && count < MAX_PACKAGES; count++) {
+            missing[count] = prerequisite_packages[count];
         }
     }
     
-    // Enable RK3588 and Mali GPU specific options
-    log_message("INFO", "Enabling RK3588, Mali GPU, and hardware acceleration configurations...");
-    
-    const char *config_options[] = {
-        // Basic RK3588 support
-        "CONFIG_ARCH_ROCKCHIP=y",
-        "CONFIG_ARM64=y",
-        "CONFIG_ROCKCHIP_RK3588=y", 
-        "CONFIG_COMMON_CLK_RK808=y",
-        "CONFIG_ROCKCHIP_IOMMU=y",
-        "CONFIG_ROCKCHIP_PM_DOMAINS=y",
-        "CONFIG_ROCKCHIP_THERMAL=y",
-        
-        // Display and GPU support
-        "CONFIG_DRM=y",
-        "CONFIG_DRM_ROCKCHIP=y",
-        "CONFIG_ROCKCHIP_VOP2=y",
-        "CONFIG_DRM_PANFROST=y",
-        "CONFIG_DRM_PANEL_BRIDGE=y",
-        "CONFIG_DRM_PANEL_SIMPLE=y",
-        
-        // Mali GPU kernel driver support
-        "CONFIG_MALI_MIDGARD=m",
-        "CONFIG_MALI_PLATFORM_NAME=\"devicetree\"",
-        "CONFIG_MALI_CSF_SUPPORT=y",
-        "CONFIG_MALI_DEVFREQ=y",
-        "CONFIG_MALI_DMA_FENCE=y",
-        
-        // Memory and DMA support
-        "CONFIG_DMA_CMA=y",
-        "CONFIG_CMA=y",
-        "CONFIG_CMA_SIZE_MBYTES=128",
-        "CONFIG_DMA_SHARED_BUFFER=y",
-        "CONFIG_SYNC_FILE=y",
-        
-        // Hardware acceleration
-        "CONFIG_PHY_ROCKCHIP_INNO_USB2=y",
-        "CONFIG_PHY_ROCKCHIP_NANENG_COMBO_PHY=y",
-        "CONFIG_ROCKCHIP_SARADC=y",
-        "CONFIG_MMC_DW_ROCKCHIP=y",
-        "CONFIG_PCIE_ROCKCHIP_HOST=y",
-        
-        // Video codec support
-        "CONFIG_STAGING_MEDIA=y",
-        "CONFIG_VIDEO_ROCKCHIP_RGA=m",
-        "CONFIG_VIDEO_ROCKCHIP_VDEC=m",
-        "CONFIG_ROCKCHIP_VPU=y",
-        "CONFIG_VIDEO_HANTRO=m",
-        
-        // Power management
-        "CONFIG_CPU_FREQ=y",
-        "CONFIG_CPU_FREQ_DEFAULT_GOV_ONDEMAND=y",
-        "CONFIG_CPU_FREQ_GOV_PERFORMANCE=y",
-        "CONFIG_CPU_FREQ_GOV_POWERSAVE=y",
-        "CONFIG_CPU_FREQ_GOV_USERSPACE=y",
-        "CONFIG_CPU_FREQ_GOV_SCHEDUTIL=y",
-        "CONFIG_CPUFREQ_DT=y",
-        "CONFIG_ARM_ROCKCHIP_CPUFREQ=y",
-        
-        // Additional GPU and graphics options
-        "CONFIG_FB=y",
-        "CONFIG_FB_SIMPLE=y",
-        "CONFIG_LOGO=y",
-        "CONFIG_LOGO_LINUX_CLUT224=y",
+    if (count > 0) {
+        snprintf(msg, sizeof(msg), "Installing %d missing package(s)", count);
+        log_message("INFO", msg);
+        strcpy(cmd, "DEBIAN_FRONTEND=noninteractive apt install -y");
+        for (i = 0; i < count; i++) {
+            strcat(cmd, " ");
+            strcat(cmd, missing[i]);
+        }
         
-        NULL
-    };
+        if (execute_command(cmd, 1) != 0) {
+            log_message("ERROR", "Failed to install prerequisites");
+            return -1;
+        }
+    } else {
+        log_message("INFO", "All prerequisite packages are installed");
+    }
     
-    FILE *config_file = fopen(".config", "a");
-    if (config_file) {
-        int i;
-        for (i = 0; config_options[i] != NULL; i++) {
-            fprintf(config_file, "%s\n", config_options[i]);
+    // Install additional Ubuntu kernel build dependencies
+    if (uname(&uts) == 0) {
+        snprintf(release, sizeof(release), "%s", uts.release);
+    }
+    snprintf(path, sizeof(path), "%s/%s", config->cache_dir, BUILD_DEP_STAMP);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fgets(stamp, sizeof(stamp), fp)) {
+            stamp[strcspn(stamp, "\n")] = '\0';
         }
-        fclose(config_file);
+        fclose(fp);
     }
     
-    // Run olddefconfig to resolve dependencies
-    if (execute_command("make olddefconfig", 1) != 0) {
-        log_message("WARNING", "Failed to resolve config dependencies");
+    if (release[0] && strcmp(stamp, release) == 0) {
+        log_message("INFO", "Kernel build dependencies already installed for this release");
+    } else if (execute_command("apt build-dep -y linux linux-image-unsigned-$(uname -r)", 1) != 0) {
+        log_message("WARNING", "Failed to install some kernel build dependencies");
+    } else if (release[0]) {
+        create_directory(config->cache_dir);
+        fp = fopen(path, "w");
+        if (fp) {
+            fprintf(fp, "%s\n", release);
+            fclose(fp);
+        }
     }
     
-    log_message("SUCCESS", "Kernel configured successfully with Mali GPU support");
+    log_message("SUCCESS", "Prerequisites installed successfully");
     return 0;
 }
 
-// Build kernel
-int build_kernel(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
-    
-    log_message("INFO", "Building kernel with Mali GPU support (this may take a while)...");
+
+// Mix a string into a 64-bit FNV-1a digest (the terminator is included so
+// that consecutive fields cannot run together)
+unsigned long long digest_string(unsigned long long hash, const char *data) {
+    do {
+        hash ^= (unsigned char)*data;
+        hash *= 1099511628211ULL;
+    } while (*data++);
+    return hash;
+}
+
+// Mix an integer into a digest
+unsigned long long digest_int(unsigned long long hash, long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return digest_string(hash, buf);
+}
+
+// Mix a file's contents into a digest; a missing file hashes differently
+// from an empty one
+unsigned long long digest_file(unsigned long long hash, const char *path) {
+    unsigned char buffer[65536];
+    size_t bytes, i;
+    FILE *fp = fopen(path, "rb");
     
-    // Set environment variables
-    setenv("ARCH", config->arch, 1);
-    setenv("CROSS_COMPILE", config->cross_compile, 1);
+    if (!fp) {
+        return digest_string(hash, "<missing>");
+    }
     
-    // Build kernel image
-    snprintf(cmd, sizeof(cmd), "make -j%d Image", config->jobs);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to build kernel image");
-        return -1;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        for (i = 0; i < bytes; i++) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
     }
+    fclose(fp);
+    return digest_string(hash, path);
+}
+
+// Hash a string with 64-bit FNV-1a (used to key cache entries)
+unsigned long long fnv1a_hash(const char *data) {
+    return digest_string(FNV_OFFSET_BASIS, data);
+}
+
+// Fetch a repository through the persistent bare mirror cache and check
+// out the requested branch or tag into dest as a worktree. Mirrors are keyed
+// by a hash of the URL so every consumer of the same remote shares objects.
+int fetch_cached_repo(build_config_t *config, const char *url, const char *ref, const char *dest) {
+    char cmd[MAX_CMD_LEN];
+    char git_cache[MAX_PATH_LEN + 8];
+    char mirror[MAX_PATH_LEN];
+    char marker[MAX_PATH_LEN + 16];
+    char pack_dir[MAX_PATH_LEN + 16];
+    char msg[MAX_PATH_LEN + 64];
+    const char *name;
+    size_t name_len;
+    long long pack_bytes;
     
-    // Build device tree blobs
-    snprintf(cmd, sizeof(cmd), "make -j%d dtbs", config->jobs);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to build device tree blobs");
+    snprintf(git_cache, sizeof(git_cache), "%s/git", config->cache_dir);
+    if (create_directory(git_cache) != 0) {
         return -1;
     }
     
-    // Build modules (including Mali GPU driver)
-    snprintf(cmd, sizeof(cmd), "make -j%d modules", config->jobs);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to build kernel modules");
+    // Mirror name: <repo basename>-<url hash>.git
+    name = strrchr(url, '/');
+    name = name ? name + 1 : url;
+    name_len = strlen(name);
+    if (name_len > 4 && strcmp(name + name_len - 4, ".git") == 0) {
+        name_len -= 4;
+    }
+    if (snprintf(mirror, sizeof(mirror), "%s/%.*s-%016llx.git",
+                 git_cache, (int)name_len, name, fnv1a_hash(url)) >= (int)sizeof(mirror)) {
+        log_message("ERROR", "Source mirror path is too long");
         return -1;
     }
     
-    log_message("SUCCESS", "Kernel built successfully with Mali GPU support");
-    return 0;
-}
-
-// Install kernel
-int install_kernel(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
+    snprintf(marker, sizeof(marker), "%s/HEAD", mirror);
+    if (access(marker, F_OK) != 0) {
+        snprintf(msg, sizeof(msg), "Creating source mirror: %s", mirror);
+        log_message("INFO", msg);
+        snprintf(cmd, sizeof(cmd), "git init --bare --quiet %s", mirror);
+        if (execute_command(cmd, 0) != 0) {
+            return -1;
+        }
+    }
     
-    log_message("INFO", "Installing kernel and Mali GPU modules...");
+    // Refresh the mirror; only new objects cross the network, and the pack
+    // growth is what we count as downloaded
+    snprintf(pack_dir, sizeof(pack_dir), "%s/objects/pack", mirror);
+    pack_bytes = directory_size(pack_dir);
+    snprintf(cmd, sizeof(cmd),
+             "git --git-dir=%s fetch --depth 1 --force %s %s:refs/cache/%s",
+             mirror, url, ref, ref);
+    if (execute_command(cmd, 1) == 0) {
+        record_downloaded_bytes(directory_size(pack_dir) - pack_bytes);
+    } else {
+        snprintf(cmd, sizeof(cmd),
+                 "git --git-dir=%s rev-parse --verify --quiet refs/cache/%s",
+                 mirror, ref);
+        if (execute_command(cmd, 0) != 0) {
+            return -1;
+        }
+        log_message("WARNING", "Fetch failed, using previously cached copy");
+    }
     
-    // Install modules (including Mali GPU driver)
-    if (execute_command("make modules_install", 1) != 0) {
-        log_message("ERROR", "Failed to install kernel modules");
-        return -1;
+    snprintf(marker, sizeof(marker), "%s/.git", dest);
+    if (access(marker, F_OK) == 0) {
+        // Existing checkout: move it to the cached commit in place so
+        // untracked build output (.config, objects) survives
+        snprintf(cmd, sizeof(cmd),
+                 "git -C %s fetch --quiet --depth 1 --force %s refs/cache/%s",
+                 dest, mirror, ref);
+        if (execute_command(cmd, 0) != 0) {
+            return -1;
+        }
+        snprintf(cmd, sizeof(cmd), "git -C %s checkout --quiet --force --detach FETCH_HEAD", dest);
+        return execute_command(cmd, 1);
     }
     
-    // Install device tree blobs
-    if (execute_command("make dtbs_install", 1) != 0) {
-        log_message("WARNING", "Failed to install device tree blobs");
+    if (access(dest, F_OK) == 0) {
+        log_message("WARNING", "Removing incomplete checkout before creating worktree");
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dest);
+        if (execute_command(cmd, 0) != 0) {
+            return -1;
+        }
     }
     
-    // Copy kernel image
-    snprintf(cmd, sizeof(cmd), "cp arch/arm64/boot/Image /boot/vmlinuz-%s-opi5plus-mali", config->kernel_version);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("ERROR", "Failed to copy kernel image");
+    // Drop worktree records whose directories were wiped (e.g. /tmp on reboot)
+    snprintf(cmd, sizeof(cmd), "git --git-dir=%s worktree prune", mirror);
+    execute_command(cmd, 0);
+    
+    snprintf(cmd, sizeof(cmd),
+             "git --git-dir=%s worktree add --force --detach %s refs/cache/%s",
+             mirror, dest, ref);
+    return execute_command(cmd, 1);
+}
+
+// Change into the current profile's object directory and export the
+// cross-compile environment. make runs with -C <source> O=<objdir>, so
+// artifact paths (arch/arm64/boot/Image, modules.order) are relative to it.
+int enter_kernel_tree(build_config_t *config) {
+    if (create_directory(config->objdir) != 0) {
         return -1;
     }
     
-    // Copy System.map
-    snprintf(cmd, sizeof(cmd), "cp System.map /boot/System.map-%s-opi5plus-mali", config->kernel_version);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to copy System.map");
+    if (chdir(config->objdir) != 0) {
+        log_message("ERROR", "Failed to change to kernel object directory");
+        return -1;
     }
     
-    // Copy config
-    snprintf(cmd, sizeof(cmd), "cp .config /boot/config-%s-opi5plus-mali", config->kernel_version);
-    if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to copy kernel config");
-    }
+    // Set environment variables for cross-compilation
+    setenv("ARCH", config->arch, 1);
+    setenv("CROSS_COMPILE", config->cross_compile, 1);
+    return 0;
+}
+
+// Read the commit currently checked out in the kernel source tree
+int get_source_commit(build_config_t *config, char *commit, size_t size) {
+    char cmd[MAX_CMD_LEN];
+    FILE *fp;
     
-    // Update initramfs
-    snprintf(cmd, sizeof(cmd), "update-initramfs -c -k %s-opi5plus-mali", config->kernel_version);
+    commit[0] = '\0';
+    snprintf(cmd, sizeof(cmd), "git -C %s/linux rev-parse HEAD 2>/dev/null", config->build_dir);
+    fp = popen(cmd, "r");
+    if (!fp) {
+        return -1;
+    }
+    if (fgets(commit, (int)size, fp)) {
+        commit[strcspn(commit, "\n")] = '\0';
+    }
+    pclose(fp);
+    return commit[0] ? 0 : -1;
+}
+
+// Download kernel source
+int download_kernel_source(build_config_t *config) {
+    char source_dir[MAX_PATH_LEN + 8];
+    char mainline_ref[80];
+    
+    log_message("INFO", "Downloading kernel source...");
+    
+    snprintf(source_dir, sizeof(source_dir), "%s/linux", config->build_dir);
+    
+    // Change to build directory
+    if (chdir(config->build_dir) != 0) {
+        log_message("ERROR", "Failed to change to build directory");
+        return -1;
+    }
+    
+    // Ubuntu Rockchip kernel source with Mali GPU support
+    if (fetch_cached_repo(config, "https://github.com/Joshua-Riek/linux-rockchip.git",
+                          config->kernel_ref[0] ? config->kernel_ref : "ubuntu-rockchip-6.8-opi5",
+                          source_dir) != 0) {
+        if (config->kernel_ref[0]) {
+            // A pinned commit must not silently fall back to another tree
+            log_message("ERROR", "Failed to fetch the requested kernel ref");
+            return -1;
+        }
+        log_message("WARNING", "Failed to clone Ubuntu Rockchip kernel, trying mainline...");
+        
+        // Fallback to mainline kernel
+        snprintf(mainline_ref, sizeof(mainline_ref), "v%s", config->kernel_version);
+        if (fetch_cached_repo(config, "https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git",
+                              mainline_ref, source_dir) != 0) {
+            log_message("ERROR", "Failed to download kernel source");
+            return -1;
+        }
+    }
+    
+    log_message("SUCCESS", "Kernel source downloaded successfully");
+    return 0;
+}
+
+// Download Ubuntu Rockchip patches
+int download_ubuntu_rockchip_patches(build_config_t *config) {
+    char patches_dir[MAX_PATH_LEN + 32];
+    
+    log_message("INFO", "Downloading Ubuntu Rockchip patches...");
+    
+    snprintf(patches_dir, sizeof(patches_dir), "%s/ubuntu-rockchip", config->build_dir);
+    
+    // Ubuntu Rockchip repository for patches and configs (default branch)
+    if (fetch_cached_repo(config, "https://github.com/Joshua-Riek/ubuntu-rockchip.git",
+                          "HEAD", patches_dir) != 0) {
+        log_message("WARNING", "Failed to download Ubuntu Rockchip patches");
+        return 0; // Non-critical
+    }
+    
+    log_message("SUCCESS", "Ubuntu Rockchip patches downloaded");
+    return 0;
+}
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(sha256_ctx_t *ctx, const unsigned char *block) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+    
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+void sha256_init(sha256_ctx_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const unsigned char *data, size_t len) {
+    ctx->length += len;
+    while (len > 0) {
+        size_t chunk = sizeof(ctx->buffer) - ctx->used;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(ctx->buffer + ctx->used, data, chunk);
+        ctx->used += chunk;
+        data += chunk;
+        len -= chunk;
+        if (ctx->used == sizeof(ctx->buffer)) {
+            sha256_transform(ctx, ctx->buffer);
+            ctx->used = 0;
+        }
+    }
+}
+
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    unsigned char zero = 0;
+    unsigned char length_be[8];
+    int i;
+    
+    sha256_update(ctx, &pad, 1);
+    while (ctx->used != 56) {
+        sha256_update(ctx, &zero, 1);
+    }
+    for (i = 0; i < 8; i++) {
+        length_be[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha256_update(ctx, length_be, 8);
+    
+    for (i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+// SHA-256 of a file as 64 lowercase hex characters
+int sha256_file(const char *path, char *hex) {
+    unsigned char buffer[65536];
+    unsigned char digest[32];
+    sha256_ctx_t ctx;
+    size_t bytes;
+    int i;
+    FILE *fp = fopen(path, "rb");
+    
+    if (!fp) {
+        return -1;
+    }
+    
+    sha256_init(&ctx);
+    while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        sha256_update(&ctx, buffer, bytes);
+    }
+    fclose(fp);
+    sha256_final(&ctx, digest);
+    
+    for (i = 0; i < 32; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    return 0;
+}
+
+// Look up the pinned SHA-256 of a blob: the manifest (sha256sum format)
+// first, then the pin shipped in mali_blobs. Returns -1 if there is none.
+int read_blob_pin(build_config_t *config, const mali_blob_t *blob, char *pin) {
+    char line[MAX_PATH_LEN];
+    char hex[65];
+    char name[MAX_PATH_LEN];
+    FILE *fp = fopen(config->blob_manifest, "r");
+    
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (line[0] != '#' && sscanf(line, "%64s %511s", hex, name) == 2 &&
+                strcmp(name, blob->file) == 0) {
+                strcpy(pin, hex);
+                fclose(fp);
+                return 0;
+            }
+        }
+        fclose(fp);
+    }
+    
+    if (blob->sha256) {
+        strcpy(pin, blob->sha256);
+        return 0;
+    }
+    return -1;
+}
+
+// Add or replace a blob's entry in the manifest
+int record_blob_pin(build_config_t *config, const char *file, const char *hex) {
+    char tmp_path[MAX_PATH_LEN + 8];
+    char line[MAX_PATH_LEN];
+    char pin[65];
+    char name[MAX_PATH_LEN];
+    FILE *in, *out;
+    
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config->blob_manifest);
+    out = fopen(tmp_path, "w");
+    if (!out) {
+        return -1;
+    }
+    
+    in = fopen(config->blob_manifest, "r");
+    if (in) {
+        while (fgets(line, sizeof(line), in)) {
+            if (sscanf(line, "%64s %511s", pin, name) == 2 && strcmp(name, file) == 0) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s  %s\n", hex, file);
+    fclose(out);
+    
+    return rename(tmp_path, config->blob_manifest);
+}
+
+// Download a URL into dest, resuming a previous partial download (dest.part)
+// with an HTTP range request
+int download_file_resumable(const char *url, const char *dest) {
+    char cmd[MAX_CMD_LEN];
+    char part[MAX_PATH_LEN + 8];
+    
+    struct stat st;
+    long long before = 0;
+    
+    snprintf(part, sizeof(part), "%s.part", dest);
+    if (stat(part, &st) == 0) {
+        before = st.st_size;
+    }
+    snprintf(cmd, sizeof(cmd),
+             "curl -fsSL --retry 3 --retry-delay 2 -C - -o %s %s", part, url);
+    if (execute_command(cmd, 0) != 0) {
+        return -1;
+    }
+    if (stat(part, &st) == 0) {
+        record_downloaded_bytes(st.st_size - before);
+    }
+    return rename(part, dest);
+}
+
+// Launch the Mali artifact fetches in background processes so they overlap
+// with each other and with the kernel source fetch. Blobs that already match
+// their pinned checksum are skipped.
+int start_mali_blob_downloads(build_config_t *config) {
+    char path[MAX_PATH_LEN];
+    char pin[65], hex[65];
+    char msg[MAX_PATH_LEN + 64];
+    const mali_blob_t *blob;
+    pid_t pid;
+    
+    log_message("INFO", "Downloading Mali G610 GPU blobs and libraries...");
+    
+    // Create Mali directory
+    if (create_directory(MALI_DIR) != 0) {
+        return -1;
+    }
+    
+    if (config->blob_manifest[0] == '\0' &&
+        snprintf(config->blob_manifest, sizeof(config->blob_manifest), "%s/%s",
+                 config->cache_dir, BLOB_MANIFEST) >= (int)sizeof(config->blob_manifest)) {
+        log_message("ERROR", "Cache directory path is too long");
+        return -1;
+    }
+    create_directory(config->cache_dir);
+    
+    download_job_count = 0;
+    fflush(stdout);
+    
+    for (blob = mali_blobs; blob->file != NULL; blob++) {
+        if (blob->vulkan_only && !config->enable_vulkan) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "%s/%s", MALI_DIR, blob->file);
+        if (read_blob_pin(config, blob, pin) == 0 &&
+            sha256_file(path, hex) == 0 && strcmp(pin, hex) == 0) {
+            snprintf(msg, sizeof(msg), "%s is up to date (SHA-256 verified)", blob->description);
+            log_message("INFO", msg);
+            continue;
+        }
+        
+        snprintf(msg, sizeof(msg), "Downloading %s...", blob->description);
+        log_message("INFO", msg);
+        
+        pid = fork();
+        if (pid == 0) {
+            _exit(download_file_resumable(blob->url, path) == 0 ? 0 : 1);
+        } else if (pid < 0) {
+            log_message("ERROR", "Failed to start download process");
+            return -1;
+        }
+        download_jobs[download_job_count].pid = pid;
+        download_jobs[download_job_count].blob = blob;
+        download_job_count++;
+    }
+    
+    // Clone libmali repository for additional components
+    log_message("INFO", "Downloading additional Mali components...");
+    pid = fork();
+    if (pid == 0) {
+        _exit(fetch_cached_repo(config, "https://github.com/tsukumijima/libmali-rockchip.git",
+                                "libmali", MALI_DIR "/libmali-src") == 0 ? 0 : 1);
+    } else if (pid > 0) {
+        download_jobs[download_job_count].pid = pid;
+        download_jobs[download_job_count].blob = NULL;
+        download_job_count++;
+    }
+    
+    return 0;
+}
+
+// Wait for the background downloads and verify every blob against its pin.
+// A blob without one is refused, unless --record-blob-pins trusts it.
+int finish_mali_blob_downloads(build_config_t *config) {
+    char path[MAX_PATH_LEN];
+    char pin[65], hex[65];
+    char msg[MAX_PATH_LEN + 256];
+    const mali_blob_t *blob;
+    int status, i;
+    int failed = 0;
+    
+    for (i = 0; i < download_job_count; i++) {
+        if (waitpid(download_jobs[i].pid, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            blob = download_jobs[i].blob;
+            if (!blob) {
+                log_message("WARNING", "Failed to download additional Mali components");
+            } else if (blob->required) {
+                snprintf(msg, sizeof(msg), "Failed to download %s", blob->description);
+                log_message("ERROR", msg);
+                failed = 1;
+            } else {
+                log_message("WARNING", "Failed to download Mali Vulkan driver, using standard version");
+            }
+        }
+    }
+    download_job_count = 0;
+    
+    if (failed) {
+        return -1;
+    }
+    
+    for (blob = mali_blobs; blob->file != NULL; blob++) {
+        if (blob->vulkan_only && !config->enable_vulkan) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "%s/%s", MALI_DIR, blob->file);
+        if (sha256_file(path, hex) != 0) {
+            continue; // Optional blob that failed to download
+        }
+        
+        if (read_blob_pin(config, blob, pin) == 0) {
+            if (strcmp(pin, hex) != 0) {
+                snprintf(msg, sizeof(msg), "Checksum mismatch for %s (expected %s, got %s)",
+                         blob->file, pin, hex);
+                log_message(blob->required ? "ERROR" : "WARNING", msg);
+                unlink(path);
+                if (blob->required) {
+                    return -1;
+                }
+            }
+        } else if (config->record_blob_pins) {
+            snprintf(msg, sizeof(msg), "No pinned checksum for %s, recording %s", blob->file, hex);
+            log_message("WARNING", msg);
+            if (record_blob_pin(config, blob->file, hex) != 0) {
+                log_message("ERROR", "Cannot write the blob manifest");
+                return -1;
+            }
+        } else {
+            snprintf(msg, sizeof(msg), "No pinned checksum for %s (add it to %s, or trust this download with --record-blob-pins)",
+                     blob->file, config->blob_manifest);
+            log_message(blob->required ? "ERROR" : "WARNING", msg);
+            unlink(path);
+            if (blob->required) {
+                return -1;
+            }
+        }
+    }
+    
+    log_message("SUCCESS", "Mali GPU blobs downloaded successfully");
+    return 0;
+}
+
+// Download Mali GPU blobs and libraries
+int download_mali_blobs(build_config_t *config) {
+    if (start_mali_blob_downloads(config) != 0) {
+        return -1;
+    }
+    return finish_mali_blob_downloads(config);
+}
+
+// Install Mali drivers and setup
+int install_mali_drivers(build_config_t *config) {
+    log_message("INFO", "Installing Mali G610 drivers and firmware...");
+    
+    // Install Mali firmware
+    if (copy_file(MALI_DIR "/mali_csffw.bin", "/lib/firmware/") != 0) {
+        log_message("ERROR", "Failed to install Mali firmware");
+        return -1;
+    }
+    
+    // Install Mali userspace driver
+    if (copy_file(MALI_DIR "/libmali-valhall-g610-g6p0-x11-wayland-gbm.so", "/usr/lib/") != 0) {
+        log_message("ERROR", "Failed to install Mali userspace driver");
+        return -1;
+    }
+    
+    // Create symbolic links for different APIs
+    log_message("INFO", "Creating Mali driver symbolic links...");
+    
+    const char *mali_links[] = {
+        "/usr/lib/libMali.so",
+        "/usr/lib/libMali.so.1",
+        "/usr/lib/libmali.so",
+        "/usr/lib/libmali.so.1",
+        "/usr/lib/libEGL.so.1",
+        "/usr/lib/libGLESv1_CM.so.1",
+        "/usr/lib/libGLESv2.so.2",
+        "/usr/lib/libgbm.so.1",
+        NULL
+    };
+    
+    int i;
+    for (i = 0; mali_links[i] != NULL; i++) {
+        if (force_symlink("/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so", mali_links[i]) != 0) {
+            log_message("WARNING", "Failed to create some Mali symbolic links");
+        }
+    }
+    
+    // Install Vulkan driver if requested
+    if (config->enable_vulkan) {
+        if (access(MALI_DIR "/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", F_OK) == 0) {
+            log_message("INFO", "Installing Mali Vulkan driver...");
+            if (copy_file(MALI_DIR "/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", "/usr/lib/") != 0) {
+                log_message("WARNING", "Failed to install Mali Vulkan driver");
+            } else {
+                // Create Vulkan-specific links
+                force_symlink("/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", "/usr/lib/libvulkan_mali.so");
+            }
+        }
+    }
+    
+    // Update library cache
+    if (execute_command("ldconfig", 1) != 0) {
+        log_message("WARNING", "Failed to update library cache");
+    }
+    
+    log_message("SUCCESS", "Mali drivers installed successfully");
+    return 0;
+}
+
+// Setup OpenCL support
+int setup_opencl_support(build_config_t *config) {
+    if (!config->enable_opencl) {
+        return 0;
+    }
+    
+    log_message("INFO", "Setting up OpenCL support for Mali G610...");
+    
+    // Create OpenCL vendor directory
+    if (create_directory("/etc/OpenCL/vendors") != 0) {
+        return -1;
+    }
+    
+    // Create Mali OpenCL ICD file
+    FILE *icd_file = fopen("/etc/OpenCL/vendors/mali.icd", "w");
+    if (icd_file) {
+        fprintf(icd_file, "/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so\n");
+        fclose(icd_file);
+    } else {
+        log_message("ERROR", "Failed to create Mali OpenCL ICD file");
+        return -1;
+    }
+    
+    // Set permissions
+    chmod("/etc/OpenCL/vendors/mali.icd", 0644);
+    
+    log_message("SUCCESS", "OpenCL support configured successfully");
+    return 0;
+}
+
+// Setup Vulkan support  
+int setup_vulkan_support(build_config_t *config) {
+    if (!config->enable_vulkan) {
+        return 0;
+    }
+    
+    log_message("INFO", "Setting up Vulkan support for Mali G610...");
+    
+    // Create Vulkan ICD directory
+    if (create_directory("/usr/share/vulkan/icd.d") != 0) {
+        return -1;
+    }
+    
+    // Create Mali Vulkan ICD file
+    FILE *icd_file = fopen("/usr/share/vulkan/icd.d/mali.json", "w");
+    if (icd_file) {
+        fprintf(icd_file, "{\n");
+        fprintf(icd_file, "    \"file_format_version\": \"1.0.0\",\n");
+        fprintf(icd_file, "    \"ICD\": {\n");
+        
+        if (access("/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so", F_OK) == 0) {
+            fprintf(icd_file, "        \"library_path\": \"/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so\",\n");
+        } else {
+            fprintf(icd_file, "        \"library_path\": \"/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so\",\n");
+        }
+        
+        fprintf(icd_file, "        \"api_version\": \"1.2.131\"\n");
+        fprintf(icd_file, "    }\n");
+        fprintf(icd_file, "}\n");
+        fclose(icd_file);
+    } else {
+        log_message("ERROR", "Failed to create Mali Vulkan ICD file");
+        return -1;
+    }
+    
+    // Set permissions
+    chmod("/usr/share/vulkan/icd.d/mali.json", 0644);
+    
+    log_message("SUCCESS", "Vulkan support configured successfully");
+    return 0;
+}
+
+// RK3588 board options applied on top of the defconfig for every profile
+static const char *const rk3588_config_options[] = {
+    // Basic RK3588 support
+    "CONFIG_ARCH_ROCKCHIP=y",
+    "CONFIG_ARM64=y",
+    "CONFIG_ROCKCHIP_RK3588=y", 
+    "CONFIG_COMMON_CLK_RK808=y",
+    "CONFIG_ROCKCHIP_IOMMU=y",
+    "CONFIG_ROCKCHIP_PM_DOMAINS=y",
+    "CONFIG_ROCKCHIP_THERMAL=y",
+    
+    // Memory and DMA support
+    "CONFIG_DMA_CMA=y",
+    "CONFIG_CMA=y",
+    "CONFIG_CMA_SIZE_MBYTES=128",
+    "CONFIG_DMA_SHARED_BUFFER=y",
+    "CONFIG_SYNC_FILE=y",
+    
+    // Hardware acceleration
+    "CONFIG_PHY_ROCKCHIP_INNO_USB2=y",
+    "CONFIG_PHY_ROCKCHIP_NANENG_COMBO_PHY=y",
+    "CONFIG_ROCKCHIP_SARADC=y",
+    "CONFIG_MMC_DW_ROCKCHIP=y",
+    "CONFIG_PCIE_ROCKCHIP_HOST=y",
+    
+    // Power management
+    "CONFIG_CPU_FREQ=y",
+    "CONFIG_CPU_FREQ_DEFAULT_GOV_ONDEMAND=y",
+    "CONFIG_CPU_FREQ_GOV_PERFORMANCE=y",
+    "CONFIG_CPU_FREQ_GOV_POWERSAVE=y",
+    "CONFIG_CPU_FREQ_GOV_USERSPACE=y",
+    "CONFIG_CPU_FREQ_GOV_SCHEDUTIL=y",
+    "CONFIG_CPUFREQ_DT=y",
+    "CONFIG_ARM_ROCKCHIP_CPUFREQ=y",
+    
+    NULL
+};
+
+// Display, Mali GPU and video options for the desktop profile
+static const char *const mali_config_options[] = {
+    // Display and GPU support
+    "CONFIG_DRM=y",
+    "CONFIG_DRM_ROCKCHIP=y",
+    "CONFIG_ROCKCHIP_VOP2=y",
+    "CONFIG_DRM_PANFROST=y",
+    "CONFIG_DRM_PANEL_BRIDGE=y",
+    "CONFIG_DRM_PANEL_SIMPLE=y",
+    
+    // Mali GPU kernel driver support
+    "CONFIG_MALI_MIDGARD=m",
+    "CONFIG_MALI_PLATFORM_NAME=\"devicetree\"",
+    "CONFIG_MALI_CSF_SUPPORT=y",
+    "CONFIG_MALI_DEVFREQ=y",
+    "CONFIG_MALI_DMA_FENCE=y",
+    
+    // Video codec support
+    "CONFIG_STAGING_MEDIA=y",
+    "CONFIG_VIDEO_ROCKCHIP_RGA=m",
+    "CONFIG_VIDEO_ROCKCHIP_VDEC=m",
+    "CONFIG_ROCKCHIP_VPU=y",
+    "CONFIG_VIDEO_HANTRO=m",
+    
+    // Additional GPU and graphics options
+    "CONFIG_FB=y",
+    "CONFIG_FB_SIMPLE=y",
+    "CONFIG_LOGO=y",
+    "CONFIG_LOGO_LINUX_CLUT224=y",
+    
+    NULL
+};
+
+// Throughput and latency options for edge inference and network nodes
+static const char *const performance_config_options[] = {
+    // schedutil follows scheduler utilisation instead of sampling load
+    "CONFIG_CPU_FREQ_DEFAULT_GOV_ONDEMAND=n",
+    "CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL=y",
+    "CONFIG_ENERGY_MODEL=y",
+    
+    // Tickless isolated cores (nohz_full=) and offloaded RCU callbacks
+    "CONFIG_NO_HZ_IDLE=n",
+    "CONFIG_NO_HZ_FULL=y",
+    "CONFIG_RCU_NOCB_CPU=y",
+    "CONFIG_HZ_250=y",
+    
+    // Voluntary preemption by default, switchable with preempt= at boot
+    "CONFIG_PREEMPT_VOLUNTARY=y",
+    "CONFIG_PREEMPT_DYNAMIC=y",
+    
+    // eBPF with the JIT for XDP and tracing
+    "CONFIG_BPF_SYSCALL=y",
+    "CONFIG_BPF_JIT=y",
+    "CONFIG_BPF_JIT_ALWAYS_ON=y",
+    "CONFIG_XDP_SOCKETS=y",
+    
+    // Transparent hugepages on request (madvise)
+    "CONFIG_TRANSPARENT_HUGEPAGE=y",
+    "CONFIG_TRANSPARENT_HUGEPAGE_MADVISE=y",
+    
+    // Larger contiguous pool for NPU and VPU buffers
+    "CONFIG_CMA_SIZE_MBYTES=512",
+    "CONFIG_ROCKCHIP_RKNPU=y",
+    
+    // Network throughput
+    "CONFIG_TCP_CONG_BBR=y",
+    "CONFIG_DEFAULT_BBR=y",
+    "CONFIG_NET_SCH_FQ=y",
+    
+    NULL
+};
+
+// --preempt model overrides
+static const char *const preempt_none_options[] = {
+    "CONFIG_PREEMPT_NONE=y", "CONFIG_PREEMPT_VOLUNTARY=n", "CONFIG_PREEMPT=n", NULL
+};
+static const char *const preempt_voluntary_options[] = {
+    "CONFIG_PREEMPT_NONE=n", "CONFIG_PREEMPT_VOLUNTARY=y", "CONFIG_PREEMPT=n", NULL
+};
+static const char *const preempt_full_options[] = {
+    "CONFIG_PREEMPT_NONE=n", "CONFIG_PREEMPT_VOLUNTARY=n", "CONFIG_PREEMPT=y", NULL
+};
+
+// --debug-info modes. DWARF is what makes vmlinux links slow and the object
+// directory large; reduced and split both cost BTF (pahole needs full DWARF).
+static const char *const debug_none_options[] = {
+    "CONFIG_DEBUG_INFO_NONE=y",
+    "CONFIG_DEBUG_INFO_DWARF_TOOLCHAIN_DEFAULT=n",
+    "CONFIG_DEBUG_INFO_DWARF4=n",
+    "CONFIG_DEBUG_INFO_DWARF5=n",
+    NULL
+};
+static const char *const debug_reduced_options[] = {
+    "CONFIG_DEBUG_INFO_NONE=n",
+    "CONFIG_DEBUG_INFO_DWARF_TOOLCHAIN_DEFAULT=y",
+    "CONFIG_DEBUG_INFO_REDUCED=y",
+    "CONFIG_DEBUG_INFO_COMPRESSED_ZSTD=y",
+    "CONFIG_DEBUG_INFO_BTF=n",
+    NULL
+};
+static const char *const debug_split_options[] = {
+    "CONFIG_DEBUG_INFO_NONE=n",
+    "CONFIG_DEBUG_INFO_DWARF_TOOLCHAIN_DEFAULT=y",
+    "CONFIG_DEBUG_INFO_SPLIT=y",
+    "CONFIG_DEBUG_INFO_COMPRESSED_ZSTD=y",
+    "CONFIG_DEBUG_INFO_BTF=n",
+    NULL
+};
+
+// --low-memory: pahole's BTF encoding of vmlinux and of every module is the
+// biggest memory spike of a build
+static const char *const low_memory_config_options[] = {
+    "CONFIG_DEBUG_INFO_BTF=n",
+    "CONFIG_DEBUG_INFO_BTF_MODULES=n",
+    NULL
+};
+
+// --toolchain llvm: whole-kernel ThinLTO
+static const char *const thinlto_config_options[] = {
+    "CONFIG_LTO_NONE=n",
+    "CONFIG_LTO_CLANG_THIN=y",
+    NULL
+};
+
+// --pgo: Clang AutoFDO. The same Kconfig serves both phases; the profile is
+// passed to make as CLANG_AUTOFDO_PROFILE in the use phase.
+static const char *const autofdo_config_options[] = {
+    "CONFIG_AUTOFDO_CLANG=y",
+    NULL
+};
+
+static const config_fragment_t rk3588_fragment = { "rk3588", rk3588_config_options };
+static const config_fragment_t mali_fragment = { "mali", mali_config_options };
+static const config_fragment_t performance_fragment = { "performance", performance_config_options };
+static const config_fragment_t thinlto_fragment = { "llvm-thinlto", thinlto_config_options };
+static const config_fragment_t autofdo_fragment = { "autofdo", autofdo_config_options };
+static const config_fragment_t low_memory_fragment = { "low-memory", low_memory_config_options };
+static const config_fragment_t preempt_fragments[] = {
+    { "preempt-none", preempt_none_options },
+    { "preempt-voluntary", preempt_voluntary_options },
+    { "preempt-full", preempt_full_options },
+    { NULL, NULL }
+};
+static const config_fragment_t debug_info_fragments[] = {
+    { "debug-none", debug_none_options },
+    { "debug-reduced", debug_reduced_options },
+    { "debug-split", debug_split_options },
+    { NULL, NULL }
+};
+
+// Kernel flavours selectable with --profile; the first listed is installed
+static const build_profile_t build_profiles[] = {
+    { "desktop", "Mali GPU, display and video acceleration",
+      { &rk3588_fragment, &mali_fragment, NULL }, "", "-opi5plus-mali", 1 },
+    { "server", "Headless: no display, GPU or video drivers",
+      { &rk3588_fragment, NULL, NULL }, "-server", "-opi5plus-server", 0 },
+    { "performance", "Headless edge/network node: schedutil, NO_HZ_FULL, BPF JIT, THP, 512M CMA",
+      { &rk3588_fragment, &performance_fragment, NULL }, "-perf", "-opi5plus-perf", 0 },
+    { NULL, NULL, { NULL, NULL, NULL }, NULL, NULL, 0 }
+};
+
+// Resolve the --profile list. Profiles share one source tree but each
+// builds into its own object directory, so switching keeps warm objects.
+int parse_profiles(build_config_t *config) {
+    char list[sizeof(config->profiles)];
+    char msg[160];
+    char *name;
+    int i, gpu = 0;
+    
+    snprintf(list, sizeof(list), "%s", config->profiles);
+    config->profile_count = 0;
+    
+    for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        for (i = 0; build_profiles[i].name && strcmp(build_profiles[i].name, name) != 0; i++) {
+        }
+        if (!build_profiles[i].name) {
+            snprintf(msg, sizeof(msg), "Unknown profile '%s' (available: desktop, server, performance)", name);
+            log_message("ERROR", msg);
+            return -1;
+        }
+        if (config->profile_count == MAX_PROFILES) {
+            log_message("ERROR", "Too many profiles");
+            return -1;
+        }
+        config->profile_list[config->profile_count++] = &build_profiles[i];
+        gpu |= build_profiles[i].gpu;
+    }
+    
+    if (config->profile_count == 0) {
+        config->profile_list[config->profile_count++] = &build_profiles[0];
+        gpu = build_profiles[0].gpu;
+    }
+    
+    // Headless-only runs have no use for the Mali userspace stack
+    if (!gpu) {
+        config->install_gpu_blobs = 0;
+        config->enable_opencl = 0;
+        config->enable_vulkan = 0;
+    }
+    
+    select_profile(config, 0);
+    return 0;
+}
+
+// Point the kernel stages at a profile and its object directory. Clang
+// objects get their own directory so switching toolchains keeps both warm.
+void select_profile(build_config_t *config, int index) {
+    config->profile = config->profile_list[index];
+    snprintf(config->objdir, sizeof(config->objdir), "%s/%s%s",
+             config->scratch_root, config->profile->name,
+             strcmp(config->toolchain, "llvm") == 0 ? "-llvm" : "");
+}
+
+// Built-in fragments for the current profile in merge order. Returns the count.
+static int collect_fragments(build_config_t *config, const config_fragment_t **list) {
+    int i, count = 0;
+    
+    for (i = 0; config->profile->fragments[i] != NULL; i++) {
+        list[count++] = config->profile->fragments[i];
+    }
+    if (config->preempt) {
+        list[count++] = config->preempt;
+    }
+    if (config->debug_info) {
+        list[count++] = config->debug_info;
+    }
+    if (config->low_memory) {
+        list[count++] = &low_memory_fragment;
+    }
+    if (strcmp(config->toolchain, "llvm") == 0) {
+        list[count++] = &thinlto_fragment;
+    }
+    if (config->pgo[0]) {
+        list[count++] = &autofdo_fragment;
+    }
+    return count;
+}
+
+// Write a built-in fragment as a merge_config.sh input file
+static int write_config_fragment(const config_fragment_t *fragment, const char *path) {
+    FILE *fp = fopen(path, "w");
+    int i;
+    
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp, "# %s fragment (builder %s)\n", fragment->name, VERSION);
+    for (i = 0; fragment->options[i] != NULL; i++) {
+        fprintf(fp, "%s\n", fragment->options[i]);
+    }
+    return fclose(fp);
+}
+
+// Read a whole file into a newly allocated, NUL-terminated buffer that
+// starts with a newline, so every line can be matched as "\n<line>\n"
+static char *read_config_text(const char *path) {
+    struct stat st;
+    char *text;
+    size_t bytes;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp || fstat(fileno(fp), &st) != 0) {
+        if (fp) {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    text = malloc(st.st_size + 2);
+    if (!text) {
+        fclose(fp);
+        return NULL;
+    }
+    text[0] = '\n';
+    bytes = fread(text + 1, 1, st.st_size, fp);
+    text[bytes + 1] = '\0';
+    fclose(fp);
+    return text;
+}
+
+// Warn about requested options that Kconfig dropped or changed (unmet
+// dependencies, renamed symbols). Returns the number of such options.
+static int report_dropped_options(const config_fragment_t *fragment, const char *text) {
+    char needle[256];
+    char msg[320];
+    const char *value;
+    int i, dropped = 0;
+    
+    for (i = 0; fragment->options[i] != NULL; i++) {
+        value = strchr(fragment->options[i], '=');
+        if (!value) {
+            continue;
+        }
+        if (strcmp(value, "=n") == 0) {
+            // Either "# CONFIG_X is not set" or simply absent
+            snprintf(needle, sizeof(needle), "\n%.*s=", (int)(value - fragment->options[i]), fragment->options[i]);
+        } else {
+            snprintf(needle, sizeof(needle), "\n%s\n", fragment->options[i]);
+        }
+        if ((strcmp(value, "=n") == 0) == (strstr(text, needle) != NULL)) {
+            snprintf(msg, sizeof(msg), "Config option not applied (%s fragment): %s",
+                     fragment->name, fragment->options[i]);
+            log_message("WARNING", msg);
+            dropped++;
+        }
+    }
+    return dropped;
+}
+
+// Configure kernel with Mali GPU support
+int configure_kernel(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char targets[160];
+    char merge_script[MAX_PATH_LEN + 64];
+    char fragment_list[MAX_CMD_LEN / 2];
+    const config_fragment_t *fragments[MAX_FRAGMENTS + 1];
+    int fragment_count;
+    char path[MAX_PATH_LEN];
+    char msg[128];
+    char *text;
+    size_t len;
+    int i;
+    
+    snprintf(msg, sizeof(msg), "Configuring kernel (%s profile)...", config->profile->name);
+    log_message("INFO", msg);
+    
+    // Clean previous build artifacts if requested; only this profile's
+    // object directory is discarded
+    if (config->clean_build) {
+        log_message("INFO", "Cleaning previous build artifacts...");
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", config->objdir);
+        if (execute_command(cmd, 1) != 0) {
+            log_message("WARNING", "Failed to clean build artifacts");
+        }
+    }
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    
+    // Everything is generated into a candidate file; the live .config (and
+    // with it every object that depends on it) is only touched if the
+    // effective configuration actually changes
+    unlink(CONFIG_CANDIDATE);
+    
+    // Use Orange Pi 5 Plus specific defconfig
+    snprintf(targets, sizeof(targets), "KCONFIG_CONFIG=%s %s", CONFIG_CANDIDATE, config->defconfig);
+    build_make_command(config, cmd, sizeof(cmd), targets);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("WARNING", "Failed to use specific defconfig, trying generic...");
+        
+        // Fallback to generic arm64 defconfig
+        snprintf(targets, sizeof(targets), "KCONFIG_CONFIG=%s defconfig", CONFIG_CANDIDATE);
+        build_make_command(config, cmd, sizeof(cmd), targets);
+        if (execute_command(cmd, 1) != 0) {
+            log_message("ERROR", "Failed to configure kernel");
+            return -1;
+        }
+    }
+    
+    // Merge the profile's RK3588, Mali GPU and hardware acceleration fragments
+    log_message("INFO", "Merging RK3588, Mali GPU, and hardware acceleration config fragments...");
+    
+    if (create_directory("fragments") != 0) {
+        return -1;
+    }
+    len = 0;
+    fragment_count = collect_fragments(config, fragments);
+    for (i = 0; i < fragment_count; i++) {
+        snprintf(path, sizeof(path), "fragments/%s.config", fragments[i]->name);
+        if (write_config_fragment(fragments[i], path) != 0) {
+            log_message("ERROR", "Failed to write config fragment");
+            return -1;
+        }
+        len += snprintf(fragment_list + len, sizeof(fragment_list) - len, " %s", path);
+    }
+    for (i = 0; i < config->user_fragment_count && len < sizeof(fragment_list); i++) {
+        len += snprintf(fragment_list + len, sizeof(fragment_list) - len, " %s", config->user_fragments[i]);
+    }
+    if (len >= sizeof(fragment_list)) {
+        log_message("ERROR", "Too many config fragments");
+        return -1;
+    }
+    
+    snprintf(merge_script, sizeof(merge_script), "%s/linux/scripts/kconfig/merge_config.sh", config->build_dir);
+    if (access(merge_script, R_OK) == 0) {
+        snprintf(cmd, sizeof(cmd), "KCONFIG_CONFIG=%s sh %s -m %s%s",
+                 CONFIG_CANDIDATE, merge_script, CONFIG_CANDIDATE, fragment_list);
+    } else {
+        // Trees without merge_config.sh: Kconfig keeps the last assignment
+        log_message("WARNING", "merge_config.sh not found, appending fragments instead");
+        snprintf(cmd, sizeof(cmd), "cat%s >> %s", fragment_list, CONFIG_CANDIDATE);
+    }
+    if (execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "Failed to merge config fragments");
+        return -1;
+    }
+    
+    // Run olddefconfig to resolve dependencies
+    snprintf(targets, sizeof(targets), "KCONFIG_CONFIG=%s olddefconfig", CONFIG_CANDIDATE);
+    build_make_command(config, cmd, sizeof(cmd), targets);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("WARNING", "Failed to resolve config dependencies");
+    }
+    unlink(CONFIG_CANDIDATE ".old");
+    
+    text = read_config_text(CONFIG_CANDIDATE);
+    if (!text) {
+        log_message("ERROR", "Failed to read generated kernel config");
+        return -1;
+    }
+    for (i = 0; i < fragment_count; i++) {
+        report_dropped_options(fragments[i], text);
+    }
+    free(text);
+    
+    // Keep the existing .config (and its mtime) when nothing changed
+    if (files_identical(".config", CONFIG_CANDIDATE)) {
+        unlink(CONFIG_CANDIDATE);
+        log_message("INFO", "Effective kernel config unchanged, keeping existing .config");
+    } else if (rename(CONFIG_CANDIDATE, ".config") != 0) {
+        log_message("ERROR", "Failed to install the new kernel config");
+        return -1;
+    } else {
+        log_message("INFO", "Kernel config updated");
+    }
+    
+    snprintf(msg, sizeof(msg), "Kernel configured successfully (%s profile)", config->profile->name);
+    log_message("SUCCESS", msg);
+    return 0;
+}
+
+// Check whether a symbol is enabled (=y or =m) in the kernel .config.
+// Returns -1 when the tree has not been configured yet.
+int kernel_config_enabled(build_config_t *config, const char *symbol) {
+    char path[MAX_PATH_LEN + 128];
+    char line[256];
+    size_t len = strlen(symbol);
+    int enabled = 0;
+    FILE *fp;
+    
+    snprintf(path, sizeof(path), "%s/.config", config->objdir);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, symbol, len) == 0 && line[len] == '=' &&
+            (line[len + 1] == 'y' || line[len + 1] == 'm')) {
+            enabled = 1;
+            break;
+        }
+    }
+    
+    fclose(fp);
+    return enabled;
+}
+
+// Read a /proc/meminfo field in MB, or -1 if unavailable
+long read_meminfo_mb(const char *key) {
+    char line[128];
+    char name[64];
+    long kb;
+    FILE *fp = fopen("/proc/meminfo", "r");
+    
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%63[^:]: %ld", name, &kb) == 2 && strcmp(name, key) == 0) {
+            fclose(fp);
+            return kb / 1024;
+        }
+    }
+    
+    fclose(fp);
+    return -1;
+}
+
+// CPUs granted by the cgroup CPU quota (v2 cpu.max or v1 CFS quota), or 0
+// when the quota is unlimited
+int read_cgroup_cpu_limit(void) {
+    char quota_str[32];
+    long quota = -1, period = 0;
+    FILE *fp;
+    
+    fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (fp) {
+        if (fscanf(fp, "%31s %ld", quota_str, &period) == 2 && strcmp(quota_str, "max") != 0) {
+            quota = atol(quota_str);
+        }
+        fclose(fp);
+    } else {
+        fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if (fp) {
+            if (fscanf(fp, "%ld", &quota) != 1) {
+                quota = -1;
+            }
+            fclose(fp);
+        }
+        fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (fp) {
+            if (fscanf(fp, "%ld", &period) != 1) {
+                period = 0;
+            }
+            fclose(fp);
+        }
+    }
+    
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return (int)((quota + period - 1) / period);
+}
+
+// Pick make -j and -l from the CPUs we may run on, their big.LITTLE capacity,
+// the cgroup quota, available memory per job and the current load
+void auto_tune_jobs(build_config_t *config) {
+    cpu_set_t set;
+    char path[128];
+    char msg[512];
+    char quota_desc[16];
+    long capacity[CPU_SETSIZE];
+    long max_capacity = 0, little_capacity = 0;
+    int cpus = 0, big = 0, little = 0;
+    int quota, cpu_budget, cpu_jobs, mem_jobs, load_jobs, heavy;
+    long available_mb, mb_per_job;
+    double load[1] = { 0 };
+    int cpu;
+    FILE *fp;
+    
+    // CPUs in our affinity mask (taskset/cpuset aware) and their capacity;
+    // on RK3588 the A76 cores report 1024 and the A55 cores about 400
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        for (cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+        cpus++;
+        capacity[cpu] = 1024;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+        fp = fopen(path, "r");
+        if (fp) {
+            if (fscanf(fp, "%ld", &capacity[cpu]) != 1) {
+                capacity[cpu] = 1024;
+            }
+            fclose(fp);
+        }
+        if (capacity[cpu] > max_capacity) {
+            max_capacity = capacity[cpu];
+        }
+    }
+    
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+        // Anything below 80% of the fastest core counts as a LITTLE core
+        if (capacity[cpu] * 10 >= max_capacity * 8) {
+            big++;
+        } else {
+            little++;
+            little_capacity += capacity[cpu];
+        }
+    }
+    
+    // A LITTLE core finishes a translation unit far later than a big one and
+    // stretches the tail of every target, so count LITTLE cores by their
+    // relative capacity rather than one job each
+    cpu_jobs = big;
+    if (little > 0 && max_capacity > 0) {
+        cpu_jobs += (int)((little_capacity + max_capacity - 1) / max_capacity);
+    }
+    if (cpu_jobs < 1) {
+        cpu_jobs = 1;
+    }
+    
+    cpu_budget = cpus > 0 ? cpus : 1;
+    quota = read_cgroup_cpu_limit();
+    if (quota > 0 && quota < cpu_budget) {
+        cpu_budget = quota;
+    }
+    if (cpu_jobs > cpu_budget) {
+        cpu_jobs = cpu_budget;
+    }
+    
+    // BTF (pahole) and LTO links need far more memory per job; assume the
+    // worst until the tree has been configured
+    heavy = kernel_config_enabled(config, "CONFIG_DEBUG_INFO_BTF");
+    if (heavy <= 0) {
+        int lto = kernel_config_enabled(config, "CONFIG_LTO_CLANG");
+        heavy = (heavy < 0 || lto > 0);
+    }
+    mb_per_job = heavy ? MB_PER_JOB_HEAVY : MB_PER_JOB;
+    available_mb = read_meminfo_mb("MemAvailable");
+    mem_jobs = available_mb > 0 ? (int)(available_mb / mb_per_job) : cpu_jobs;
+    if (mem_jobs < 1) {
+        mem_jobs = 1;
+    }
+    
+    // Leave room for whatever else is already running
+    load_jobs = cpu_jobs;
+    if (getloadavg(load, 1) == 1 && load[0] > 0.5) {
+        load_jobs = (int)(cpu_budget - load[0] + 0.5);
+        if (load_jobs < 1) {
+            load_jobs = 1;
+        }
+    }
+    
+    config->jobs = cpu_jobs;
+    if (mem_jobs < config->jobs) {
+        config->jobs = mem_jobs;
+    }
+    if (load_jobs < config->jobs) {
+        config->jobs = load_jobs;
+    }
+    
+    // Stop spawning new jobs whenever the machine is already saturated
+    config->load_limit = cpu_budget;
+    
+    if (quota > 0) {
+        snprintf(quota_desc, sizeof(quota_desc), "%d", quota);
+    } else {
+        strcpy(quota_desc, "none");
+    }
+    snprintf(msg, sizeof(msg),
+             "Auto jobs: -j%d -l%.0f (cpus %d: %d big/%d little -> %d, cgroup quota %s, "
+             "memory %ld MB / %ld MB per job -> %d, load %.2f -> %d)",
+             config->jobs, config->load_limit, cpus, big, little, cpu_jobs, quota_desc,
+             available_mb, mb_per_job, mem_jobs, load[0], load_jobs);
+    log_message("INFO", msg);
+}
+
+// --low-memory: compile at -j but link modules with one job per
+// MB_PER_LINK_JOB of available memory, and never stack profiles or targets
+void apply_low_memory(build_config_t *config) {
+    char msg[256];
+    long available_mb = read_meminfo_mb("MemAvailable");
+    
+    config->link_jobs = available_mb > 0 ? (int)(available_mb / MB_PER_LINK_JOB) : 1;
+    if (config->link_jobs < 1) {
+        config->link_jobs = 1;
+    }
+    if (config->link_jobs > config->jobs) {
+        config->link_jobs = config->jobs;
+    }
+    
+    // Both run several link steps at once
+    config->parallel_profiles = 0;
+    config->single_make = 0;
+    
+    snprintf(msg, sizeof(msg), "Low memory: compile -j%d, module link -j%d (%ld MB available), BTF disabled",
+             config->jobs, config->link_jobs, available_mb);
+    log_message("INFO", msg);
+    if (strcmp(config->toolchain, "llvm") == 0) {
+        log_message("WARNING", "ThinLTO links vmlinux in one large step; consider --toolchain gcc");
+    }
+}
+
+// Free space in MB of the filesystem holding path, or -1 if unavailable
+long free_space_mb(const char *path) {
+    struct statvfs st;
+    
+    if (statvfs(path, &st) != 0) {
+        return -1;
+    }
+    return (long)((unsigned long long)st.f_bavail * st.f_frsize / (1024 * 1024));
+}
+
+// Find the mount holding path (the longest matching mount point in
+// /proc/mounts). Returns 0 on success.
+int find_mount(const char *path, char *device, size_t device_size,
+               char *mount_point, size_t mount_size, char *fstype, size_t fstype_size) {
+    char resolved[MAX_PATH_LEN];
+    char line[1024];
+    char dev[256], mnt[MAX_PATH_LEN], type[32];
+    size_t len, best = 0;
+    FILE *fp;
+    
+    if (!realpath(path, resolved)) {
+        return -1;
+    }
+    
+    fp = fopen("/proc/mounts", "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%255s %511s %31s", dev, mnt, type) != 3) {
+            continue;
+        }
+        len = strlen(mnt);
+        if (strncmp(resolved, mnt, len) != 0 ||
+            (len > 1 && resolved[len] != '\0' && resolved[len] != '/')) {
+            continue;
+        }
+        if (len >= best) {
+            best = len;
+            snprintf(device, device_size, "%s", dev);
+            snprintf(mount_point, mount_size, "%s", mnt);
+            snprintf(fstype, fstype_size, "%s", type);
+        }
+    }
+    
+    fclose(fp);
+    return best > 0 ? 0 : -1;
+}
+
+// Writable NVMe mount with the most free space, or -1 if there is none
+static long find_nvme_mount(char *mount_point, size_t size) {
+    char line[1024];
+    char dev[256], mnt[MAX_PATH_LEN], type[32], options[256];
+    long free_mb, best = -1;
+    FILE *fp = fopen("/proc/mounts", "r");
+    
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%255s %511s %31s %255s", dev, mnt, type, options) != 4 ||
+            strncmp(dev, "/dev/nvme", 9) != 0 || strncmp(options, "rw", 2) != 0) {
+            continue;
+        }
+        free_mb = free_space_mb(mnt);
+        if (free_mb > best) {
+            best = free_mb;
+            snprintf(mount_point, size, "%s", mnt);
+        }
+    }
+    
+    fclose(fp);
+    return best;
+}
+
+// Human name of the storage behind a block device
+static const char *storage_kind(const char *device) {
+    if (strncmp(device, "/dev/mmcblk", 11) == 0) {
+        return "eMMC/SD";
+    } else if (strncmp(device, "/dev/nvme", 9) == 0) {
+        return "NVMe";
+    } else if (strncmp(device, "/dev/sd", 7) == 0) {
+        return "SATA/USB";
+    }
+    return "disk";
+}
+
+// Place the object directories. Object files are written once and read a
+// few times, so on eMMC/SD most of the build's I/O (and flash wear) can be
+// moved to tmpfs when RAM allows, or to an NVMe drive. Only the final
+// artifacts are copied back to the build directory.
+int setup_scratch(build_config_t *config) {
+    char path[MAX_PATH_LEN + 16];
+    char device[256] = "unknown", mount_point[MAX_PATH_LEN], fstype[32];
+    char mnt_device[256] = "unknown", mnt_point[MAX_PATH_LEN], mnt_type[32];
+    char cmd[MAX_CMD_LEN];
+    char msg[MAX_PATH_LEN + 192];
+    long needed_mb = 0, budget_mb, free_mb, size_mb;
+    long long bytes;
+    int auto_mode = strcmp(config->scratch, "auto") == 0;
+    int i;
+    
+    snprintf(config->scratch_root, sizeof(config->scratch_root), "%s/%s", config->build_dir, OBJ_DIR);
+    if (strcmp(config->scratch, "disk") == 0) {
+        return 0;
+    }
+    
+    // Size from the previous on-disk object directories, if any
+    for (i = 0; i < config->profile_count; i++) {
+        select_profile(config, i);
+        bytes = tree_size(config->objdir);
+        needed_mb += bytes > 0 ? (long)(bytes / (1024 * 1024)) : SCRATCH_ESTIMATE_MB;
+    }
+    select_profile(config, 0);
+    
+    find_mount(config->build_dir, device, sizeof(device), mount_point, sizeof(mount_point),
+               fstype, sizeof(fstype));
+    
+    if (auto_mode && strcmp(fstype, "tmpfs") == 0) {
+        log_message("INFO", "Build directory is already on tmpfs; object directories stay there");
+        return 0;
+    }
+    
+    if (auto_mode || strcmp(config->scratch, "tmpfs") == 0) {
+        // RAM left after the compile jobs and some headroom
+        budget_mb = read_meminfo_mb("MemAvailable") - SCRATCH_HEADROOM_MB -
+                    (long)config->jobs * (strcmp(config->toolchain, "llvm") == 0 ? MB_PER_JOB_HEAVY : MB_PER_JOB);
+        size_mb = needed_mb + needed_mb / 4;
+        if (size_mb > budget_mb) {
+            size_mb = budget_mb;
+        }
+        
+        if (budget_mb >= needed_mb || (!auto_mode && budget_mb >= SCRATCH_HEADROOM_MB)) {
+            snprintf(path, sizeof(path), "%s/%s", config->build_dir, SCRATCH_DIR);
+            if (create_directory(path) != 0) {
+                return -1;
+            }
+            if (find_mount(path, mnt_device, sizeof(mnt_device), mnt_point, sizeof(mnt_point),
+                           mnt_type, sizeof(mnt_type)) == 0 &&
+                strcmp(mnt_type, "tmpfs") == 0 && strcmp(mnt_point, mount_point) != 0) {
+                // Still mounted from an earlier run: keep its objects
+                snprintf(cmd, sizeof(cmd), "mount -o remount,size=%ldm %s", size_mb, path);
+            } else {
+                snprintf(cmd, sizeof(cmd), "mount -t tmpfs -o size=%ldm,mode=0755 kernel-scratch %s",
+                         size_mb, path);
+            }
+            if (execute_command(cmd, 0) == 0) {
+                snprintf(config->scratch_root, sizeof(config->scratch_root), "%s", path);
+                config->scratch_tmpfs = 1;
+                snprintf(msg, sizeof(msg),
+                         "Object directories on tmpfs %s (%ld MB, ~%ld MB needed); keeps ~%ld MB of "
+                         "object writes off %s (%s)", path, size_mb, needed_mb, needed_mb, device,
+                         storage_kind(device));
+                log_message("INFO", msg);
+                if (size_mb < needed_mb) {
+                    log_message("WARNING", "Scratch tmpfs is smaller than the estimate; a full tmpfs spills to disk");
+                }
+                select_profile(config, 0);
+                return 0;
+            }
+            log_message("WARNING", "Could not mount scratch tmpfs");
+        } else {
+            snprintf(msg, sizeof(msg), "Not enough RAM for a scratch tmpfs (%ld MB free after -j%d, ~%ld MB needed)",
+                     budget_mb > 0 ? budget_mb : 0, config->jobs, needed_mb);
+            log_message(auto_mode ? "INFO" : "WARNING", msg);
+        }
+    }
+    
+    if (auto_mode) {
+        if (strncmp(device, "/dev/nvme", 9) == 0) {
+            log_message("INFO", "Build directory is already on NVMe; object directories stay there");
+            return 0;
+        }
+        free_mb = find_nvme_mount(path, sizeof(path));
+        if (free_mb < needed_mb + SCRATCH_HEADROOM_MB) {
+            snprintf(msg, sizeof(msg), "No scratch space found; object directories stay on %s (%s)",
+                     device, storage_kind(device));
+            log_message("INFO", msg);
+            return 0;
+        }
+        snprintf(config->scratch_root, sizeof(config->scratch_root), "%s/kernel-scratch", path);
+    } else if (strcmp(config->scratch, "tmpfs") == 0) {
+        log_message("WARNING", "Falling back to object directories in the build directory");
+        return 0;
+    } else {
+        snprintf(config->scratch_root, sizeof(config->scratch_root), "%s", config->scratch);
+    }
+    
+    if (create_directory(config->scratch_root) != 0) {
+        log_message("ERROR", "Failed to create scratch directory");
+        return -1;
+    }
+    free_mb = free_space_mb(config->scratch_root);
+    if (free_mb >= 0 && free_mb < needed_mb) {
+        snprintf(msg, sizeof(msg), "Scratch directory has %ld MB free, ~%ld MB needed", free_mb, needed_mb);
+        log_message("WARNING", msg);
+    }
+    if (find_mount(config->scratch_root, mnt_device, sizeof(mnt_device), mnt_point, sizeof(mnt_point),
+                   mnt_type, sizeof(mnt_type)) == 0 && strcmp(mnt_device, device) == 0) {
+        snprintf(msg, sizeof(msg), "Object directories in %s (same device as the build directory)",
+                 config->scratch_root);
+    } else {
+        snprintf(msg, sizeof(msg), "Object directories in %s (%s); keeps ~%ld MB of object writes off %s (%s)",
+                 config->scratch_root, storage_kind(mnt_device), needed_mb, device, storage_kind(device));
+    }
+    log_message("INFO", msg);
+    select_profile(config, 0);
+    return 0;
+}
+
+// Whether the object directories live outside <build>/out
+static int scratch_active(build_config_t *config) {
+    char disk_root[MAX_PATH_LEN + 8];
+    
+    snprintf(disk_root, sizeof(disk_root), "%s/%s", config->build_dir, OBJ_DIR);
+    return strcmp(config->scratch_root, disk_root) != 0;
+}
+
+// Move a full tmpfs object directory to the build directory and leave a
+// symlink behind, so the build resumes on disk with the objects it has
+int spill_scratch(build_config_t *config) {
+    char disk_dir[MAX_PATH_LEN + 128];
+    char cmd[MAX_CMD_LEN];
+    struct stat st;
+    long free_mb;
+    
+    if (!config->scratch_tmpfs || lstat(config->objdir, &st) != 0 || S_ISLNK(st.st_mode)) {
+        return -1;
+    }
+    free_mb = free_space_mb(config->objdir);
+    if (free_mb < 0 || free_mb > SCRATCH_SPILL_MB) {
+        return -1;  // Not a space problem
+    }
+    
+    log_message("WARNING", "Scratch tmpfs is full; spilling the object directory to disk");
+    snprintf(disk_dir, sizeof(disk_dir), "%s/%s/%s", config->build_dir, OBJ_DIR, strrchr(config->objdir, '/') + 1);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", disk_dir);
+    execute_command(cmd, 0);
+    if (create_directory(disk_dir) != 0) {
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd), "cp -a %s/. %s", config->objdir, disk_dir);
+    if (execute_command(cmd, 0) != 0) {
+        log_message("ERROR", "Failed to move object directory to disk");
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", config->objdir);
+    if (execute_command(cmd, 0) != 0 || symlink(disk_dir, config->objdir) != 0) {
+        log_message("ERROR", "Failed to replace object directory with a link to disk");
+        return -1;
+    }
+    return enter_kernel_tree(config);
+}
+
+// Copy the final build outputs out of scratch space into
+// <build>/artifacts/<profile>. Returns 0 when nothing needs preserving.
+int preserve_artifacts(build_config_t *config) {
+    const char *files[] = { "arch/arm64/boot/Image", "System.map", ".config", "vmlinux" };
+    char dir[MAX_PATH_LEN + 128];
+    char src[MAX_PATH_LEN * 2];
+    char msg[MAX_PATH_LEN + 160];
+    int i, count = 3;
+    
+    if (!scratch_active(config)) {
+        return 0;
+    }
+    
+    // AutoFDO needs the matching vmlinux to turn the recorded profile into
+    // kernel.afdo
+    if (strcmp(config->pgo, "instrument") == 0) {
+        count = 4;
+    }
+    
+    snprintf(dir, sizeof(dir), "%s/%s/%s", config->build_dir, ARTIFACT_DIR, strrchr(config->objdir, '/') + 1);
+    if (create_directory(dir) != 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        snprintf(src, sizeof(src), "%s/%s", config->objdir, files[i]);
+        if (copy_file(src, dir) != 0) {
+            snprintf(msg, sizeof(msg), "Failed to preserve %s", files[i]);
+            log_message("WARNING", msg);
+        }
+    }
+    snprintf(msg, sizeof(msg), "Build artifacts saved to %s", dir);
+    log_message("INFO", msg);
+    return 0;
+}
+
+// Build a kernel make invocation for the configured job count, routing the
+// target compiler through the compiler cache when one is enabled
+void build_make_command(build_config_t *config, char *cmd, size_t size, const char *targets) {
+    char cc_override[192] = "";
+    char load_limit[32] = "";
+    char localversion[64] = "";
+    char toolchain[MAX_PATH_LEN + 40] = "";
+    int len;
+    const char *kcflags = config->tune_cpu ? " KCFLAGS=" TUNE_CPU_FLAGS : "";
+    const char *launcher = NULL;
+    int jobs = config->jobs;
+    
+    // Concurrent profile builds share the job budget
+    if (config->parallel_profiles && config->profile_count > 1) {
+        jobs = jobs / config->profile_count > 0 ? jobs / config->profile_count : 1;
+    }
+    
+    if (config->profile->localversion[0]) {
+        snprintf(localversion, sizeof(localversion), " LOCALVERSION=%s", config->profile->localversion);
+    }
+    
+    // With ccache the distributed compiler runs as CCACHE_PREFIX
+    if (strcmp(config->compiler_cache, "none") != 0) {
+        launcher = config->compiler_cache;
+    } else if (config->distributed[0]) {
+        launcher = config->distributed;
+    }
+    if (launcher && strcmp(config->toolchain, "llvm") == 0) {
+        snprintf(cc_override, sizeof(cc_override), " CC=\"%s clang\"", launcher);
+    } else if (launcher) {
+        snprintf(cc_override, sizeof(cc_override), " CC=\"%s %sgcc\"", launcher, config->cross_compile);
+    }
+    
+    if (strcmp(config->toolchain, "llvm") == 0) {
+        len = snprintf(toolchain, sizeof(toolchain), " LLVM=1");
+        if (strcmp(config->pgo, "use") == 0) {
+            snprintf(toolchain + len, sizeof(toolchain) - len, " CLANG_AUTOFDO_PROFILE=%s", config->pgo_profile);
+        }
+    }
+    
+    if (config->load_limit > 0) {
+        snprintf(load_limit, sizeof(load_limit), " -l%.1f", config->load_limit);
+    }
+    
+    snprintf(cmd, size, "make -C %s/linux O=%s -j%d%s%s%s%s%s %s", config->build_dir, config->objdir,
+             jobs, load_limit, toolchain, cc_override, localversion, kcflags, targets);
+}
+
+// Validate the requested compiler cache and export its directory and size
+// limit so every make invocation (and the cache daemon) picks them up
+int setup_compiler_cache(build_config_t *config) {
+    char msg[MAX_PATH_LEN + 64];
+    
+    if (strcmp(config->compiler_cache, "none") == 0) {
+        return 0;
+    }
+    
+    if (strcmp(config->compiler_cache, "ccache") != 0 && strcmp(config->compiler_cache, "sccache") != 0) {
+        log_message("ERROR", "Unsupported compiler cache (use ccache, sccache or none)");
+        return -1;
+    }
+    
+    if (!find_in_path(config->compiler_cache)) {
+        snprintf(msg, sizeof(msg), "%s not found, building without a compiler cache", config->compiler_cache);
+        log_message("WARNING", msg);
+        strcpy(config->compiler_cache, "none");
+        return 0;
+    }
+    
+    if (config->compiler_cache_dir[0] == '\0' &&
+        snprintf(config->compiler_cache_dir, sizeof(config->compiler_cache_dir), "%s/%s",
+                 config->cache_dir, config->compiler_cache) >= (int)sizeof(config->compiler_cache_dir)) {
+        log_message("ERROR", "Cache directory path is too long");
+        return -1;
+    }
+    if (create_directory(config->compiler_cache_dir) != 0) {
+        return -1;
+    }
+    
+    if (strcmp(config->compiler_cache, "ccache") == 0) {
+        setenv("CCACHE_DIR", config->compiler_cache_dir, 1);
+        setenv("CCACHE_MAXSIZE", config->compiler_cache_size, 1);
+        // Build trees move between worktrees; hash relative to them
+        setenv("CCACHE_BASEDIR", config->build_dir, 1);
+        setenv("CCACHE_NOHASHDIR", "1", 1);
+    } else {
+        setenv("SCCACHE_DIR", config->compiler_cache_dir, 1);
+        setenv("SCCACHE_CACHE_SIZE", config->compiler_cache_size, 1);
+        execute_command("sccache --start-server", 0);
+    }
+    
+    snprintf(msg, sizeof(msg), "Using %s compiler cache at %s (limit %s)",
+             config->compiler_cache, config->compiler_cache_dir, config->compiler_cache_size);
+    log_message("INFO", msg);
+    return 0;
+}
+
+// Read the current compiler cache hit/miss counters
+int read_compiler_cache_stats(build_config_t *config, compiler_cache_stats_t *stats) {
+    char line[256];
+    char key[128];
+    long value;
+    FILE *fp;
+    
+    stats->hits = 0;
+    stats->misses = 0;
+    
+    if (strcmp(config->compiler_cache, "ccache") == 0) {
+        // Machine-readable "<counter>\t<value>" lines
+        fp = popen("ccache --print-stats 2>/dev/null", "r");
+        if (!fp) {
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "%127s %ld", key, &value) != 2) {
+                continue;
+            }
+            if (strcmp(key, "direct_cache_hit") == 0 || strcmp(key, "preprocessed_cache_hit") == 0) {
+                stats->hits += value;
+            } else if (strcmp(key, "cache_miss") == 0) {
+                stats->misses += value;
+            }
+        }
+        pclose(fp);
+    } else if (strcmp(config->compiler_cache, "sccache") == 0) {
+        fp = popen("sccache --show-stats 2>/dev/null", "r");
+        if (!fp) {
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "Cache hits %ld", &value) == 1) {
+                stats->hits = value;
+            } else if (sscanf(line, "Cache misses %ld", &value) == 1) {
+                stats->misses = value;
+            }
+        }
+        pclose(fp);
+    } else {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Print the compiler cache hits and misses accumulated during this run
+void print_compiler_cache_summary(build_config_t *config, compiler_cache_stats_t *before) {
+    compiler_cache_stats_t after;
+    char host[64] = "unknown";
+    long hits, misses;
+    
+    if (strcmp(config->compiler_cache, "none") == 0 || read_compiler_cache_stats(config, &after) != 0) {
+        return;
+    }
+    
+    hits = after.hits - before->hits;
+    misses = after.misses - before->misses;
+    gethostname(host, sizeof(host) - 1);
+    
+    printf("\n%s%sCompiler Cache (%s):%s\n", COLOR_BOLD, COLOR_YELLOW, host, COLOR_RESET);
+    printf("  Backend: %s\n", config->compiler_cache);
+    printf("  Directory: %s (limit %s)\n", config->compiler_cache_dir, config->compiler_cache_size);
+    printf("  Hits: %ld\n", hits);
+    printf("  Misses: %ld\n", misses);
+    if (hits + misses > 0) {
+        printf("  Hit Rate: %.1f%%\n", 100.0 * hits / (hits + misses));
+    }
+}
+
+// Open a TCP connection to host:port within timeout_ms. Returns 0 when the
+// host accepts connections.
+int probe_tcp_host(const char *host, int port, int timeout_ms, double *latency_ms) {
+    struct addrinfo hints = { 0 }, *addrs, *addr;
+    struct pollfd pfd;
+    struct timespec start;
+    char service[16];
+    socklen_t len;
+    int fd, error, result = -1;
+    
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &addrs) != 0) {
+        return -1;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (addr = addrs; addr && result != 0; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+            result = 0;
+        } else if (errno == EINPROGRESS) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            len = sizeof(error);
+            if (poll(&pfd, 1, timeout_ms) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+                result = 0;
+            }
+        }
+        close(fd);
+    }
+    freeaddrinfo(addrs);
+    
+    if (latency_ms) {
+        *latency_ms = elapsed_seconds(&start) * 1000.0;
+    }
+    return result;
+}
+
+static volatile sig_atomic_t monitor_stop = 0;
+
+static void stop_monitor(int sig) {
+    (void)sig;
+    monitor_stop = 1;
+}
+
+// Sample distccmon-text once a second. Each sample adds the number of busy
+// slots per host; samples with no compile in flight are not counted, so the
+// result is the utilization while distributed compiles were possible. The
+// totals are written to fd on SIGTERM.
+static void run_build_host_monitor(build_config_t *config, int fd, pid_t parent) {
+    long busy[MAX_BUILD_HOSTS + 1] = { 0 };
+    long samples = 0, pid;
+    char line[512];
+    char phase[32];
+    char *host, *end;
+    FILE *fp;
+    int i, any, len;
+    
+    signal(SIGTERM, stop_monitor);
+    while (!monitor_stop && getppid() == parent) {
+        fp = popen("distccmon-text 2>/dev/null", "r");
+        any = 0;
+        while (fp && fgets(line, sizeof(line), fp)) {
+            // "  4711  Compile     init/main.c        buildhost[2]"
+            if (sscanf(line, "%ld %31s", &pid, phase) != 2 || strcmp(phase, "Startup") == 0 ||
+                strcmp(phase, "Blocked") == 0 || strcmp(phase, "Done") == 0) {
+                continue;
+            }
+            line[strcspn(line, "\n")] = '\0';
+            host = strrchr(line, ' ');
+            end = strrchr(line, '[');
+            if (!host || !end || end < host) {
+                continue;
+            }
+            *end = '\0';
+            host++;
+            for (i = 0; i < config->build_host_count; i++) {
+                // distccmon-text truncates host names to 24 characters
+                if (strncmp(config->build_hosts[i].name, host, 24) == 0) {
+                    busy[i]++;
+                    any = 1;
+                    break;
+                }
+            }
+        }
+        if (fp) {
+            pclose(fp);
+        }
+        samples += any;
+        sleep(1);
+    }
+    
+    len = snprintf(line, sizeof(line), "%ld", samples);
+    for (i = 0; i < config->build_host_count; i++) {
+        len += snprintf(line + len, sizeof(line) - len, " %ld", busy[i]);
+    }
+    if (write(fd, line, len) < 0) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+// Fan compiles out to --build-hosts through distcc or icecream. Unreachable
+// hosts are dropped; with none left the build stays local. The job count
+// becomes the local jobs plus every reachable host's slots.
+int setup_distributed_build(build_config_t *config) {
+    build_host_t *host;
+    char spec[sizeof(config->build_hosts_spec)];
+    char distcc_hosts[MAX_CMD_LEN] = "";
+    char msg[256];
+    char *item, *mark;
+    double latency;
+    int port = strcmp(config->distributed, "icecc") == 0 ? ICECC_PORT : DISTCC_PORT;
+    int local_jobs = config->jobs;
+    int slots = 0;
+    int fds[2];
+    size_t len;
+    
+    if (!config->distributed[0]) {
+        return 0;
+    }
+    
+    if (!find_in_path(config->distributed)) {
+        snprintf(msg, sizeof(msg), "%s not found, building locally", config->distributed);
+        log_message("WARNING", msg);
+        config->distributed[0] = '\0';
+        return 0;
+    }
+    
+    config->build_host_count = 0;
+    snprintf(spec, sizeof(spec), "%s", config->build_hosts_spec);
+    for (item = strtok(spec, ","); item && config->build_host_count < MAX_BUILD_HOSTS; item = strtok(NULL, ",")) {
+        host = &config->build_hosts[config->build_host_count];
+        host->slots = DEFAULT_HOST_SLOTS;
+        host->port = port;
+        if ((mark = strchr(item, '/')) != NULL) {
+            *mark = '\0';
+            host->slots = atoi(mark + 1) > 0 ? atoi(mark + 1) : DEFAULT_HOST_SLOTS;
+        }
+        if ((mark = strchr(item, ':')) != NULL) {
+            *mark = '\0';
+            host->port = atoi(mark + 1);
+        }
+        snprintf(host->name, sizeof(host->name), "%s", item);
+        
+        if (probe_tcp_host(host->name, host->port, HOST_PROBE_TIMEOUT_MS, &latency) != 0) {
+            snprintf(msg, sizeof(msg), "Build host %s:%d unreachable, skipping", host->name, host->port);
+            log_message("WARNING", msg);
+            continue;
+        }
+        snprintf(msg, sizeof(msg), "Build host %s:%d reachable (%.0f ms, %d slots)",
+                 host->name, host->port, latency, host->slots);
+        log_message("INFO", msg);
+        
+        len = strlen(distcc_hosts);
+        snprintf(distcc_hosts + len, sizeof(distcc_hosts) - len, "%s%s:%d/%d,lzo",
+                 len ? " " : "", host->name, host->port, host->slots);
+        slots += host->slots;
+        config->build_host_count++;
+    }
+    
+    if (config->build_host_count == 0) {
+        log_message("WARNING", "No build hosts reachable, building locally");
+        config->distributed[0] = '\0';
+        return 0;
+    }
+    
+    // Remote hosts may be x86 or native arm64; a triplet-qualified compiler
+    // name resolves to an aarch64 compiler on both
+    if (config->cross_compile[0] == '\0') {
+        strcpy(config->cross_compile, "aarch64-linux-gnu-");
+        log_message("INFO", "Using CROSS_COMPILE=aarch64-linux-gnu- for distributed compiles");
+    }
+    
+    if (strcmp(config->compiler_cache, "sccache") == 0) {
+        log_message("WARNING", "sccache cannot chain to distcc/icecc; disabling the compiler cache");
+        strcpy(config->compiler_cache, "none");
+    } else if (strcmp(config->compiler_cache, "ccache") == 0) {
+        setenv("CCACHE_PREFIX", config->distributed, 1);
+    }
+    
+    if (strcmp(config->distributed, "distcc") == 0) {
+        len = strlen(distcc_hosts);
+        snprintf(distcc_hosts + len, sizeof(distcc_hosts) - len, " localhost/%d", local_jobs);
+        setenv("DISTCC_HOSTS", distcc_hosts, 1);
+    } else if (!getenv("ICECC_VERSION")) {
+        log_message("WARNING", "ICECC_VERSION is not set; hosts of another architecture need an "
+                    "icecc-create-env toolchain for the cross compiler");
+    }
+    
+    host = &config->build_hosts[config->build_host_count++];
+    snprintf(host->name, sizeof(host->name), "localhost");
+    host->port = 0;
+    host->slots = local_jobs;
+    
+    config->jobs = local_jobs + slots;
+    snprintf(msg, sizeof(msg), "Distributed build with %s: -j%d (%d local + %d remote slots on %d host(s))",
+             config->distributed, config->jobs, local_jobs, slots, config->build_host_count - 1);
+    log_message("INFO", msg);
+    
+    if (strcmp(config->distributed, "distcc") == 0 && pipe2(fds, O_CLOEXEC) == 0) {
+        pid_t parent = getpid();
+        
+        build_host_monitor = fork();
+        if (build_host_monitor == 0) {
+            close(fds[0]);
+            run_build_host_monitor(config, fds[1], parent);
+        }
+        close(fds[1]);
+        build_host_monitor_fd = fds[0];
+        if (build_host_monitor < 0) {
+            build_host_monitor = 0;
+            close(fds[0]);
+            build_host_monitor_fd = -1;
+        }
+    }
+    return 0;
+}
+
+// Stop the distcc sampler and print the per-host slot utilization
+void finish_build_host_monitor(build_config_t *config) {
+    char buffer[512];
+    char *field, *rest;
+    long samples, busy;
+    ssize_t bytes;
+    int i;
+    
+    if (build_host_monitor <= 0) {
+        if (strcmp(config->distributed, "icecc") == 0) {
+            log_message("INFO", "Per-host icecream utilization is shown by icemon");
+        }
+        return;
+    }
+    
+    // The totals fit in the pipe buffer, so the sampler never blocks
+    kill(build_host_monitor, SIGTERM);
+    waitpid(build_host_monitor, NULL, 0);
+    bytes = read(build_host_monitor_fd, buffer, sizeof(buffer) - 1);
+    close(build_host_monitor_fd);
+    build_host_monitor = 0;
+    if (bytes <= 0) {
+        return;
+    }
+    buffer[bytes] = '\0';
+    
+    samples = strtol(buffer, &rest, 10);
+    printf("\n%s%sBuild Hosts (distcc, %lds sampled):%s\n", COLOR_BOLD, COLOR_YELLOW, samples, COLOR_RESET);
+    for (i = 0; i < config->build_host_count; i++) {
+        field = rest;
+        busy = strtol(field, &rest, 10);
+        printf("  %-24s %3d slots  avg %5.1f busy  %5.1f%%\n", config->build_hosts[i].name,
+               config->build_hosts[i].slots, samples > 0 ? (double)busy / samples : 0.0,
+               samples > 0 ? 100.0 * busy / ((double)samples * config->build_hosts[i].slots) : 0.0);
+    }
+}
+
+// Sample the memory in use on the whole board (MemTotal - MemAvailable) and
+// the swap in use. Per-process peaks (ru_maxrss) miss a -j build's total.
+// The peaks are written to fd on SIGTERM.
+static void run_memory_monitor(int fd, pid_t parent) {
+    long total = read_meminfo_mb("MemTotal");
+    long used, swap, peak_used = 0, peak_swap = 0;
+    char line[64];
+    int len;
+    
+    signal(SIGTERM, stop_monitor);
+    while (!monitor_stop && getppid() == parent) {
+        used = total - read_meminfo_mb("MemAvailable");
+        swap = read_meminfo_mb("SwapTotal") - read_meminfo_mb("SwapFree");
+        if (used > peak_used) {
+            peak_used = used;
+        }
+        if (swap > peak_swap) {
+            peak_swap = swap;
+        }
+        usleep(MEMORY_SAMPLE_MS * 1000);
+    }
+    
+    len = snprintf(line, sizeof(line), "%ld %ld %ld", peak_used, peak_swap, total);
+    if (write(fd, line, len) < 0) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+// Fork the memory sampler. On failure *pid stays 0 and nothing is tracked.
+void start_memory_monitor(pid_t *pid, int *fd) {
+    pid_t parent = getpid();
+    int fds[2];
+    
+    *pid = 0;
+    *fd = -1;
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return;
+    }
+    *pid = fork();
+    if (*pid == 0) {
+        close(fds[0]);
+        run_memory_monitor(fds[1], parent);
+    }
+    close(fds[1]);
+    if (*pid < 0) {
+        *pid = 0;
+        close(fds[0]);
+        return;
+    }
+    *fd = fds[0];
+}
+
+// Stop the memory sampler and log the peaks against the board's RAM. Swap
+// in use is memory the build wanted, so it counts towards the peak.
+void finish_memory_monitor(pid_t pid, int fd) {
+    char buffer[64];
+    char msg[192];
+    long used, swap, total;
+    ssize_t bytes;
+    
+    if (pid <= 0) {
+        return;
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    bytes = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (bytes <= 0) {
+        return;
+    }
+    buffer[bytes] = '\0';
+    if (sscanf(buffer, "%ld %ld %ld", &used, &swap, &total) != 3) {
+        return;
+    }
+    
+    snprintf(msg, sizeof(msg), "Peak memory: %ld MB in use + %ld MB swapped of %ld MB RAM", used, swap, total);
+    log_message(used + swap > total ? "WARNING" : "INFO", msg);
+    if (used + swap > total) {
+        log_message("WARNING", "The build exceeded RAM; lower -j or use --debug-info none");
+    }
+}
+
+// Create a zstd-compressed zram swap device of --zram-swap MB ("auto": half
+// the RAM) for this run. Failure only costs the headroom, so it is a warning.
+int setup_zram_swap(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char msg[128];
+    long mb;
+    FILE *fp;
+    
+    if (!config->zram_swap[0]) {
+        return 0;
+    }
+    mb = strcmp(config->zram_swap, "auto") == 0 ? read_meminfo_mb("MemTotal") / 2 : atol(config->zram_swap);
+    if (mb <= 0) {
+        log_message("WARNING", "Cannot size zram swap; continuing without it");
+        return 0;
+    }
+    
+    snprintf(cmd, sizeof(cmd), "modprobe zram 2>/dev/null; zramctl --find --size %ldM --algorithm zstd 2>/dev/null", mb);
+    fp = popen(cmd, "r");
+    if (!fp || !fgets(config->zram_device, sizeof(config->zram_device), fp)) {
+        config->zram_device[0] = '\0';
+    }
+    if (fp) {
+        pclose(fp);
+    }
+    config->zram_device[strcspn(config->zram_device, "\n")] = '\0';
+    if (!config->zram_device[0]) {
+        log_message("WARNING", "Failed to create a zram device; continuing without swap");
+        return 0;
+    }
+    
+    // Above any disk swap, so the eMMC/SD card is only the last resort
+    snprintf(cmd, sizeof(cmd), "mkswap %s > /dev/null && swapon -p 100 %s", config->zram_device, config->zram_device);
+    if (execute_command(cmd, 0) != 0) {
+        log_message("WARNING", "Failed to enable zram swap; continuing without it");
+        remove_zram_swap(config);
+        return 0;
+    }
+    snprintf(msg, sizeof(msg), "zram swap: %s, %ld MB (zstd)", config->zram_device, mb);
+    log_message("INFO", msg);
+    return 0;
+}
+
+// Remove the zram swap device created by setup_zram_swap()
+void remove_zram_swap(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    
+    if (!config->zram_device[0]) {
+        return;
+    }
+    snprintf(cmd, sizeof(cmd), "swapoff %s 2>/dev/null; zramctl --reset %s", config->zram_device, config->zram_device);
+    if (execute_command(cmd, 0) != 0) {
+        log_message("WARNING", "Failed to remove zram swap device");
+    }
+    config->zram_device[0] = '\0';
+}
+
+// Seconds elapsed since a CLOCK_MONOTONIC start point
+double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Seconds between a wall-clock start point and a file's mtime, or -1 when the
+// file is missing or was not rewritten after start
+double seconds_until_mtime(const char *path, const struct timespec *start) {
+    struct stat st;
+    double offset;
+    
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    
+    offset = (st.st_mtim.tv_sec - start->tv_sec) + (st.st_mtim.tv_nsec - start->tv_nsec) / 1e9;
+    return offset >= 0 ? offset : -1;
+}
+
+// Latest completion time of a build target, derived from the mtimes of the
+// artifacts it produces. This gives per-target timing even when all targets
+// share one make invocation.
+double target_completion_time(const char *target, const struct timespec *start) {
+    char line[MAX_PATH_LEN];
+    char path[MAX_PATH_LEN + 8];
+    double latest = -1, offset;
+    size_t len;
+    FILE *fp;
+    
+    if (strcmp(target, "Image") == 0) {
+        return seconds_until_mtime("arch/arm64/boot/Image", start);
+    }
+    
+    if (strcmp(target, "dtbs") == 0) {
+        fp = popen("find arch/arm64/boot/dts -name '*.dtb' 2>/dev/null", "r");
+    } else {
+        // modules.order lists every module object; the linked .ko sits beside it
+        fp = fopen("modules.order", "r");
+    }
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        len = strlen(line);
+        if (strcmp(target, "modules") == 0 && len > 2 && strcmp(line + len - 2, ".o") == 0) {
+            snprintf(path, sizeof(path), "%.*s.ko", (int)(len - 2), line);
+        } else {
+            snprintf(path, sizeof(path), "%s", line);
+        }
+        offset = seconds_until_mtime(path, start);
+        if (offset > latest) {
+            latest = offset;
+        }
+    }
+    
+    if (strcmp(target, "dtbs") == 0) {
+        pclose(fp);
+    } else {
+        fclose(fp);
+    }
+    return latest;
+}
+
+// Log per-target wall-clock timing for a build
+void report_build_timing(build_config_t *config, const struct timespec *wall_start,
+                         const double *make_seconds, double total) {
+    const char *targets[] = { "Image", "dtbs", "modules" };
+    char msg[160];
+    double ready;
+    int i;
+    
+    log_message("INFO", config->single_make ?
+                "Build timing (single make invocation):" :
+                "Build timing (sequential make invocations):");
+    for (i = 0; i < 3; i++) {
+        ready = target_completion_time(targets[i], wall_start);
+        if (config->single_make) {
+            if (ready < 0) {
+                snprintf(msg, sizeof(msg), "  %-8s up to date", targets[i]);
+            } else {
+                snprintf(msg, sizeof(msg), "  %-8s ready at +%.1fs", targets[i], ready);
+            }
+        } else {
+            snprintf(msg, sizeof(msg), "  %-8s %.1fs", targets[i], make_seconds[i]);
+        }
+        log_message("INFO", msg);
+    }
+    snprintf(msg, sizeof(msg), "  %-8s %.1fs with -j%d", "total", total, config->jobs);
+    log_message("INFO", msg);
+}
+
+// Run the kernel make targets. Returns NULL on success, otherwise the error
+// to report.
+static const char *make_kernel_targets(build_config_t *config, double *make_seconds) {
+    const char *targets[] = { "Image", "dtbs", "modules" };
+    const char *errors[] = {
+        "Failed to build kernel image",
+        "Failed to build device tree blobs",
+        "Failed to build kernel modules"  // Includes the Mali GPU driver
+    };
+    char cmd[MAX_CMD_LEN];
+    struct timespec step;
+    int jobs, i;
+    
+    if (config->single_make) {
+        // One invocation lets the jobserver overlap the serial tail of each
+        // target with the others and parses Kbuild only once
+        build_make_command(config, cmd, sizeof(cmd), "Image dtbs modules");
+        if (execute_command(cmd, 1) != 0) {
+            return "Failed to build kernel image, device tree blobs or modules";
+        }
+        return NULL;
+    }
+    
+    for (i = 0; i < 3; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &step);
+        build_make_command(config, cmd, sizeof(cmd), targets[i]);
+        if (config->low_memory && strcmp(targets[i], "modules") == 0) {
+            // Compile at full width, then run the memory-hungry final
+            // module links (modpost, .ko link) with fewer jobs
+            snprintf(cmd + strlen(cmd), sizeof(cmd) - strlen(cmd), " KBUILD_MODPOST_NOFINAL=1");
+            if (execute_command(cmd, 1) != 0) {
+                return errors[i];
+            }
+            jobs = config->jobs;
+            config->jobs = config->link_jobs;
+            build_make_command(config, cmd, sizeof(cmd), targets[i]);
+            config->jobs = jobs;
+        }
+        if (execute_command(cmd, 1) != 0) {
+            return errors[i];
+        }
+        make_seconds[i] = elapsed_seconds(&step);
+    }
+    return NULL;
+}
+
+// Pin everything kbuild would otherwise take from the clock, the user and
+// the host, so identical inputs give identical Image and modules. The
+// timestamp is the source commit's.
+void set_reproducible_env(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char epoch[32] = "";
+    char timestamp[64];
+    time_t when;
+    FILE *fp;
+    
+    snprintf(cmd, sizeof(cmd), "git -C %s/linux log -1 --format=%%ct 2>/dev/null", config->build_dir);
+    fp = popen(cmd, "r");
+    if (fp) {
+        if (!fgets(epoch, sizeof(epoch), fp)) {
+            epoch[0] = '\0';
+        }
+        pclose(fp);
+    }
+    epoch[strcspn(epoch, "\n")] = '\0';
+    if (!epoch[0]) {
+        strcpy(epoch, "0");
+    }
+    when = (time_t)atoll(epoch);
+    strftime(timestamp, sizeof(timestamp), "%a %b %e %H:%M:%S UTC %Y", gmtime(&when));
+    
+    setenv("SOURCE_DATE_EPOCH", epoch, 1);
+    setenv("KBUILD_BUILD_TIMESTAMP", timestamp, 1);
+    setenv("KBUILD_BUILD_USER", BUILD_IDENTITY, 1);
+    setenv("KBUILD_BUILD_HOST", BUILD_IDENTITY, 1);
+    // Otherwise "#N" in uname -v counts the builds of this object directory
+    setenv("KBUILD_BUILD_VERSION", "1", 1);
+}
+
+// First line of a command's output ("" if it printed nothing)
+static void command_first_line(const char *cmd, char *line, size_t size) {
+    FILE *fp = popen(cmd, "r");
+    
+    line[0] = '\0';
+    if (fp) {
+        if (!fgets(line, (int)size, fp)) {
+            line[0] = '\0';
+        }
+        pclose(fp);
+    }
+    line[strcspn(line, "\n")] = '\0';
+}
+
+// SHA-256 over everything that determines the build output: the source
+// commit, the effective .config, the compiler/linker/pahole versions and
+// the make variables we pass. Also written to <objdir>/.artifact-inputs so
+// a miss can be explained by diffing two boards' files. Returns -1 when the
+// tree has uncommitted changes the commit does not describe.
+int artifact_key(build_config_t *config, char *key) {
+    char inputs[4096];
+    char line[256];
+    char cmd[MAX_CMD_LEN];
+    char hex[65];
+    unsigned char digest[32];
+    sha256_ctx_t ctx;
+    int len, i;
+    FILE *fp;
+    
+    snprintf(cmd, sizeof(cmd), "git -C %s/linux status --porcelain --untracked-files=no 2>/dev/null", config->build_dir);
+    command_first_line(cmd, line, sizeof(line));
+    if (line[0] || get_source_commit(config, line, sizeof(line)) != 0) {
+        return -1;
+    }
+    len = snprintf(inputs, sizeof(inputs), "source %s\n", line);
+    
+    if (sha256_file(".config", hex) != 0) {
+        return -1;
+    }
+    len += snprintf(inputs + len, sizeof(inputs) - len, "config %s\n", hex);
+    
+    if (strcmp(config->toolchain, "llvm") == 0) {
+        command_first_line("clang --version 2>/dev/null", line, sizeof(line));
+        len += snprintf(inputs + len, sizeof(inputs) - len, "cc %s\n", line);
+        command_first_line("ld.lld --version 2>/dev/null", line, sizeof(line));
+    } else {
+        snprintf(cmd, sizeof(cmd), "%sgcc --version 2>/dev/null", config->cross_compile);
+        command_first_line(cmd, line, sizeof(line));
+        len += snprintf(inputs + len, sizeof(inputs) - len, "cc %s\n", line);
+        snprintf(cmd, sizeof(cmd), "%sld --version 2>/dev/null", config->cross_compile);
+        command_first_line(cmd, line, sizeof(line));
+    }
+    len += snprintf(inputs + len, sizeof(inputs) - len, "ld %s\n", line);
+    command_first_line("pahole --version 2>/dev/null", line, sizeof(line));
+    len += snprintf(inputs + len, sizeof(inputs) - len, "pahole %s\n", line);
+    
+    len += snprintf(inputs + len, sizeof(inputs) - len, "make ARCH=%s CROSS_COMPILE=%s LOCALVERSION=%s%s%s\n",
+                    config->arch, config->cross_compile, config->profile->localversion,
+                    strcmp(config->toolchain, "llvm") == 0 ? " LLVM=1" : "",
+                    config->tune_cpu ? " KCFLAGS=" TUNE_CPU_FLAGS : "");
+    if (strcmp(config->pgo, "use") == 0) {
+        if (sha256_file(config->pgo_profile, hex) != 0) {
+            return -1;
+        }
+        len += snprintf(inputs + len, sizeof(inputs) - len, "autofdo %s\n", hex);
+    }
+    len += snprintf(inputs + len, sizeof(inputs) - len, "pgo %s\n", config->pgo[0] ? config->pgo : "none");
+    
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const unsigned char *)inputs, strlen(inputs));
+    sha256_final(&ctx, digest);
+    for (i = 0; i < 32; i++) {
+        sprintf(key + i * 2, "%02x", digest[i]);
+    }
+    
+    fp = fopen(".artifact-inputs", "w");
+    if (fp) {
+        fputs(inputs, fp);
+        fclose(fp);
+    }
+    return 0;
+}
+
+// Path of the cache entry for key, creating the cache directory
+static int artifact_path(build_config_t *config, const char *key, char *path, size_t size) {
+    if (create_directory(config->artifact_cache) != 0) {
+        return -1;
+    }
+    return snprintf(path, size, "%s/%s.tar.zst", config->artifact_cache, key) >= (int)size ? -1 : 0;
+}
+
+// Unpack a cached build of key into the object directory. Returns 1 on a
+// hit, 0 on a miss. Run from the object directory.
+int restore_artifacts(build_config_t *config, const char *key) {
+    char path[MAX_PATH_LEN];
+    char cmd[MAX_CMD_LEN];
+    struct timespec start;
+    
+    if (artifact_path(config, key, path, sizeof(path)) != 0 || access(path, R_OK) != 0) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    snprintf(cmd, sizeof(cmd), "zstd -q -d -c %s | tar -xf -", path);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("WARNING", "Cached artifacts are unreadable; building instead");
+        return 0;
+    }
+    // Keep the entry from being pruned as the oldest
+    utimensat(AT_FDCWD, path, NULL, 0);
+    
+    snprintf(cmd, sizeof(cmd), "Artifact cache hit: %.12s restored in %.1fs", key, elapsed_seconds(&start));
+    log_message("SUCCESS", cmd);
+    return 1;
+}
+
+// Store what the install, bundle and debug-info stages read from the
+// object directory under key: Image, dtbs, modules, vmlinux, System.map
+// and the generated include/ and scripts/ that modules_install and
+// dtbs_install need. Concurrent writers from several boards each write
+// their own temporary file, and the rename makes the entry appear whole.
+int store_artifacts(build_config_t *config, const char *key) {
+    char path[MAX_PATH_LEN];
+    char cmd[MAX_CMD_LEN];
+    
+    if (artifact_path(config, key, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd),
+             "{ printf '%%s\\0' .config Makefile vmlinux System.map Module.symvers modules.order modules.builtin "
+             "modules.builtin.modinfo arch/arm64/boot/Image include scripts; "
+             "find arch/arm64/boot/dts \\( -name '*.dtb' -o -name dtbs-list \\) -print0; find . -name '*.ko' -print0; } | "
+             "tar --null --ignore-failed-read -T - -cf - | zstd -q -T%d -f -o %s.%d && mv %s.%d %s",
+             config->jobs, path, (int)getpid(), path, (int)getpid(), path);
+    if (execute_command(cmd, 0) != 0) {
+        snprintf(cmd, sizeof(cmd), "rm -f %s.%d", path, (int)getpid());
+        execute_command(cmd, 0);
+        log_message("WARNING", "Failed to store build artifacts in the cache");
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd), "ls -1t %s/*.tar.zst | tail -n +%d | xargs -r rm -f",
+             config->artifact_cache, ARTIFACT_CACHE_KEEP + 1);
+    execute_command(cmd, 0);
+    
+    snprintf(cmd, sizeof(cmd), "Artifacts cached as %s", path);
+    log_message("INFO", cmd);
+    return 0;
+}
+
+// Build progress. make's compile lines ("  CC      kernel/fork.o", also
+// AS and "CC [M]") are counted as they stream past run_command(), against
+// the object count of the last cold build of this profile. The stage writes
+// its count to <stage>.progress, which run_pipeline() draws as a status line.
+static struct {
+    int active;
+    long objects;
+    long expected;             // 0 while no cold build has been recorded
+    double median_rate;        // Objects/s of this host's recent cold builds
+    struct timespec start;
+    struct timespec updated;
+    int milestone;             // Last 10% step written to the build log
+    char path[MAX_PATH_LEN + 64];
+    char prefix[8];            // Start of the current output line
+    int column;
+} build_progress;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Read the history: the object count of the profile's last cold build and
+// the median throughput of the last PROGRESS_HISTORY_RUNS on this host with
+// the same toolchain and job count
+static void progress_history(build_config_t *config, const char *host) {
+    char path[MAX_PATH_LEN + 32];
+    char line[512];
+    char row_host[128], row_profile[64], row_toolchain[16];
+    double rates[PROGRESS_HISTORY_RUNS];
+    double seconds;
+    long objects;
+    int jobs, count = 0, n = 0;
+    FILE *fp;
+    
+    build_progress.expected = 0;
+    build_progress.median_rate = 0;
+    snprintf(path, sizeof(path), "%s/%s", config->cache_dir, PROGRESS_HISTORY);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%*s %127s %63s %15s %d %ld %lf", row_host, row_profile, row_toolchain,
+                   &jobs, &objects, &seconds) != 6 || strcmp(row_profile, config->profile->name) != 0) {
+            continue;
+        }
+        build_progress.expected = objects;
+        if (strcmp(row_host, host) == 0 && strcmp(row_toolchain, config->toolchain) == 0 &&
+            jobs == config->jobs && seconds > 0) {
+            rates[count++ % PROGRESS_HISTORY_RUNS] = objects / seconds;
+        }
+    }
+    fclose(fp);
+    
+    n = count < PROGRESS_HISTORY_RUNS ? count : PROGRESS_HISTORY_RUNS;
+    if (n > 0) {
+        qsort(rates, n, sizeof(rates[0]), compare_doubles);
+        build_progress.median_rate = rates[n / 2];
+    }
+}
+
+static void progress_start(build_config_t *config, const char *host) {
+    memset(&build_progress, 0, sizeof(build_progress));
+    progress_history(config, host);
+    snprintf(build_progress.path, sizeof(build_progress.path), "%s/%s/build:%s.progress",
+             config->build_dir, STAGE_LOG_DIR, config->profile->name);
+    clock_gettime(CLOCK_MONOTONIC, &build_progress.start);
+    build_progress.updated = build_progress.start;
+    build_progress.active = 1;
+}
+
+// Publish the count for the status line and log every 10%
+static void progress_update(void) {
+    char tmp[MAX_PATH_LEN + 72];
+    char msg[160];
+    double elapsed = elapsed_seconds(&build_progress.start);
+    double rate = elapsed > 0 ? build_progress.objects / elapsed : 0;
+    int step;
+    FILE *fp;
+    
+    snprintf(tmp, sizeof(tmp), "%s.tmp", build_progress.path);
+    fp = fopen(tmp, "w");
+    if (fp) {
+        fprintf(fp, "%ld %ld %.1f\n", build_progress.objects, build_progress.expected, elapsed);
+        fclose(fp);
+        rename(tmp, build_progress.path);
+    }
+    
+    if (build_progress.expected <= 0) {
+        return;
+    }
+    step = (int)(build_progress.objects * 10 / build_progress.expected);
+    if (step > build_progress.milestone && step < 10) {
+        build_progress.milestone = step;
+        snprintf(msg, sizeof(msg), "[+progress] %d%% (%ld/%ld objects, %.1f obj/s, ETA %.0fs)\n", step * 10,
+                 build_progress.objects, build_progress.expected, rate,
+                 rate > 0 ? (build_progress.expected - build_progress.objects) / rate : 0);
+        log_write(msg, strlen(msg));
+    }
+}
+
+// Count compile lines in command output while a build is being tracked
+void progress_feed(const char *data, size_t len) {
+    struct timespec now;
+    size_t i;
+    
+    if (!build_progress.active) {
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            if (build_progress.column >= 5 && (memcmp(build_progress.prefix, "  CC ", 5) == 0 ||
+                                               memcmp(build_progress.prefix, "  AS ", 5) == 0)) {
+                build_progress.objects++;
+            }
+            build_progress.column = 0;
+        } else if (build_progress.column < (int)sizeof(build_progress.prefix)) {
+            build_progress.prefix[build_progress.column++] = data[i];
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - build_progress.updated.tv_sec) * 1000 +
+        (now.tv_nsec - build_progress.updated.tv_nsec) / 1000000 >= PROGRESS_INTERVAL_MS) {
+        build_progress.updated = now;
+        progress_update();
+    }
+}
+
+// Stop counting. A cold build (no objects to start from) is added to the
+// history and its throughput compared with this host's recent median.
+static void progress_finish(build_config_t *config, const char *host, int cold, double seconds) {
+    char path[MAX_PATH_LEN + 32];
+    char msg[256];
+    double rate;
+    FILE *fp;
+    
+    build_progress.active = 0;
+    unlink(build_progress.path);
+    if (!cold || build_progress.objects == 0 || seconds <= 0) {
+        return;
+    }
+    
+    rate = build_progress.objects / seconds;
+    snprintf(msg, sizeof(msg), "Build throughput: %ld objects in %.0fs, %.1f obj/s", build_progress.objects, seconds, rate);
+    log_message("INFO", msg);
+    if (build_progress.median_rate > 0 && rate < build_progress.median_rate * (1.0 - PROGRESS_SLOWDOWN_PCT / 100.0)) {
+        snprintf(msg, sizeof(msg), "Build throughput is %.0f%% below this host's recent median (%.1f obj/s); "
+                 "check for thermal throttling, swapping or a slow disk",
+                 (1.0 - rate / build_progress.median_rate) * 100.0, build_progress.median_rate);
+        log_message("WARNING", msg);
+    }
+    
+    snprintf(path, sizeof(path), "%s/%s", config->cache_dir, PROGRESS_HISTORY);
+    fp = fopen(path, "a");
+    if (fp) {
+        fprintf(fp, "%ld\t%s\t%s\t%s\t%d\t%ld\t%.1f\n", (long)time(NULL), host, config->profile->name,
+                config->toolchain, config->jobs, build_progress.objects, seconds);
+        fclose(fp);
+    }
+}
+
+// Draw the progress of a running build stage as the terminal status line
+static void draw_build_progress(build_config_t *config, pipeline_stage_t *stage) {
+    char path[MAX_PATH_LEN + 64];
+    char bar[PROGRESS_BAR_WIDTH + 1];
+    char line[256];
+    double elapsed, rate, fraction;
+    long objects, expected;
+    int filled, i, len;
+    FILE *fp;
+    
+    snprintf(path, sizeof(path), "%s/%s/%s.progress", config->build_dir, STAGE_LOG_DIR, stage->name);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    i = fscanf(fp, "%ld %ld %lf", &objects, &expected, &elapsed);
+    fclose(fp);
+    if (i != 3) {
+        return;
+    }
+    
+    rate = elapsed > 0 ? objects / elapsed : 0;
+    if (expected <= 0) {
+        snprintf(line, sizeof(line), "%s: %ld objects, %.1f obj/s (no previous build to estimate from)",
+                 stage->name, objects, rate);
+        log_status(line);
+        return;
+    }
+    
+    fraction = objects < expected ? (double)objects / expected : 1.0;
+    filled = (int)(fraction * PROGRESS_BAR_WIDTH);
+    for (i = 0; i < PROGRESS_BAR_WIDTH; i++) {
+        bar[i] = i < filled ? '#' : '-';
+    }
+    bar[PROGRESS_BAR_WIDTH] = '\0';
+    len = snprintf(line, sizeof(line), "%s [%s] %3.0f%% %ld/%ld obj %.1f obj/s", stage->name, bar,
+                   fraction * 100.0, objects, expected, rate);
+    if (rate > 0 && objects < expected) {
+        snprintf(line + len, sizeof(line) - len, " ETA %dm%02ds", (int)((expected - objects) / rate) / 60,
+                 (int)((expected - objects) / rate) % 60);
+    }
+    log_status(line);
+}
+
+// Build kernel
+int build_kernel(build_config_t *config) {
+    const char *error;
+    char cmd[MAX_CMD_LEN];
+    double make_seconds[3] = { 0, 0, 0 };
+    struct timespec start, wall_start;
+    char key[65] = "";
+    char host[128] = "unknown";
+    pid_t monitor = 0;
+    int monitor_fd = -1;
+    int cold;
+    
+    snprintf(cmd, sizeof(cmd), "Building kernel for the %s profile (this may take a while)...",
+             config->profile->name);
+    log_message("INFO", cmd);
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    
+    // AutoFDO needs kernel support (Linux 6.13+ for ARCH_SUPPORTS_AUTOFDO_CLANG)
+    if (config->pgo[0] && kernel_config_enabled(config, "CONFIG_AUTOFDO_CLANG") <= 0) {
+        log_message("ERROR", "This kernel tree does not support Clang AutoFDO (CONFIG_AUTOFDO_CLANG)");
+        return -1;
+    }
+    
+    set_reproducible_env(config);
+    if (kernel_config_enabled(config, "CONFIG_MODULE_SIG_ALL") > 0) {
+        log_message("WARNING", "Modules are signed with a per-build key, so they are not reproducible");
+    }
+    
+    // bindeb-pkg rebuilds from the objects, which the cache does not hold
+    if (strcmp(config->artifact_cache, "none") != 0 && !config->deb) {
+        if (artifact_key(config, key) != 0) {
+            log_message("WARNING", "Kernel tree has local changes; artifact cache bypassed");
+            key[0] = '\0';
+        } else if (restore_artifacts(config, key)) {
+            preserve_artifacts(config);
+            return 0;
+        } else {
+            snprintf(cmd, sizeof(cmd), "Artifact cache miss: %.12s", key);
+            log_message("INFO", cmd);
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_REALTIME, &wall_start);
+    if (config->low_memory) {
+        start_memory_monitor(&monitor, &monitor_fd);
+    }
+    gethostname(host, sizeof(host) - 1);
+    cold = access("vmlinux", F_OK) != 0;
+    progress_start(config, host);
+    
+    // A scratch tmpfs that fills up is moved to disk and the build resumed
+    while ((error = make_kernel_targets(config, make_seconds)) != NULL) {
+        if (spill_scratch(config) != 0) {
+            progress_finish(config, host, 0, 0);
+            finish_memory_monitor(monitor, monitor_fd);
+            log_message("ERROR", error);
+            return -1;
+        }
+    }
+    
+    progress_finish(config, host, cold, elapsed_seconds(&start));
+    finish_memory_monitor(monitor, monitor_fd);
+    report_build_timing(config, &wall_start, make_seconds, elapsed_seconds(&start));
+    preserve_artifacts(config);
+    if (key[0]) {
+        store_artifacts(config, key); // Non-critical
+    }
+    
+    if (strcmp(config->pgo, "instrument") == 0) {
+        log_message("INFO", "AutoFDO phase 1 done. Boot this kernel, run the target workload and collect:");
+        log_message("INFO", "  perf record -e cs_etm/@tmc_etr0/k -a -o perf.data -- sleep 120");
+        snprintf(cmd, sizeof(cmd), "  llvm-profgen --kernel --binary=%s/%s/%s/vmlinux --perfdata=perf.data -o kernel.afdo",
+                 config->build_dir, scratch_active(config) ? ARTIFACT_DIR : OBJ_DIR,
+                 strrchr(config->objdir, '/') + 1);
+        log_message("INFO", cmd);
+        log_message("INFO", "Then rebuild with: --toolchain llvm --pgo use --pgo-profile kernel.afdo");
+    }
+    
+    log_message("SUCCESS", "Kernel built successfully with Mali GPU support");
+    return 0;
+}
+
+// Total size of the uncompressed modules (*.ko) below path
+static long long module_bytes(const char *path) {
+    char entry_path[MAX_PATH_LEN];
+    struct dirent *entry;
+    struct stat st;
+    long long total = 0;
+    size_t len;
+    DIR *dir = opendir(path);
+    
+    if (!dir) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+        if (lstat(entry_path, &st) != 0) {
+            continue;
+        }
+        len = strlen(entry->d_name);
+        if (S_ISDIR(st.st_mode)) {
+            total += module_bytes(entry_path);
+        } else if (S_ISREG(st.st_mode) && len > 3 && strcmp(entry->d_name + len - 3, ".ko") == 0) {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+// Install the modules into <root>/lib/modules/<release>. make strips them
+// (INSTALL_MOD_STRIP) across all jobs, they are compressed in parallel, and
+// a single depmod indexes the result. Run from the kernel tree.
+int stage_modules(build_config_t *config, const char *root, const char *release) {
+    char cmd[MAX_CMD_LEN];
+    char dir[MAX_PATH_LEN];
+    struct timespec start;
+    long long before;
+    long long after;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    before = module_bytes(".");
+    
+    // depmod runs once below, after compression renames the modules
+    build_make_command(config, cmd, sizeof(cmd), "modules_install");
+    snprintf(cmd + strlen(cmd), sizeof(cmd) - strlen(cmd), " INSTALL_MOD_PATH=%s DEPMOD=true%s",
+             root, config->module_strip ? " INSTALL_MOD_STRIP=1" : "");
+    if (execute_command(cmd, 1) != 0) {
+        return -1;
+    }
+    
+    snprintf(dir, sizeof(dir), "%s%s/%s", root, MODULES_DIR, release);
+    if (strcmp(config->module_compress, "zstd") == 0) {
+        snprintf(cmd, sizeof(cmd), "find %s -name '*.ko' -print0 | xargs -0 -r -n 16 -P %d zstd -q -f --rm",
+                 dir, config->jobs);
+    } else if (strcmp(config->module_compress, "xz") == 0) {
+        // The in-kernel decompressor only handles CRC32 and small dictionaries
+        snprintf(cmd, sizeof(cmd),
+                 "find %s -name '*.ko' -print0 | xargs -0 -r -n 16 -P %d xz -q -f --check=crc32 --lzma2=dict=1MiB",
+                 dir, config->jobs);
+    } else {
+        cmd[0] = '\0';
+    }
+    if (cmd[0] && execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "Failed to compress kernel modules");
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd), "depmod -b %s -F System.map %s", root, release);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "depmod failed");
+        return -1;
+    }
+    
+    after = tree_size(dir);
+    snprintf(cmd, sizeof(cmd), "Modules: %lld MB -> %lld MB (strip %s, %s), saved %lld MB in %.1fs",
+             before / (1024 * 1024), after / (1024 * 1024), config->module_strip ? "on" : "off",
+             config->module_compress, (before > after ? before - after : 0) / (1024 * 1024),
+             elapsed_seconds(&start));
+    log_message("INFO", cmd);
+    return 0;
+}
+
+// Atomically replace the live module directory with the staged one. The
+// previous modules end up at the staged path. Filesystems without
+// RENAME_EXCHANGE fall back to two renames.
+int swap_modules(const char *staged, const char *live) {
+    char old[MAX_PATH_LEN];
+    
+    if (access(live, F_OK) != 0) {
+        return rename(staged, live);
+    }
+    if (renameat2(AT_FDCWD, staged, AT_FDCWD, live, RENAME_EXCHANGE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+    snprintf(old, sizeof(old), "%s.old", staged);
+    if (rename(live, old) != 0) {
+        return -1;
+    }
+    if (rename(staged, live) != 0) {
+        rename(old, live);
+        return -1;
+    }
+    return rename(old, staged);
+}
+
+// Install kernel
+int install_kernel(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char path[MAX_PATH_LEN * 2];
+    char staging[MAX_PATH_LEN];
+    char live[MAX_PATH_LEN];
+    char release[128];
+    
+    if (config->deb) {
+        return install_kernel_packages(config);
+    }
+    
+    log_message("INFO", "Installing kernel and Mali GPU modules...");
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    
+    if (kernel_release(config, release, sizeof(release)) != 0) {
+        snprintf(release, sizeof(release), "%s%s", config->kernel_version, config->profile->image_suffix);
+    }
+    
+    // Install modules (including Mali GPU driver) beside the live tree,
+    // then swap them in so a failed install never leaves it half-written
+    snprintf(staging, sizeof(staging), "%s/.staging-%s", MODULES_DIR, release);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", staging);
+    execute_command(cmd, 0);
+    if (stage_modules(config, staging, release) != 0) {
+        log_message("ERROR", "Failed to install kernel modules");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s%s/%s", staging, MODULES_DIR, release);
+    snprintf(live, sizeof(live), "%s/%s", MODULES_DIR, release);
+    if (swap_modules(path, live) != 0) {
+        log_message("ERROR", "Failed to swap in kernel modules");
+        return -1;
+    }
+    // The staging tree now holds the previous modules
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", staging);
+    execute_command(cmd, 0);
+    
+    // Install device tree blobs
+    build_make_command(config, cmd, sizeof(cmd), "dtbs_install");
+    if (execute_command(cmd, 1) != 0) {
+        log_message("WARNING", "Failed to install device tree blobs");
+    }
+    
+    // Copy kernel image
+    snprintf(path, sizeof(path), "/boot/vmlinuz-%s%s", config->kernel_version, config->profile->image_suffix);
+    if (copy_file("arch/arm64/boot/Image", path) != 0) {
+        log_message("ERROR", "Failed to copy kernel image");
+        return -1;
+    }
+    
+    // Copy System.map
+    snprintf(path, sizeof(path), "/boot/System.map-%s%s", config->kernel_version, config->profile->image_suffix);
+    if (copy_file("System.map", path) != 0) {
+        log_message("WARNING", "Failed to copy System.map");
+    }
+    
+    // Copy config
+    snprintf(path, sizeof(path), "/boot/config-%s%s", config->kernel_version, config->profile->image_suffix);
+    if (copy_file(".config", path) != 0) {
+        log_message("WARNING", "Failed to copy kernel config");
+    }
+    
+    // Update initramfs
+    snprintf(path, sizeof(path), "%s%s", config->kernel_version, config->profile->image_suffix);
+    generate_initramfs(config, release, path);
+    
+    // Update bootloader
+    if (execute_command("u-boot-update", 1) != 0) {
+        log_message("WARNING", "Failed to update u-boot configuration");
+    }
+    
+    log_message("SUCCESS", "Kernel installed successfully with Mali GPU support");
+    return 0;
+}
+
+// Archive the debug symbols of the primary profile as
+// <cache-dir>/debug/<release>.tar.zst: vmlinux, System.map, the unstripped
+// modules and, in split mode, the .dwo files. Installed modules are
+// stripped, so this is what crash/gdb need to symbolize a dump later.
+int export_debug_info(build_config_t *config) {
+    char release[128];
+    char dir[MAX_PATH_LEN + 8];
+    char archive[MAX_PATH_LEN + 160];
+    char cmd[MAX_CMD_LEN * 2];
+    struct stat st;
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    if (kernel_config_enabled(config, "CONFIG_DEBUG_INFO") != 1) {
+        log_message("INFO", "Kernel built without debug info; nothing to export");
+        return 0;
+    }
+    if (kernel_release(config, release, sizeof(release)) != 0) {
+        log_message("ERROR", "Kernel release unknown; build the kernel first");
+        return -1;
+    }
+    
+    snprintf(dir, sizeof(dir), "%s/%s", config->cache_dir, DEBUG_DIR);
+    if (create_directory(dir) != 0) {
+        return -1;
+    }
+    snprintf(archive, sizeof(archive), "%s/%s.tar.zst", dir, release);
+    
+    log_message("INFO", "Exporting debug symbols...");
+    snprintf(cmd, sizeof(cmd),
+             "{ printf 'vmlinux\\0System.map\\0'; find . \\( -name '*.ko' -o -name '*.dwo' \\) -print0; }"
+             " | tar --null -T - -cf - | zstd -q -T%d -f -o %s.tmp && mv %s.tmp %s",
+             config->jobs, archive, archive, archive);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "Failed to export debug symbols");
+        return -1;
+    }
+    
+    if (stat(archive, &st) == 0) {
+        snprintf(cmd, sizeof(cmd), "Debug symbols: %s (%lld MB)", archive, (long long)st.st_size / (1024 * 1024));
+        log_message("INFO", cmd);
+    }
+    return 0;
+}
+
+// Shell commands that generate /boot/initrd.img-<image> for the modules in
+// /lib/modules/<release>. Without initramfs options this is plain
+// update-initramfs. Otherwise mkinitramfs runs against a copy of
+// /etc/initramfs-tools with COMPRESS/MODULES overridden. "loaded" keeps only
+// the modules loaded on this board (MODULES=list from /proc/modules). The
+// bundle install script embeds the same commands, so each board prunes for
+// its own hardware.
+void initramfs_script(build_config_t *config, const char *release, const char *image, char *script, size_t size) {
+    int len;
+    
+    if (!config->initramfs_compress[0] && !config->initramfs_modules[0]) {
+        snprintf(script, size, "update-initramfs -c -k %s", image);
+        return;
+    }
+    
+    len = snprintf(script, size, "(conf=$(mktemp -d) && cp -a /etc/initramfs-tools/. \"$conf\"/");
+    if (config->initramfs_compress[0]) {
+        len += snprintf(script + len, size - len, " && echo COMPRESS=%s >> \"$conf/initramfs.conf\"",
+                        config->initramfs_compress);
+    }
+    if (strcmp(config->initramfs_modules, "loaded") == 0) {
+        // Nothing loaded (all built in, or no /proc) falls back to dep
+        len += snprintf(script + len, size - len,
+                        " && if grep -qs . /proc/modules; then echo MODULES=list >> \"$conf/initramfs.conf\""
+                        " && cut -d' ' -f1 /proc/modules >> \"$conf/modules\";"
+                        " else echo MODULES=dep >> \"$conf/initramfs.conf\"; fi");
+    } else if (config->initramfs_modules[0]) {
+        len += snprintf(script + len, size - len, " && echo MODULES=%s >> \"$conf/initramfs.conf\"",
+                        config->initramfs_modules);
+    }
+    snprintf(script + len, size - len,
+             " && mkinitramfs -d \"$conf\" -o /boot/initrd.img-%s %s; status=$?; rm -rf \"$conf\"; exit $status)",
+             image, release);
+}
+
+// Generate the initramfs and report its size and generation time
+int generate_initramfs(build_config_t *config, const char *release, const char *image) {
+    char cmd[MAX_CMD_LEN];
+    char msg[MAX_PATH_LEN + 128];
+    char path[MAX_PATH_LEN];
+    struct timespec start;
+    struct stat st;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    initramfs_script(config, release, image, cmd, sizeof(cmd));
+    if (execute_command(cmd, 1) != 0) {
+        log_message("WARNING", "Failed to update initramfs");
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "/boot/initrd.img-%s", image);
+    if (stat(path, &st) == 0) {
+        snprintf(msg, sizeof(msg), "Initramfs %s: %.1f MB (%s compression, %s modules) in %.1fs", path,
+                 st.st_size / (1024.0 * 1024.0),
+                 config->initramfs_compress[0] ? config->initramfs_compress : "default",
+                 config->initramfs_modules[0] ? config->initramfs_modules : "default",
+                 elapsed_seconds(&start));
+        log_message("INFO", msg);
+    }
+    return 0;
+}
+
+// Build linux-image/linux-headers/linux-libc-dev packages with the kernel's
+// bindeb-pkg and collect them in <build>/debs/<release>. The image package
+// carries the device trees. Each release keeps its own directory, so an
+// older kernel can be reinstalled with dpkg.
+int build_kernel_packages(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char dir[MAX_PATH_LEN + 160];
+    char parent[MAX_PATH_LEN + 64];
+    char src[MAX_PATH_LEN * 2];
+    char release[128];
+    char threads[16];
+    struct dirent *entry;
+    struct stat st;
+    time_t started;
+    DIR *d;
+    const char *ext;
+    int moved = 0;
+    
+    log_message("INFO", "Building kernel packages (bindeb-pkg)...");
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    if (kernel_release(config, release, sizeof(release)) != 0) {
+        log_message("ERROR", "Kernel release unknown; build the kernel first");
+        return -1;
+    }
+    
+    // dpkg-deb compresses with this many zstd/xz threads
+    snprintf(threads, sizeof(threads), "%d", config->jobs);
+    setenv("DPKG_DEB_THREADS_MAX", threads, 1);
+    set_reproducible_env(config);
+    
+    started = time(NULL);
+    build_make_command(config, cmd, sizeof(cmd), "bindeb-pkg");
+    snprintf(cmd + strlen(cmd), sizeof(cmd) - strlen(cmd), " KDEB_COMPRESS=%s%s", config->deb_compress,
+             config->module_strip ? " INSTALL_MOD_STRIP=1" : "");
+    if (execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "Failed to build kernel packages");
+        return -1;
+    }
+    
+    // The packages land next to the object directory
+    snprintf(dir, sizeof(dir), "%s/%s/%s", config->build_dir, DEB_DIR, release);
+    if (create_directory(dir) != 0) {
+        return -1;
+    }
+    snprintf(parent, sizeof(parent), "%s", config->objdir);
+    *strrchr(parent, '/') = '\0';
+    d = opendir(parent);
+    if (!d) {
+        return -1;
+    }
+    while ((entry = readdir(d)) != NULL) {
+        ext = strrchr(entry->d_name, '.');
+        if (!ext || (strcmp(ext, ".deb") != 0 && strcmp(ext, ".buildinfo") != 0 && strcmp(ext, ".changes") != 0)) {
+            continue;
+        }
+        snprintf(src, sizeof(src), "%s/%s", parent, entry->d_name);
+        if (stat(src, &st) != 0 || st.st_mtime < started) {
+            continue;
+        }
+        // Copy rather than rename: the object directory may be on scratch space
+        if (copy_file(src, dir) == 0) {
+            unlink(src);
+            moved++;
+        }
+    }
+    closedir(d);
+    
+    if (moved == 0) {
+        log_message("ERROR", "bindeb-pkg produced no packages");
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd), "Kernel packages (%s): %s", config->deb_compress, dir);
+    log_message("SUCCESS", cmd);
+    return 0;
+}
+
+// Install the image and headers packages of this build through dpkg
+int install_kernel_packages(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    char release[128];
+    
+    log_message("INFO", "Installing kernel packages...");
+    
+    if (kernel_release(config, release, sizeof(release)) != 0) {
+        log_message("ERROR", "Kernel release unknown; build the kernel first");
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd), "dpkg -i %s/%s/%s/linux-image-%s_*.deb %s/%s/%s/linux-headers-%s_*.deb",
+             config->build_dir, DEB_DIR, release, release, config->build_dir, DEB_DIR, release, release);
+    if (execute_command(cmd, 1) != 0) {
+        log_message("ERROR", "Failed to install kernel packages");
+        return -1;
+    }
+    
+    // The image package's hooks build a default initramfs; replace it when
+    // initramfs options were given
+    if (config->initramfs_compress[0] || config->initramfs_modules[0]) {
+        generate_initramfs(config, release, release);
+    }
+    if (execute_command("u-boot-update", 1) != 0) {
+        log_message("WARNING", "Failed to update u-boot configuration");
+    }
+    
+    snprintf(cmd, sizeof(cmd), "Roll back with: dpkg -i %s/%s/<previous release>/linux-image-*.deb",
+             config->build_dir, DEB_DIR);
+    log_message("INFO", cmd);
+    log_message("SUCCESS", "Kernel packages installed successfully");
+    return 0;
+}
+
+// Kernel release string of the current profile's build (KERNELRELEASE)
+int kernel_release(build_config_t *config, char *release, size_t size) {
+    char path[MAX_PATH_LEN + 128];
+    FILE *fp;
+    
+    snprintf(path, sizeof(path), "%s/include/config/kernel.release", config->objdir);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    if (!fgets(release, size, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    release[strcspn(release, "\n")] = '\0';
+    return 0;
+}
+
+// Bundle directory for the current build: <build>/bundles/<release>-<commit>
+int bundle_path(build_config_t *config, char *path, size_t size) {
+    char release[128];
+    char commit[64] = "";
+    
+    if (kernel_release(config, release, sizeof(release)) != 0) {
+        return -1;
+    }
+    get_source_commit(config, commit, sizeof(commit));
+    snprintf(path, size, "%s/%s/%s%s%.12s", config->build_dir, BUNDLE_DIR, release,
+             commit[0] ? "-" : "", commit);
+    return 0;
+}
+
+// Append "<sha256>  <path>" for every regular file below dir to fp, with
+// paths relative to the bundle root
+static int write_bundle_manifest(FILE *fp, const char *root, const char *dir) {
+    char path[MAX_PATH_LEN];
+    char hex[65];
+    struct dirent *entry;
+    struct stat st;
+    DIR *d = opendir(dir);
+    int result = 0;
+    
+    if (!d) {
+        return -1;
+    }
+    while ((entry = readdir(d)) != NULL && result == 0) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (lstat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            result = write_bundle_manifest(fp, root, path);
+        } else if (S_ISREG(st.st_mode)) {
+            if (sha256_file(path, hex) != 0) {
+                result = -1;
+            } else {
+                fprintf(fp, "%s  %s\n", hex, path + strlen(root) + 1);
+            }
+        }
+    }
+    closedir(d);
+    return result;
+}
+
+// Package the primary profile for other boards: modules, device trees, the
+// /boot files, the Mali firmware and an install.sh that performs the same
+// steps as install_kernel() on the target
+int create_bundle(build_config_t *config) {
+    char dir[MAX_PATH_LEN];
+    char tmp[MAX_PATH_LEN + 8];
+    char path[MAX_PATH_LEN * 2];
+    char release[128];
+    char image[160];
+    char cmd[MAX_CMD_LEN];
+    FILE *fp;
+    
+    log_message("INFO", "Creating kernel bundle...");
+    
+    if (enter_kernel_tree(config) != 0) {
+        return -1;
+    }
+    if (kernel_release(config, release, sizeof(release)) != 0 || bundle_path(config, dir, sizeof(dir)) != 0) {
+        log_message("ERROR", "Kernel release unknown; build the kernel first");
+        return -1;
+    }
+    snprintf(image, sizeof(image), "%s%s", config->kernel_version, config->profile->image_suffix);
+    
+    // Assemble next to the final location, then swap it in
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dir);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", tmp);
+    execute_command(cmd, 0);
+    snprintf(path, sizeof(path), "%s/boot", tmp);
+    if (create_directory(path) != 0) {
+        return -1;
+    }
+    
+    if (stage_modules(config, tmp, release) != 0) {
+        log_message("ERROR", "Failed to stage kernel modules");
+        return -1;
+    }
+    // Links back into this build tree are meaningless on the target
+    snprintf(path, sizeof(path), "%s/lib/modules/%s/build", tmp, release);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/lib/modules/%s/source", tmp, release);
+    unlink(path);
+    
+    build_make_command(config, cmd, sizeof(cmd), "dtbs_install");
+    snprintf(cmd + strlen(cmd), sizeof(cmd) - strlen(cmd), " INSTALL_DTBS_PATH=%s/boot/dtbs/%s", tmp, release);
     if (execute_command(cmd, 1) != 0) {
-        log_message("WARNING", "Failed to update initramfs");
+        log_message("WARNING", "Failed to stage device tree blobs");
+    }
+    
+    snprintf(path, sizeof(path), "%s/boot/vmlinuz-%s", tmp, image);
+    if (copy_file("arch/arm64/boot/Image", path) != 0) {
+        log_message("ERROR", "Failed to stage kernel image");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/boot/System.map-%s", tmp, image);
+    copy_file("System.map", path);
+    snprintf(path, sizeof(path), "%s/boot/config-%s", tmp, image);
+    copy_file(".config", path);
+    
+    if (config->profile->gpu && access(MALI_DIR "/mali_csffw.bin", F_OK) == 0) {
+        snprintf(path, sizeof(path), "%s/lib/firmware", tmp);
+        create_directory(path);
+        copy_file(MALI_DIR "/mali_csffw.bin", path);
+    }
+    
+    if (config->runtime_tune[0] && write_tuning_profile(config, tmp) != 0) {
+        log_message("ERROR", "Failed to stage runtime tuning profile");
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "%s/install.sh", tmp);
+    fp = fopen(path, "w");
+    if (!fp) {
+        log_message("ERROR", "Failed to write bundle install script");
+        return -1;
+    }
+    fprintf(fp,
+            "#!/bin/sh\n"
+            "# Kernel bundle %s (builder %s): install on this board\n"
+            "set -e\n"
+            "[ \"$(id -u)\" -eq 0 ] || exec sudo -n sh \"$0\" \"$@\"\n"
+            "cd \"$(dirname \"$0\")\"\n"
+            "sha256sum -c --quiet MANIFEST\n"
+            "rm -rf /lib/modules/.%s.new /lib/modules/.%s.old\n"
+            "cp -a lib/modules/%s /lib/modules/.%s.new\n"
+            "if [ -d /lib/modules/%s ]; then mv /lib/modules/%s /lib/modules/.%s.old; fi\n"
+            "mv /lib/modules/.%s.new /lib/modules/%s && rm -rf /lib/modules/.%s.old\n"
+            "if [ -d boot/dtbs/%s ]; then\n"
+            "    mkdir -p /boot/dtbs && rm -rf /boot/dtbs/%s && cp -a boot/dtbs/%s /boot/dtbs/\n"
+            "fi\n"
+            "if [ -d lib/firmware ]; then cp -a lib/firmware/. /lib/firmware/; fi\n"
+            "cp boot/vmlinuz-%s boot/System.map-%s boot/config-%s /boot/\n",
+            strrchr(dir, '/') + 1, VERSION, release, release, release, release, release, release, release,
+            release, release, release, release, release, release, image, image, image);
+    if (config->runtime_tune[0]) {
+        fprintf(fp,
+                "cp .%s /usr/local/sbin/ && cp .%s /etc/systemd/system/\n"
+                "systemctl daemon-reload && systemctl enable %s || echo \"WARNING: %s not enabled\"\n",
+                TUNE_SCRIPT, TUNE_UNIT, TUNE_SERVICE, TUNE_SERVICE);
+    }
+    initramfs_script(config, release, image, cmd, sizeof(cmd));
+    fprintf(fp,
+            "%s || echo \"WARNING: initramfs generation failed\"\n"
+            "u-boot-update || echo \"WARNING: u-boot-update failed\"\n"
+            "echo \"Installed kernel %s\"\n",
+            cmd, release);
+    fclose(fp);
+    chmod(path, 0755);
+    
+    // Written beside the bundle and moved in, so it never lists itself
+    snprintf(path, sizeof(path), "%s.manifest", tmp);
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    if (write_bundle_manifest(fp, tmp, tmp) != 0) {
+        fclose(fp);
+        log_message("ERROR", "Failed to checksum bundle contents");
+        return -1;
+    }
+    fclose(fp);
+    snprintf(cmd, sizeof(cmd), "%s/MANIFEST", tmp);
+    if (rename(path, cmd) != 0) {
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    execute_command(cmd, 0);
+    if (rename(tmp, dir) != 0) {
+        log_message("ERROR", "Failed to finalize bundle");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s/latest", config->build_dir, BUNDLE_DIR);
+    force_symlink(strrchr(dir, '/') + 1, path);
+    
+    snprintf(cmd, sizeof(cmd), "Kernel bundle: %s (%lld MB)", dir, tree_size(dir) / (1024 * 1024));
+    log_message("SUCCESS", cmd);
+    return 0;
+}
+
+// Push the bundle to one board and install it there. Runs in its own
+// process with output in <build>/deploy/<host>.log. The exit status is the
+// failed step: 1 connect, 2 sync, 3 install.
+static void deploy_to_host(const char *bundle, const char *host, const char *log_path) {
+    const char *name = strrchr(bundle, '/') + 1;
+    char cmd[MAX_CMD_LEN];
+    int fd;
+    
+    fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    
+    snprintf(cmd, sizeof(cmd), DEPLOY_SSH " %s 'mkdir -p " REMOTE_BUNDLE_DIR "'", host);
+    if (execute_command(cmd, 1) != 0) {
+        _exit(1);
+    }
+    // --delete keeps the remote copy identical; unchanged files are not resent
+    snprintf(cmd, sizeof(cmd), "rsync -a --delete -e '" DEPLOY_SSH "' %s/ %s:" REMOTE_BUNDLE_DIR "/%s/",
+             bundle, host, name);
+    if (execute_command(cmd, 1) != 0) {
+        _exit(2);
+    }
+    snprintf(cmd, sizeof(cmd), DEPLOY_SSH " %s 'sh " REMOTE_BUNDLE_DIR "/%s/install.sh'", host, name);
+    if (execute_command(cmd, 1) != 0) {
+        _exit(3);
+    }
+    _exit(0);
+}
+
+// Read the --deploy host list: comma-separated, or one host per line from
+// @file ('#' starts a comment)
+static int read_deploy_hosts(build_config_t *config, char hosts[][128], int max) {
+    char buffer[sizeof(config->deploy_hosts)];
+    char line[256];
+    char *item;
+    int count = 0;
+    FILE *fp;
+    
+    if (config->deploy_hosts[0] == '@') {
+        fp = fopen(config->deploy_hosts + 1, "r");
+        if (!fp) {
+            return -1;
+        }
+        while (fgets(line, sizeof(line), fp) && count < max) {
+            line[strcspn(line, "#\n")] = '\0';
+            if (sscanf(line, "%127s", hosts[count]) == 1) {
+                count++;
+            }
+        }
+        fclose(fp);
+        return count;
+    }
+    
+    snprintf(buffer, sizeof(buffer), "%s", config->deploy_hosts);
+    for (item = strtok(buffer, ", "); item && count < max; item = strtok(NULL, ", ")) {
+        snprintf(hosts[count++], 128, "%s", item);
+    }
+    return count;
+}
+
+// Deploy the bundle to every --deploy host, --deploy-jobs at a time, and
+// print the per-host result
+int deploy_bundle(build_config_t *config) {
+    static const char *const steps[] = { "ok", "connect failed", "sync failed", "install failed" };
+    static char hosts[MAX_DEPLOY_HOSTS][128];
+    pid_t pids[MAX_DEPLOY_HOSTS];
+    int results[MAX_DEPLOY_HOSTS];
+    struct timespec started[MAX_DEPLOY_HOSTS];
+    double seconds[MAX_DEPLOY_HOSTS];
+    char bundle[MAX_PATH_LEN];
+    char log_path[MAX_PATH_LEN + 160];
+    char msg[MAX_PATH_LEN + 64];
+    int count, next = 0, running = 0, done = 0, failed = 0;
+    int status, i;
+    pid_t pid;
+    
+    select_profile(config, 0);
+    if (bundle_path(config, bundle, sizeof(bundle)) != 0 || access(bundle, F_OK) != 0) {
+        log_message("ERROR", "No kernel bundle to deploy");
+        return -1;
+    }
+    count = read_deploy_hosts(config, hosts, MAX_DEPLOY_HOSTS);
+    if (count <= 0) {
+        log_message("ERROR", "No deploy hosts");
+        return -1;
+    }
+    
+    snprintf(log_path, sizeof(log_path), "%s/%s", config->build_dir, DEPLOY_DIR);
+    create_directory(log_path);
+    snprintf(msg, sizeof(msg), "Deploying %s to %d board(s), %d at a time...",
+             strrchr(bundle, '/') + 1, count, config->deploy_jobs);
+    log_message("INFO", msg);
+    
+    while (done < count) {
+        while (next < count && running < config->deploy_jobs) {
+            snprintf(log_path, sizeof(log_path), "%s/%s/%s.log", config->build_dir, DEPLOY_DIR, hosts[next]);
+            fflush(stdout);
+            clock_gettime(CLOCK_MONOTONIC, &started[next]);
+            pids[next] = fork();
+            if (pids[next] == 0) {
+                deploy_to_host(bundle, hosts[next], log_path);
+            }
+            if (pids[next] < 0) {
+                results[next] = 1;
+                seconds[next] = 0;
+                done++;
+            } else {
+                running++;
+            }
+            next++;
+        }
+        
+        pid = wait(&status);
+        if (pid < 0) {
+            break;
+        }
+        for (i = 0; i < next; i++) {
+            if (pids[i] != pid) {
+                continue;
+            }
+            results[i] = WIFEXITED(status) && WEXITSTATUS(status) <= 3 ? WEXITSTATUS(status) : 3;
+            seconds[i] = elapsed_seconds(&started[i]);
+            snprintf(msg, sizeof(msg), "[%d/%d] %s: %s (%.1fs)", done + 1, count, hosts[i],
+                     steps[results[i]], seconds[i]);
+            log_message(results[i] == 0 ? "INFO" : "WARNING", msg);
+            running--;
+            done++;
+        }
+    }
+    
+    printf("\n%s%sDeployment (%s):%s\n", COLOR_BOLD, COLOR_YELLOW, strrchr(bundle, '/') + 1, COLOR_RESET);
+    for (i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            failed++;
+        }
+        printf("  %-32s %s%-16s%s %6.1fs\n", hosts[i], results[i] == 0 ? COLOR_GREEN : COLOR_RED,
+               steps[results[i]], COLOR_RESET, seconds[i]);
+    }
+    if (failed) {
+        printf("  Logs: %s/%s/<host>.log\n", config->build_dir, DEPLOY_DIR);
+        snprintf(msg, sizeof(msg), "Deployment failed on %d of %d board(s)", failed, count);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    log_message("SUCCESS", "Kernel deployed to all boards");
+    return 0;
+}
+
+// Verify GPU installation and functionality
+int verify_gpu_installation(void) {
+    log_message("INFO", "Verifying Mali GPU installation...");
+    
+    // Check if Mali firmware exists
+    if (access("/lib/firmware/mali_csffw.bin", F_OK) != 0) {
+        log_message("ERROR", "Mali firmware not found");
+        return -1;
+    }
+    
+    // Check if Mali driver library exists
+    if (access("/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so", F_OK) != 0) {
+        log_message("ERROR", "Mali driver library not found");
+        return -1;
+    }
+    
+    // Test OpenCL if enabled
+    if (access("/etc/OpenCL/vendors/mali.icd", F_OK) == 0) {
+        log_message("INFO", "Testing OpenCL functionality...");
+        if (execute_command("clinfo 2>/dev/null | grep -i mali", 0) == 0) {
+            log_message("SUCCESS", "OpenCL Mali support detected");
+        } else {
+            log_message("WARNING", "OpenCL Mali support not detected (may need reboot)");
+        }
+    }
+    
+    // Test Vulkan if enabled
+    if (access("/usr/share/vulkan/icd.d/mali.json", F_OK) == 0) {
+        log_message("INFO", "Testing Vulkan functionality...");
+        if (execute_command("vulkaninfo 2>/dev/null | grep -i mali", 0) == 0) {
+            log_message("SUCCESS", "Vulkan Mali support detected");
+        } else {
+            log_message("WARNING", "Vulkan Mali support not detected (may need reboot)");
+        }
+    }
+    
+    log_message("SUCCESS", "GPU installation verification completed");
+    return 0;
+}
+
+// GPU benchmark (--gpu-bench). libOpenCL and libvulkan are loaded with
+// dlopen, so the builder needs neither their headers nor their libraries.
+// Only the handful of entry points and structures used here are declared;
+// their layout is fixed by the respective ABIs.
+typedef int32_t cl_int;
+typedef uint32_t cl_uint;
+typedef uint64_t cl_bitfield;
+
+#define CL_DEVICE_TYPE_GPU (1 << 2)
+#define CL_DEVICE_NAME 0x102B
+#define CL_MEM_READ_WRITE (1 << 0)
+#define CL_MEM_COPY_HOST_PTR (1 << 5)
+#define CL_PROGRAM_BUILD_LOG 0x1183
+
+typedef struct {
+    cl_int (*GetPlatformIDs)(cl_uint, void **, cl_uint *);
+    cl_int (*GetDeviceIDs)(void *, cl_bitfield, cl_uint, void **, cl_uint *);
+    cl_int (*GetDeviceInfo)(void *, cl_uint, size_t, void *, size_t *);
+    void *(*CreateContext)(const intptr_t *, cl_uint, void **, void *, void *, cl_int *);
+    void *(*CreateCommandQueue)(void *, void *, cl_bitfield, cl_int *);
+    void *(*CreateProgramWithSource)(void *, cl_uint, const char **, const size_t *, cl_int *);
+    cl_int (*BuildProgram)(void *, cl_uint, void **, const char *, void *, void *);
+    cl_int (*GetProgramBuildInfo)(void *, void *, cl_uint, size_t, void *, size_t *);
+    void *(*CreateKernel)(void *, const char *, cl_int *);
+    void *(*CreateBuffer)(void *, cl_bitfield, size_t, void *, cl_int *);
+    cl_int (*SetKernelArg)(void *, cl_uint, size_t, const void *);
+    cl_int (*EnqueueNDRangeKernel)(void *, void *, cl_uint, const size_t *, const size_t *, const size_t *,
+                                   cl_uint, void *, void *);
+    cl_int (*EnqueueReadBuffer)(void *, void *, cl_uint, size_t, size_t, void *, cl_uint, void *, void *);
+    cl_int (*Finish)(void *);
+    cl_int (*ReleaseMemObject)(void *);
+    cl_int (*ReleaseKernel)(void *);
+    cl_int (*ReleaseProgram)(void *);
+    cl_int (*ReleaseCommandQueue)(void *);
+    cl_int (*ReleaseContext)(void *);
+} opencl_api_t;
+
+// The Vulkan types and values below mirror vulkan_core.h for Vulkan 1.0
+// (VK_API_VERSION_1_0, the version the instance asks for). Core 1.0
+// definitions are frozen, so later headers agree with them.
+
+// Non-dispatchable Vulkan handles are 64-bit on every ABI
+typedef uint64_t vk_handle_t;
+
+// VkStructureType
+#define VK_STRUCTURE_TYPE_APPLICATION_INFO 0
+#define VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO 1
+#define VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO 2
+#define VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO 3
+#define VK_STRUCTURE_TYPE_SUBMIT_INFO 4
+#define VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO 5
+#define VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO 12
+#define VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO 16
+#define VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO 18
+#define VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO 29
+#define VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO 30
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO 32
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO 33
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO 34
+#define VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET 35
+#define VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO 39
+#define VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO 40
+#define VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO 42
+#define VK_STRUCTURE_TYPE_MEMORY_BARRIER 46
+
+#define VK_PHYSICAL_DEVICE_TYPE_CPU 4
+#define VK_QUEUE_GRAPHICS_COMPUTE_TRANSFER 0x7
+#define VK_MEMORY_PROPERTY_DEVICE_LOCAL 0x1
+#define VK_MEMORY_PROPERTY_HOST_VISIBLE_COHERENT 0x6
+#define VK_BUFFER_USAGE_TRANSFER_SRC_DST 0x3
+#define VK_BUFFER_USAGE_STORAGE_BUFFER 0x20
+#define VK_DESCRIPTOR_TYPE_STORAGE_BUFFER 7
+#define VK_SHADER_STAGE_COMPUTE 0x20
+#define VK_PIPELINE_BIND_POINT_COMPUTE 1
+#define VK_PIPELINE_STAGE_COMPUTE_SHADER 0x800
+#define VK_PIPELINE_STAGE_HOST 0x4000
+#define VK_ACCESS_SHADER_WRITE 0x40
+#define VK_ACCESS_HOST_READ 0x2000
+#define VK_PROPERTIES_TYPE_OFFSET 16   // VkPhysicalDeviceProperties.deviceType
+#define VK_PROPERTIES_NAME_OFFSET 20   // VkPhysicalDeviceProperties.deviceName
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    const char *pApplicationName;
+    uint32_t applicationVersion;
+    const char *pEngineName;
+    uint32_t engineVersion;
+    uint32_t apiVersion;
+} vk_application_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    const vk_application_info_t *pApplicationInfo;
+    uint32_t enabledLayerCount;
+    const char *const *ppEnabledLayerNames;
+    uint32_t enabledExtensionCount;
+    const char *const *ppEnabledExtensionNames;
+} vk_instance_create_info_t;
+
+typedef struct {
+    uint32_t queueFlags;
+    uint32_t queueCount;
+    uint32_t timestampValidBits;
+    uint32_t minImageTransferGranularity[3];
+} vk_queue_family_properties_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t queueFamilyIndex;
+    uint32_t queueCount;
+    const float *pQueuePriorities;
+} vk_device_queue_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t queueCreateInfoCount;
+    const vk_device_queue_create_info_t *pQueueCreateInfos;
+    uint32_t enabledLayerCount;
+    const char *const *ppEnabledLayerNames;
+    uint32_t enabledExtensionCount;
+    const char *const *ppEnabledExtensionNames;
+    const void *pEnabledFeatures;
+} vk_device_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint64_t size;
+    uint32_t usage;
+    uint32_t sharingMode;
+    uint32_t queueFamilyIndexCount;
+    const uint32_t *pQueueFamilyIndices;
+} vk_buffer_create_info_t;
+
+typedef struct {
+    uint64_t size;
+    uint64_t alignment;
+    uint32_t memoryTypeBits;
+} vk_memory_requirements_t;
+
+typedef struct {
+    uint32_t memoryTypeCount;
+    struct { uint32_t propertyFlags; uint32_t heapIndex; } memoryTypes[32];
+    uint32_t memoryHeapCount;
+    struct { uint64_t size; uint32_t flags; } memoryHeaps[16];
+} vk_memory_properties_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint64_t allocationSize;
+    uint32_t memoryTypeIndex;
+} vk_memory_allocate_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t queueFamilyIndex;
+} vk_command_pool_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    vk_handle_t commandPool;
+    uint32_t level;
+    uint32_t commandBufferCount;
+} vk_command_buffer_allocate_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    const void *pInheritanceInfo;
+} vk_command_buffer_begin_info_t;
+
+typedef struct {
+    uint64_t srcOffset;
+    uint64_t dstOffset;
+    uint64_t size;
+} vk_buffer_copy_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    size_t codeSize;
+    const uint32_t *pCode;
+} vk_shader_module_create_info_t;
+
+typedef struct {
+    uint32_t binding;
+    uint32_t descriptorType;
+    uint32_t descriptorCount;
+    uint32_t stageFlags;
+    const void *pImmutableSamplers;
+} vk_descriptor_set_layout_binding_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t bindingCount;
+    const vk_descriptor_set_layout_binding_t *pBindings;
+} vk_descriptor_set_layout_create_info_t;
+
+typedef struct {
+    uint32_t stageFlags;
+    uint32_t offset;
+    uint32_t size;
+} vk_push_constant_range_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t setLayoutCount;
+    const vk_handle_t *pSetLayouts;
+    uint32_t pushConstantRangeCount;
+    const vk_push_constant_range_t *pPushConstantRanges;
+} vk_pipeline_layout_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t stage;
+    vk_handle_t module;
+    const char *pName;
+    const void *pSpecializationInfo;
+} vk_pipeline_shader_stage_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    vk_pipeline_shader_stage_create_info_t stage;
+    vk_handle_t layout;
+    vk_handle_t basePipelineHandle;
+    int32_t basePipelineIndex;
+} vk_compute_pipeline_create_info_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t descriptorCount;
+} vk_descriptor_pool_size_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t flags;
+    uint32_t maxSets;
+    uint32_t poolSizeCount;
+    const vk_descriptor_pool_size_t *pPoolSizes;
+} vk_descriptor_pool_create_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    vk_handle_t descriptorPool;
+    uint32_t descriptorSetCount;
+    const vk_handle_t *pSetLayouts;
+} vk_descriptor_set_allocate_info_t;
+
+typedef struct {
+    vk_handle_t buffer;
+    uint64_t offset;
+    uint64_t range;
+} vk_descriptor_buffer_info_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    vk_handle_t dstSet;
+    uint32_t dstBinding;
+    uint32_t dstArrayElement;
+    uint32_t descriptorCount;
+    uint32_t descriptorType;
+    const void *pImageInfo;
+    const vk_descriptor_buffer_info_t *pBufferInfo;
+    const void *pTexelBufferView;
+} vk_write_descriptor_set_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t srcAccessMask;
+    uint32_t dstAccessMask;
+} vk_memory_barrier_t;
+
+typedef struct {
+    uint32_t sType;
+    const void *pNext;
+    uint32_t waitSemaphoreCount;
+    const vk_handle_t *pWaitSemaphores;
+    const uint32_t *pWaitDstStageMask;
+    uint32_t commandBufferCount;
+    void *const *pCommandBuffers;
+    uint32_t signalSemaphoreCount;
+    const vk_handle_t *pSignalSemaphores;
+} vk_submit_info_t;
+
+typedef struct {
+    int32_t (*CreateInstance)(const vk_instance_create_info_t *, const void *, void **);
+    int32_t (*EnumeratePhysicalDevices)(void *, uint32_t *, void **);
+    void (*GetPhysicalDeviceProperties)(void *, void *);
+    void (*GetPhysicalDeviceQueueFamilyProperties)(void *, uint32_t *, vk_queue_family_properties_t *);
+    void (*GetPhysicalDeviceMemoryProperties)(void *, vk_memory_properties_t *);
+    int32_t (*CreateDevice)(void *, const vk_device_create_info_t *, const void *, void **);
+    void (*GetDeviceQueue)(void *, uint32_t, uint32_t, void **);
+    int32_t (*CreateBuffer)(void *, const vk_buffer_create_info_t *, const void *, vk_handle_t *);
+    void (*GetBufferMemoryRequirements)(void *, vk_handle_t, vk_memory_requirements_t *);
+    int32_t (*AllocateMemory)(void *, const vk_memory_allocate_info_t *, const void *, vk_handle_t *);
+    int32_t (*BindBufferMemory)(void *, vk_handle_t, vk_handle_t, uint64_t);
+    int32_t (*CreateCommandPool)(void *, const vk_command_pool_create_info_t *, const void *, vk_handle_t *);
+    int32_t (*AllocateCommandBuffers)(void *, const vk_command_buffer_allocate_info_t *, void **);
+    int32_t (*BeginCommandBuffer)(void *, const vk_command_buffer_begin_info_t *);
+    void (*CmdCopyBuffer)(void *, vk_handle_t, vk_handle_t, uint32_t, const vk_buffer_copy_t *);
+    int32_t (*EndCommandBuffer)(void *);
+    int32_t (*QueueSubmit)(void *, uint32_t, const vk_submit_info_t *, vk_handle_t);
+    int32_t (*QueueWaitIdle)(void *);
+    void (*DestroyCommandPool)(void *, vk_handle_t, const void *);
+    void (*DestroyBuffer)(void *, vk_handle_t, const void *);
+    void (*FreeMemory)(void *, vk_handle_t, const void *);
+    void (*DestroyDevice)(void *, const void *);
+    void (*DestroyInstance)(void *, const void *);
+    int32_t (*MapMemory)(void *, vk_handle_t, uint64_t, uint64_t, uint32_t, void **);
+    void (*UnmapMemory)(void *, vk_handle_t);
+    int32_t (*CreateShaderModule)(void *, const vk_shader_module_create_info_t *, const void *, vk_handle_t *);
+    void (*DestroyShaderModule)(void *, vk_handle_t, const void *);
+    int32_t (*CreateDescriptorSetLayout)(void *, const vk_descriptor_set_layout_create_info_t *, const void *,
+                                         vk_handle_t *);
+    void (*DestroyDescriptorSetLayout)(void *, vk_handle_t, const void *);
+    int32_t (*CreatePipelineLayout)(void *, const vk_pipeline_layout_create_info_t *, const void *, vk_handle_t *);
+    void (*DestroyPipelineLayout)(void *, vk_handle_t, const void *);
+    int32_t (*CreateComputePipelines)(void *, vk_handle_t, uint32_t, const vk_compute_pipeline_create_info_t *,
+                                      const void *, vk_handle_t *);
+    void (*DestroyPipeline)(void *, vk_handle_t, const void *);
+    int32_t (*CreateDescriptorPool)(void *, const vk_descriptor_pool_create_info_t *, const void *, vk_handle_t *);
+    void (*DestroyDescriptorPool)(void *, vk_handle_t, const void *);
+    int32_t (*AllocateDescriptorSets)(void *, const vk_descriptor_set_allocate_info_t *, vk_handle_t *);
+    void (*UpdateDescriptorSets)(void *, uint32_t, const vk_write_descriptor_set_t *, uint32_t, const void *);
+    void (*CmdBindPipeline)(void *, uint32_t, vk_handle_t);
+    void (*CmdBindDescriptorSets)(void *, uint32_t, vk_handle_t, uint32_t, uint32_t, const vk_handle_t *,
+                                  uint32_t, const uint32_t *);
+    void (*CmdPushConstants)(void *, vk_handle_t, uint32_t, uint32_t, uint32_t, const void *);
+    void (*CmdDispatch)(void *, uint32_t, uint32_t, uint32_t);
+    void (*CmdPipelineBarrier)(void *, uint32_t, uint32_t, uint32_t, uint32_t, const vk_memory_barrier_t *,
+                               uint32_t, const void *, uint32_t, const void *);
+} vulkan_api_t;
+
+// OpenCL C for the SGEMM (16x16 tiles in local memory) and copy kernels
+static const char *gpu_bench_kernels =
+    "#define TS 16\n"
+    "__kernel void sgemm(const int n, __global const float *a, __global const float *b, __global float *c) {\n"
+    "    __local float ta[TS][TS];\n"
+    "    __local float tb[TS][TS];\n"
+    "    int lr = get_local_id(1), lc = get_local_id(0);\n"
+    "    int row = get_global_id(1), col = get_global_id(0);\n"
+    "    float acc = 0.0f;\n"
+    "    for (int t = 0; t < n; t += TS) {\n"
+    "        ta[lr][lc] = a[row * n + t + lc];\n"
+    "        tb[lr][lc] = b[(t + lr) * n + col];\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "        for (int k = 0; k < TS; k++) acc += ta[lr][k] * tb[k][lc];\n"
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    }\n"
+    "    c[row * n + col] = acc;\n"
+    "}\n"
+    "__kernel void copy(__global const float4 *src, __global float4 *dst) {\n"
+    "    size_t i = get_global_id(0);\n"
+    "    dst[i] = src[i];\n"
+    "}\n";
+
+// SPIR-V 1.0 compute shader for the Vulkan test, hand-assembled from:
+//   layout(local_size_x = 64) in;
+//   layout(std430, binding = 0) buffer Data { vec4 v[]; };
+//   layout(push_constant) uniform P { float m; float c; uint n; };
+//   void main() {
+//       uint i = gl_GlobalInvocationID.x;
+//       vec4 x = vec4(float(i & 1023u));
+//       for (uint k = 0u; k < n; k++) x = x * m + c;
+//       v[i] = x;
+//   }
+// m, c and n are push constants so the compiler cannot fold the loop.
+static const uint32_t gpu_bench_spirv[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x00000036, 0x00000000, 0x00020011,
+    0x00000001, 0x0003000e, 0x00000000, 0x00000001, 0x0006000f, 0x00000005,
+    0x00000001, 0x6e69616d, 0x00000000, 0x00000007, 0x00060010, 0x00000001,
+    0x00000011, 0x00000040, 0x00000001, 0x00000001, 0x00040047, 0x00000007,
+    0x0000000b, 0x0000001c, 0x00040047, 0x0000000a, 0x00000006, 0x00000010,
+    0x00050048, 0x0000000b, 0x00000000, 0x00000023, 0x00000000, 0x00030047,
+    0x0000000b, 0x00000003, 0x00040047, 0x0000000d, 0x00000022, 0x00000000,
+    0x00040047, 0x0000000d, 0x00000021, 0x00000000, 0x00050048, 0x0000000e,
+    0x00000000, 0x00000023, 0x00000000, 0x00050048, 0x0000000e, 0x00000001,
+    0x00000023, 0x00000004, 0x00050048, 0x0000000e, 0x00000002, 0x00000023,
+    0x00000008, 0x00030047, 0x0000000e, 0x00000002, 0x00020013, 0x00000002,
+    0x00030021, 0x00000003, 0x00000002, 0x00040015, 0x00000004, 0x00000020,
+    0x00000000, 0x00040015, 0x00000011, 0x00000020, 0x00000001, 0x00030016,
+    0x00000008, 0x00000020, 0x00020014, 0x0000001c, 0x00040017, 0x00000005,
+    0x00000004, 0x00000003, 0x00040017, 0x00000009, 0x00000008, 0x00000004,
+    0x0003001d, 0x0000000a, 0x00000009, 0x0003001e, 0x0000000b, 0x0000000a,
+    0x0005001e, 0x0000000e, 0x00000008, 0x00000008, 0x00000004, 0x00040020,
+    0x00000006, 0x00000001, 0x00000005, 0x00040020, 0x0000000c, 0x00000002,
+    0x0000000b, 0x00040020, 0x0000000f, 0x00000009, 0x0000000e, 0x00040020,
+    0x00000015, 0x00000009, 0x00000008, 0x00040020, 0x00000016, 0x00000009,
+    0x00000004, 0x00040020, 0x00000017, 0x00000002, 0x00000009, 0x00040020,
+    0x00000018, 0x00000001, 0x00000004, 0x0004002b, 0x00000011, 0x00000012,
+    0x00000000, 0x0004002b, 0x00000011, 0x00000013, 0x00000001, 0x0004002b,
+    0x00000011, 0x00000014, 0x00000002, 0x0004002b, 0x00000004, 0x00000019,
+    0x00000000, 0x0004002b, 0x00000004, 0x0000001a, 0x00000001, 0x0004002b,
+    0x00000004, 0x0000001b, 0x000003ff, 0x0004003b, 0x00000006, 0x00000007,
+    0x00000001, 0x0004003b, 0x0000000c, 0x0000000d, 0x00000002, 0x0004003b,
+    0x0000000f, 0x00000010, 0x00000009, 0x00050036, 0x00000002, 0x00000001,
+    0x00000000, 0x00000003, 0x000200f8, 0x0000001e, 0x00050041, 0x00000018,
+    0x0000001f, 0x00000007, 0x00000019, 0x0004003d, 0x00000004, 0x00000020,
+    0x0000001f, 0x00050041, 0x00000015, 0x00000021, 0x00000010, 0x00000012,
+    0x0004003d, 0x00000008, 0x00000022, 0x00000021, 0x00050041, 0x00000015,
+    0x00000023, 0x00000010, 0x00000013, 0x0004003d, 0x00000008, 0x00000024,
+    0x00000023, 0x00050041, 0x00000016, 0x00000025, 0x00000010, 0x00000014,
+    0x0004003d, 0x00000004, 0x00000026, 0x00000025, 0x000500c7, 0x00000004,
+    0x00000027, 0x00000020, 0x0000001b, 0x00040070, 0x00000008, 0x00000028,
+    0x00000027, 0x00070050, 0x00000009, 0x00000029, 0x00000028, 0x00000028,
+    0x00000028, 0x00000028, 0x00070050, 0x00000009, 0x0000002a, 0x00000024,
+    0x00000024, 0x00000024, 0x00000024, 0x000200f9, 0x0000002b, 0x000200f8,
+    0x0000002b, 0x000700f5, 0x00000009, 0x0000002c, 0x00000029, 0x0000001e,
+    0x00000032, 0x0000002f, 0x000700f5, 0x00000004, 0x0000002d, 0x00000019,
+    0x0000001e, 0x00000033, 0x0000002f, 0x000500b0, 0x0000001c, 0x00000034,
+    0x0000002d, 0x00000026, 0x000400f6, 0x00000030, 0x0000002f, 0x00000000,
+    0x000400fa, 0x00000034, 0x0000002e, 0x00000030, 0x000200f8, 0x0000002e,
+    0x0005008e, 0x00000009, 0x00000031, 0x0000002c, 0x00000022, 0x00050081,
+    0x00000009, 0x00000032, 0x00000031, 0x0000002a, 0x000200f9, 0x0000002f,
+    0x000200f8, 0x0000002f, 0x00050080, 0x00000004, 0x00000033, 0x0000002d,
+    0x0000001a, 0x000200f9, 0x0000002b, 0x000200f8, 0x00000030, 0x00060041,
+    0x00000017, 0x00000035, 0x0000000d, 0x00000012, 0x00000020, 0x0003003e,
+    0x00000035, 0x0000002c, 0x000100fd, 0x00010038,
+};
+
+// Resolve every symbol in names into the function table fns. Returns the
+// library handle, or NULL (logging why) when the API is not available.
+static void *gpu_load_api(const char *library, const char *const *names, void **fns, const char *prefix) {
+    char symbol[64];
+    char msg[160];
+    void *lib = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    int i;
+    
+    if (!lib) {
+        snprintf(msg, sizeof(msg), "%s not available: %s", library, dlerror());
+        log_message("WARNING", msg);
+        return NULL;
+    }
+    for (i = 0; names[i]; i++) {
+        snprintf(symbol, sizeof(symbol), "%s%s", prefix, names[i]);
+        fns[i] = dlsym(lib, symbol);
+        if (!fns[i]) {
+            snprintf(msg, sizeof(msg), "%s lacks %s", library, symbol);
+            log_message("WARNING", msg);
+            dlclose(lib);
+            return NULL;
+        }
+    }
+    return lib;
+}
+
+// Fold the current GPU clock into the highest one seen so far
+static void gpu_sample_frequency(gpu_bench_t *result) {
+    char path[MAX_PATH_LEN];
+    long hz = 0;
+    FILE *fp;
+    
+    snprintf(path, sizeof(path), "%s/cur_freq", GPU_DEVFREQ);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    if (fscanf(fp, "%ld", &hz) == 1 && hz / 1000000 > result->freq_seen_mhz) {
+        result->freq_seen_mhz = hz / 1000000;
+    }
+    fclose(fp);
+}
+
+// Run launch() until GPU_BENCH_SECONDS have passed (at least three times),
+// sampling the clock after each run. Returns the fastest run in seconds.
+static double gpu_time_runs(int (*launch)(void *), void *arg, gpu_bench_t *result) {
+    struct timespec total, start;
+    double best = -1, seconds;
+    int runs = 0;
+    
+    if (launch(arg) != 0) { // Warm up: compile, allocate, raise the clock
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &total);
+    while (runs < 3 || elapsed_seconds(&total) < GPU_BENCH_SECONDS) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (launch(arg) != 0) {
+            return -1;
+        }
+        seconds = elapsed_seconds(&start);
+        if (best < 0 || seconds < best) {
+            best = seconds;
+        }
+        gpu_sample_frequency(result);
+        runs++;
+    }
+    return best;
+}
+
+typedef struct {
+    opencl_api_t *cl;
+    void *queue;
+    void *kernel;
+    size_t global[2];
+    size_t local[2];
+    cl_uint dims;
+} opencl_launch_t;
+
+static int opencl_launch(void *arg) {
+    opencl_launch_t *l = arg;
+    
+    if (l->cl->EnqueueNDRangeKernel(l->queue, l->kernel, l->dims, NULL, l->global,
+                                    l->local[0] ? l->local : NULL, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+    return l->cl->Finish(l->queue) == 0 ? 0 : -1;
+}
+
+// SGEMM and copy bandwidth on the first OpenCL GPU. The SGEMM result is
+// checked, so a driver that computes garbage fails rather than scoring.
+// Returns 1 when OpenCL is not installed.
+static int gpu_bench_opencl(gpu_bench_t *result) {
+    static const char *const names[] = {
+        "GetPlatformIDs", "GetDeviceIDs", "GetDeviceInfo", "CreateContext", "CreateCommandQueue",
+        "CreateProgramWithSource", "BuildProgram", "GetProgramBuildInfo", "CreateKernel", "CreateBuffer",
+        "SetKernelArg", "EnqueueNDRangeKernel", "EnqueueReadBuffer", "Finish", "ReleaseMemObject",
+        "ReleaseKernel", "ReleaseProgram", "ReleaseCommandQueue", "ReleaseContext", NULL
+    };
+    opencl_api_t cl;
+    opencl_launch_t launch = { .cl = &cl };
+    const int n = GPU_SGEMM_N;
+    const size_t copy_bytes = (size_t)GPU_COPY_MB * 1024 * 1024;
+    void *platforms[8], *device = NULL, *context = NULL, *program = NULL;
+    void *sgemm = NULL, *copy = NULL, *buffers[5] = { NULL };
+    float *a = NULL, *b = NULL;
+    char build_log[2048];
+    cl_uint platform_count = 0, device_count = 0, i;
+    cl_int err = 0;
+    double seconds;
+    int status = -1;
+    void *lib = gpu_load_api("libOpenCL.so.1", names, (void **)&cl, "cl");
+    
+    if (!lib) {
+        return 1;
+    }
+    if (cl.GetPlatformIDs(8, platforms, &platform_count) != 0) {
+        platform_count = 0;
+    }
+    for (i = 0; i < platform_count && !device; i++) {
+        if (cl.GetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &device, &device_count) != 0) {
+            device = NULL;
+        }
+    }
+    if (!device) {
+        log_message("ERROR", "OpenCL: no GPU device (CPU-only or missing ICD)");
+        goto out;
+    }
+    cl.GetDeviceInfo(device, CL_DEVICE_NAME, sizeof(result->opencl_device), result->opencl_device, NULL);
+    
+    context = cl.CreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (context) {
+        launch.queue = cl.CreateCommandQueue(context, device, 0, &err);
+    }
+    if (!launch.queue) {
+        log_message("ERROR", "OpenCL: failed to create a command queue");
+        goto out;
+    }
+    program = cl.CreateProgramWithSource(context, 1, &gpu_bench_kernels, NULL, &err);
+    if (!program || cl.BuildProgram(program, 1, &device, "-cl-fast-relaxed-math", NULL, NULL) != 0) {
+        build_log[0] = '\0';
+        if (program) {
+            cl.GetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(build_log), build_log, NULL);
+        }
+        log_message("ERROR", "OpenCL: benchmark kernels failed to build");
+        fprintf(stderr, "%s\n", build_log);
+        goto out;
+    }
+    sgemm = cl.CreateKernel(program, "sgemm", &err);
+    copy = cl.CreateKernel(program, "copy", &err);
+    
+    a = malloc(sizeof(float) * n * n);
+    b = malloc(sizeof(float) * n * n);
+    if (!sgemm || !copy || !a || !b) {
+        goto out;
+    }
+    for (i = 0; i < (cl_uint)(n * n); i++) {
+        a[i] = 1.0f;
+        b[i] = 2.0f;
+    }
+    buffers[0] = cl.CreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * n * n, a, &err);
+    buffers[1] = cl.CreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * n * n, b, &err);
+    buffers[2] = cl.CreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * n * n, NULL, &err);
+    buffers[3] = cl.CreateBuffer(context, CL_MEM_READ_WRITE, copy_bytes, NULL, &err);
+    buffers[4] = cl.CreateBuffer(context, CL_MEM_READ_WRITE, copy_bytes, NULL, &err);
+    for (i = 0; i < 5; i++) {
+        if (!buffers[i]) {
+            log_message("ERROR", "OpenCL: failed to allocate benchmark buffers");
+            goto out;
+        }
+    }
+    
+    cl.SetKernelArg(sgemm, 0, sizeof(int), &n);
+    cl.SetKernelArg(sgemm, 1, sizeof(void *), &buffers[0]);
+    cl.SetKernelArg(sgemm, 2, sizeof(void *), &buffers[1]);
+    cl.SetKernelArg(sgemm, 3, sizeof(void *), &buffers[2]);
+    launch.kernel = sgemm;
+    launch.dims = 2;
+    launch.global[0] = launch.global[1] = n;
+    launch.local[0] = launch.local[1] = 16;
+    seconds = gpu_time_runs(opencl_launch, &launch, result);
+    if (seconds <= 0) {
+        log_message("ERROR", "OpenCL: SGEMM failed to run");
+        goto out;
+    }
+    result->sgemm_gflops = 2.0 * n * n * n / seconds / 1e9;
+    
+    // Every element of ones(n) x twos(n) is 2n
+    if (cl.EnqueueReadBuffer(launch.queue, buffers[2], 1, 0, sizeof(float) * n * n, a, 0, NULL, NULL) != 0) {
+        goto out;
+    }
+    for (i = 0; i < (cl_uint)(n * n); i += n + 1) {
+        if (a[i] != 2.0f * n) {
+            log_message("ERROR", "OpenCL: SGEMM returned wrong results");
+            result->sgemm_gflops = 0;
+            goto out;
+        }
+    }
+    
+    cl.SetKernelArg(copy, 0, sizeof(void *), &buffers[3]);
+    cl.SetKernelArg(copy, 1, sizeof(void *), &buffers[4]);
+    launch.kernel = copy;
+    launch.dims = 1;
+    launch.global[0] = copy_bytes / (4 * sizeof(float));
+    launch.local[0] = 0;
+    seconds = gpu_time_runs(opencl_launch, &launch, result);
+    if (seconds <= 0) {
+        log_message("ERROR", "OpenCL: copy kernel failed to run");
+        goto out;
+    }
+    result->opencl_gbs = 2.0 * copy_bytes / seconds / 1e9; // Read plus write
+    status = 0;
+    
+out:
+    for (i = 0; i < 5; i++) {
+        if (buffers[i]) {
+            cl.ReleaseMemObject(buffers[i]);
+        }
+    }
+    if (sgemm) {
+        cl.ReleaseKernel(sgemm);
+    }
+    if (copy) {
+        cl.ReleaseKernel(copy);
+    }
+    if (program) {
+        cl.ReleaseProgram(program);
+    }
+    if (launch.queue) {
+        cl.ReleaseCommandQueue(launch.queue);
+    }
+    if (context) {
+        cl.ReleaseContext(context);
+    }
+    free(a);
+    free(b);
+    dlclose(lib);
+    return status;
+}
+
+typedef struct {
+    vulkan_api_t *vk;
+    void *queue;
+    void *command_buffer;
+} vulkan_launch_t;
+
+static int vulkan_launch(void *arg) {
+    vulkan_launch_t *l = arg;
+    vk_submit_info_t submit = { .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO, .commandBufferCount = 1,
+                                .pCommandBuffers = &l->command_buffer };
+    
+    if (l->vk->QueueSubmit(l->queue, 1, &submit, 0) != 0) {
+        return -1;
+    }
+    return l->vk->QueueWaitIdle(l->queue) == 0 ? 0 : -1;
+}
+
+// Dispatch gpu_bench_spirv over GPU_COMPUTE_INVOCATIONS and check every
+// result, so a driver that cannot run compute shaders fails rather than
+// scoring. Commands are recorded into a new buffer from pool.
+static int gpu_bench_vulkan_compute(vulkan_api_t *vk, void *device, void *queue, vk_handle_t pool,
+                                    const vk_memory_properties_t *memory, gpu_bench_t *result) {
+    const uint64_t bytes = (uint64_t)GPU_COMPUTE_INVOCATIONS * 4 * sizeof(float);
+    struct { float m; float c; uint32_t n; } push = { 1.0f, 1.0f, GPU_COMPUTE_ITERATIONS };
+    vulkan_launch_t launch = { .vk = vk, .queue = queue };
+    vk_buffer_create_info_t buffer_info = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = bytes,
+                                            .usage = VK_BUFFER_USAGE_STORAGE_BUFFER };
+    vk_memory_allocate_info_t allocate = { .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    vk_memory_requirements_t requirements;
+    vk_shader_module_create_info_t module_info = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+                                                   .codeSize = sizeof(gpu_bench_spirv), .pCode = gpu_bench_spirv };
+    vk_descriptor_set_layout_binding_t binding = { .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                   .descriptorCount = 1, .stageFlags = VK_SHADER_STAGE_COMPUTE };
+    vk_descriptor_set_layout_create_info_t set_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, .bindingCount = 1, .pBindings = &binding };
+    vk_push_constant_range_t range = { .stageFlags = VK_SHADER_STAGE_COMPUTE, .size = sizeof(push) };
+    vk_pipeline_layout_create_info_t layout_info = { .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                                                     .setLayoutCount = 1, .pushConstantRangeCount = 1,
+                                                     .pPushConstantRanges = &range };
+    vk_compute_pipeline_create_info_t pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = { .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, .stage = VK_SHADER_STAGE_COMPUTE,
+                   .pName = "main" },
+        .basePipelineIndex = -1 };
+    vk_descriptor_pool_size_t pool_size = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 };
+    vk_descriptor_pool_create_info_t descriptor_pool_info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                                                              .maxSets = 1, .poolSizeCount = 1, .pPoolSizes = &pool_size };
+    vk_descriptor_set_allocate_info_t set_info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                                                   .descriptorSetCount = 1 };
+    vk_descriptor_buffer_info_t buffer_range = { .range = bytes };
+    vk_write_descriptor_set_t write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, .descriptorCount = 1,
+                                        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .pBufferInfo = &buffer_range };
+    vk_memory_barrier_t barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER, .srcAccessMask = VK_ACCESS_SHADER_WRITE,
+                                    .dstAccessMask = VK_ACCESS_HOST_READ };
+    vk_command_buffer_allocate_info_t command_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                       .commandPool = pool, .commandBufferCount = 1 };
+    vk_command_buffer_begin_info_t begin = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    vk_handle_t buffer = 0, buffer_memory = 0, module = 0, set_layout = 0, layout = 0, pipeline = 0;
+    vk_handle_t descriptor_pool = 0, set = 0;
+    float *data = NULL;
+    double seconds;
+    uint32_t type, i;
+    int status = -1;
+    
+    // Host-visible, so the results can be read back and checked
+    if (vk->CreateBuffer(device, &buffer_info, NULL, &buffer) != 0) {
+        buffer = 0;
+        goto out;
+    }
+    vk->GetBufferMemoryRequirements(device, buffer, &requirements);
+    for (type = 0; type < memory->memoryTypeCount; type++) {
+        if ((requirements.memoryTypeBits & (1u << type)) &&
+            (memory->memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_COHERENT) ==
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_COHERENT) {
+            break;
+        }
+    }
+    allocate.allocationSize = requirements.size;
+    allocate.memoryTypeIndex = type;
+    if (type == memory->memoryTypeCount || vk->AllocateMemory(device, &allocate, NULL, &buffer_memory) != 0 ||
+        vk->BindBufferMemory(device, buffer, buffer_memory, 0) != 0) {
+        log_message("ERROR", "Vulkan: failed to allocate the compute buffer");
+        goto out;
+    }
+    
+    if (vk->CreateShaderModule(device, &module_info, NULL, &module) != 0 ||
+        vk->CreateDescriptorSetLayout(device, &set_layout_info, NULL, &set_layout) != 0) {
+        log_message("ERROR", "Vulkan: failed to load the compute shader");
+        goto out;
+    }
+    layout_info.pSetLayouts = &set_layout;
+    if (vk->CreatePipelineLayout(device, &layout_info, NULL, &layout) != 0) {
+        goto out;
+    }
+    pipeline_info.stage.module = module;
+    pipeline_info.layout = layout;
+    if (vk->CreateComputePipelines(device, 0, 1, &pipeline_info, NULL, &pipeline) != 0) {
+        log_message("ERROR", "Vulkan: failed to create the compute pipeline");
+        pipeline = 0;
+        goto out;
+    }
+    if (vk->CreateDescriptorPool(device, &descriptor_pool_info, NULL, &descriptor_pool) != 0) {
+        goto out;
+    }
+    set_info.descriptorPool = descriptor_pool;
+    set_info.pSetLayouts = &set_layout;
+    if (vk->AllocateDescriptorSets(device, &set_info, &set) != 0) {
+        goto out;
+    }
+    buffer_range.buffer = buffer;
+    write.dstSet = set;
+    vk->UpdateDescriptorSets(device, 1, &write, 0, NULL);
+    
+    if (vk->AllocateCommandBuffers(device, &command_info, &launch.command_buffer) != 0 ||
+        vk->BeginCommandBuffer(launch.command_buffer, &begin) != 0) {
+        goto out;
+    }
+    vk->CmdBindPipeline(launch.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vk->CmdBindDescriptorSets(launch.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0, NULL);
+    vk->CmdPushConstants(launch.command_buffer, layout, VK_SHADER_STAGE_COMPUTE, 0, sizeof(push), &push);
+    vk->CmdDispatch(launch.command_buffer, GPU_COMPUTE_INVOCATIONS / 64, 1, 1);
+    vk->CmdPipelineBarrier(launch.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER, VK_PIPELINE_STAGE_HOST, 0,
+                           1, &barrier, 0, NULL, 0, NULL);
+    if (vk->EndCommandBuffer(launch.command_buffer) != 0) {
+        goto out;
+    }
+    
+    seconds = gpu_time_runs(vulkan_launch, &launch, result);
+    if (seconds <= 0) {
+        log_message("ERROR", "Vulkan: compute dispatch failed to run");
+        goto out;
+    }
+    // Four lanes, a multiply and an add each, per iteration
+    result->vulkan_gflops = 8.0 * GPU_COMPUTE_INVOCATIONS * GPU_COMPUTE_ITERATIONS / seconds / 1e9;
+    
+    // Invocation i adds 1.0 n times to (i & 1023); exact in float
+    if (vk->MapMemory(device, buffer_memory, 0, bytes, 0, (void **)&data) != 0) {
+        data = NULL;
+        goto out;
+    }
+    for (i = 0; i < GPU_COMPUTE_INVOCATIONS * 4; i++) {
+        if (data[i] != (float)((i / 4) & 1023) + GPU_COMPUTE_ITERATIONS) {
+            log_message("ERROR", "Vulkan: compute shader returned wrong results");
+            result->vulkan_gflops = 0;
+            goto out;
+        }
+    }
+    status = 0;
+    
+out:
+    if (data) {
+        vk->UnmapMemory(device, buffer_memory);
+    }
+    if (pipeline) {
+        vk->DestroyPipeline(device, pipeline, NULL);
+    }
+    if (layout) {
+        vk->DestroyPipelineLayout(device, layout, NULL);
+    }
+    if (descriptor_pool) {
+        vk->DestroyDescriptorPool(device, descriptor_pool, NULL);
+    }
+    if (set_layout) {
+        vk->DestroyDescriptorSetLayout(device, set_layout, NULL);
+    }
+    if (module) {
+        vk->DestroyShaderModule(device, module, NULL);
+    }
+    if (buffer) {
+        vk->DestroyBuffer(device, buffer, NULL);
+    }
+    if (buffer_memory) {
+        vk->FreeMemory(device, buffer_memory, NULL);
+    }
+    return status;
+}
+
+// Device-local buffer copy bandwidth and compute shader throughput on the
+// first non-CPU Vulkan device. A CPU device (llvmpipe) means the Mali ICD
+// did not load. Returns 1 when Vulkan is not installed.
+static int gpu_bench_vulkan(gpu_bench_t *result) {
+    static const char *const names[] = {
+        "CreateInstance", "EnumeratePhysicalDevices", "GetPhysicalDeviceProperties",
+        "GetPhysicalDeviceQueueFamilyProperties", "GetPhysicalDeviceMemoryProperties", "CreateDevice",
+        "GetDeviceQueue", "CreateBuffer", "GetBufferMemoryRequirements", "AllocateMemory", "BindBufferMemory",
+        "CreateCommandPool", "AllocateCommandBuffers", "BeginCommandBuffer", "CmdCopyBuffer", "EndCommandBuffer",
+        "QueueSubmit", "QueueWaitIdle", "DestroyCommandPool", "DestroyBuffer", "FreeMemory", "DestroyDevice",
+        "DestroyInstance", "MapMemory", "UnmapMemory", "CreateShaderModule", "DestroyShaderModule",
+        "CreateDescriptorSetLayout", "DestroyDescriptorSetLayout", "CreatePipelineLayout", "DestroyPipelineLayout",
+        "CreateComputePipelines", "DestroyPipeline", "CreateDescriptorPool", "DestroyDescriptorPool",
+        "AllocateDescriptorSets", "UpdateDescriptorSets", "CmdBindPipeline", "CmdBindDescriptorSets",
+        "CmdPushConstants", "CmdDispatch", "CmdPipelineBarrier", NULL
+    };
+    vulkan_api_t vk;
+    vulkan_launch_t launch = { .vk = &vk };
+    vk_application_info_t app = { .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO, .pApplicationName = "builder",
+                                  .apiVersion = (1u << 22) };
+    vk_instance_create_info_t instance_info = { .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, .pApplicationInfo = &app };
+    vk_queue_family_properties_t families[16];
+    vk_memory_properties_t memory;
+    vk_memory_requirements_t requirements;
+    union { unsigned char bytes[1024]; uint64_t align; } properties;
+    const float priority = 1.0f;
+    const uint64_t copy_bytes = (uint64_t)GPU_COPY_MB * 1024 * 1024;
+    vk_device_queue_create_info_t queue_info = { .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, .queueCount = 1,
+                                                 .pQueuePriorities = &priority };
+    vk_device_create_info_t device_info = { .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, .queueCreateInfoCount = 1,
+                                            .pQueueCreateInfos = &queue_info };
+    vk_buffer_create_info_t buffer_info = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = copy_bytes,
+                                            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_DST };
+    vk_memory_allocate_info_t allocate = { .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    vk_command_pool_create_info_t pool_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+    vk_command_buffer_allocate_info_t command_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                                                       .commandBufferCount = 1 };
+    vk_command_buffer_begin_info_t begin = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    vk_buffer_copy_t region = { .size = copy_bytes };
+    void *instance = NULL, *physical[8], *picked = NULL, *device = NULL;
+    vk_handle_t buffers[2] = { 0 }, memories[2] = { 0 }, pool = 0;
+    uint32_t count = 8, family_count = 16, family, type, i;
+    double seconds;
+    int status = -1;
+    void *lib = gpu_load_api("libvulkan.so.1", names, (void **)&vk, "vk");
+    
+    if (!lib) {
+        return 1;
+    }
+    if (vk.CreateInstance(&instance_info, NULL, &instance) != 0) {
+        log_message("ERROR", "Vulkan: failed to create an instance");
+        instance = NULL;
+        goto out;
+    }
+    if (vk.EnumeratePhysicalDevices(instance, &count, physical) < 0) {
+        count = 0;
+    }
+    for (i = 0; i < count && !picked; i++) {
+        vk.GetPhysicalDeviceProperties(physical[i], properties.bytes);
+        if (*(uint32_t *)(properties.bytes + VK_PROPERTIES_TYPE_OFFSET) != VK_PHYSICAL_DEVICE_TYPE_CPU) {
+            picked = physical[i];
+            snprintf(result->vulkan_device, sizeof(result->vulkan_device), "%.*s",
+                     (int)sizeof(result->vulkan_device) - 1,
+                     (const char *)properties.bytes + VK_PROPERTIES_NAME_OFFSET);
+        }
+    }
+    if (!picked) {
+        log_message("ERROR", count ? "Vulkan: only software (CPU) devices found" : "Vulkan: no devices found");
+        goto out;
+    }
+    
+    vk.GetPhysicalDeviceQueueFamilyProperties(picked, &family_count, families);
+    for (family = 0; family < family_count && !(families[family].queueFlags & VK_QUEUE_GRAPHICS_COMPUTE_TRANSFER);
+         family++) {
+    }
+    queue_info.queueFamilyIndex = family;
+    if (family == family_count || vk.CreateDevice(picked, &device_info, NULL, &device) != 0) {
+        log_message("ERROR", "Vulkan: failed to create a device");
+        device = NULL;
+        goto out;
+    }
+    vk.GetDeviceQueue(device, family, 0, &launch.queue);
+    
+    vk.GetPhysicalDeviceMemoryProperties(picked, &memory);
+    for (i = 0; i < 2; i++) {
+        if (vk.CreateBuffer(device, &buffer_info, NULL, &buffers[i]) != 0) {
+            goto out;
+        }
+        vk.GetBufferMemoryRequirements(device, buffers[i], &requirements);
+        for (type = 0; type < memory.memoryTypeCount; type++) {
+            if ((requirements.memoryTypeBits & (1u << type)) &&
+                (memory.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL)) {
+                break;
+            }
+        }
+        allocate.allocationSize = requirements.size;
+        allocate.memoryTypeIndex = type;
+        if (type == memory.memoryTypeCount || vk.AllocateMemory(device, &allocate, NULL, &memories[i]) != 0 ||
+            vk.BindBufferMemory(device, buffers[i], memories[i], 0) != 0) {
+            log_message("ERROR", "Vulkan: failed to allocate benchmark buffers");
+            goto out;
+        }
+    }
+    
+    pool_info.queueFamilyIndex = family;
+    if (vk.CreateCommandPool(device, &pool_info, NULL, &pool) != 0) {
+        goto out;
+    }
+    command_info.commandPool = pool;
+    if (vk.AllocateCommandBuffers(device, &command_info, &launch.command_buffer) != 0 ||
+        vk.BeginCommandBuffer(launch.command_buffer, &begin) != 0) {
+        goto out;
+    }
+    vk.CmdCopyBuffer(launch.command_buffer, buffers[0], buffers[1], 1, &region);
+    if (vk.EndCommandBuffer(launch.command_buffer) != 0) {
+        goto out;
+    }
+    
+    seconds = gpu_time_runs(vulkan_launch, &launch, result);
+    if (seconds <= 0) {
+        log_message("ERROR", "Vulkan: buffer copy failed to run");
+        goto out;
+    }
+    result->vulkan_gbs = 2.0 * copy_bytes / seconds / 1e9;
+    status = gpu_bench_vulkan_compute(&vk, device, launch.queue, pool, &memory, result);
+    
+out:
+    if (device) {
+        if (pool) {
+            vk.DestroyCommandPool(device, pool, NULL);
+        }
+        for (i = 0; i < 2; i++) {
+            if (buffers[i]) {
+                vk.DestroyBuffer(device, buffers[i], NULL);
+            }
+            if (memories[i]) {
+                vk.FreeMemory(device, memories[i], NULL);
+            }
+        }
+        vk.DestroyDevice(device, NULL);
+    }
+    if (instance) {
+        vk.DestroyInstance(instance, NULL);
+    }
+    dlclose(lib);
+    return status;
+}
+
+// Stored value of a metric in a GPU baseline file, or -1 if it is not listed
+static double gpu_baseline_value(const char *path, const char *metric) {
+    char line[256];
+    char name[64];
+    double value, result = -1;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] != '#' && sscanf(line, "%63s %lf", name, &value) == 2 && strcmp(name, metric) == 0) {
+            result = value;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+// Benchmark the running system's GPU stack: an OpenCL SGEMM and copy kernel
+// and a Vulkan buffer copy and compute dispatch, with the devfreq clock
+// observed along the way. Results are compared with (and the first run
+// becomes) the baseline. Fails on software fallback, wrong results or a
+// regression.
+int run_gpu_benchmark(build_config_t *config) {
+    gpu_bench_t result = { .freq_seen_mhz = 0 };
+    char path[MAX_PATH_LEN];
+    char governor[32] = "unknown";
+    char msg[MAX_PATH_LEN + 64];
+    long max_hz = 0;
+    double values[5], base, delta;
+    const char *metrics[] = { "opencl_sgemm_gflops", "opencl_copy_gbs", "vulkan_copy_gbs", "vulkan_compute_gflops",
+                              "gpu_clock_mhz" };
+    const char *labels[] = { "OpenCL SGEMM", "OpenCL copy", "Vulkan copy", "Vulkan compute", "GPU clock" };
+    const char *units[] = { "GFLOPS", "GB/s", "GB/s", "GFLOPS", "MHz" };
+    int opencl, vulkan, failed, regressed = 0, i;
+    FILE *fp;
+    
+    log_message("INFO", "Running GPU benchmark...");
+    
+    snprintf(path, sizeof(path), "%s/governor", GPU_DEVFREQ);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%31s", governor) != 1) {
+            strcpy(governor, "unknown");
+        }
+        fclose(fp);
+    }
+    snprintf(path, sizeof(path), "%s/max_freq", GPU_DEVFREQ);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%ld", &max_hz) != 1) {
+            max_hz = 0;
+        }
+        fclose(fp);
+    }
+    
+    opencl = gpu_bench_opencl(&result);
+    vulkan = gpu_bench_vulkan(&result);
+    failed = opencl < 0 || vulkan < 0 || (opencl > 0 && vulkan > 0);
+    
+    if (result.opencl_device[0] && !strcasestr(result.opencl_device, "mali")) {
+        snprintf(msg, sizeof(msg), "OpenCL device is not the Mali GPU: %s", result.opencl_device);
+        log_message("WARNING", msg);
+    }
+    if (result.vulkan_device[0] && !strcasestr(result.vulkan_device, "mali")) {
+        snprintf(msg, sizeof(msg), "Vulkan device is not the Mali GPU: %s", result.vulkan_device);
+        log_message("WARNING", msg);
+    }
+    
+    if (config->gpu_baseline[0] == '\0' &&
+        snprintf(config->gpu_baseline, sizeof(config->gpu_baseline), "%s/%s",
+                 config->cache_dir, GPU_BASELINE) >= (int)sizeof(config->gpu_baseline)) {
+        log_message("ERROR", "Cache directory path is too long");
+        return -1;
+    }
+    values[0] = result.sgemm_gflops;
+    values[1] = result.opencl_gbs;
+    values[2] = result.vulkan_gbs;
+    values[3] = result.vulkan_gflops;
+    values[4] = result.freq_seen_mhz;
+    
+    printf("\n%sGPU benchmark:%s\n", COLOR_BOLD, COLOR_RESET);
+    printf("  OpenCL device: %s\n", result.opencl_device[0] ? result.opencl_device : "-");
+    printf("  Vulkan device: %s\n", result.vulkan_device[0] ? result.vulkan_device : "-");
+    printf("  devfreq: %s governor, max %ld MHz\n", governor, max_hz / 1000000);
+    printf("  %-14s %14s %8s\n", "metric", "value", "baseline");
+    for (i = 0; i < 5; i++) {
+        if (values[i] <= 0) {
+            printf("  %-14s %14s\n", labels[i], "not measured");
+            continue;
+        }
+        printf("  %-14s %7.1f %-6s", labels[i], values[i], units[i]);
+        base = gpu_baseline_value(config->gpu_baseline, metrics[i]);
+        if (base > 0) {
+            delta = (values[i] - base) * 100.0 / base;
+            printf(" %8.1f %s%+.1f%%%s\n", base,
+                   delta < -GPU_REGRESSION_PCT ? COLOR_RED : delta > GPU_REGRESSION_PCT ? COLOR_GREEN : COLOR_RESET,
+                   delta, COLOR_RESET);
+            regressed |= delta < -GPU_REGRESSION_PCT;
+        } else {
+            printf(" %8s\n", "-");
+        }
+    }
+    printf("\n");
+    
+    // A GPU that never left its lowest OPPs under load scores low for
+    // reasons unrelated to the kernel or driver
+    if (max_hz > 0 && result.freq_seen_mhz > 0 && result.freq_seen_mhz * 1000000.0 < max_hz * 0.9) {
+        snprintf(msg, sizeof(msg), "GPU ran at %ld of %ld MHz under load (%s governor); check devfreq",
+                 result.freq_seen_mhz, max_hz / 1000000, governor);
+        log_message("WARNING", msg);
+    } else if (max_hz == 0) {
+        log_message("WARNING", "No devfreq node at " GPU_DEVFREQ "; GPU clock not observed");
+    }
+    
+    if (failed) {
+        log_message("ERROR", "GPU benchmark failed");
+        return -1;
+    }
+    if (regressed) {
+        snprintf(msg, sizeof(msg), "GPU performance regressed more than %.0f%% from %s",
+                 GPU_REGRESSION_PCT, config->gpu_baseline);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    
+    // First benchmark on this board becomes the baseline
+    if (access(config->gpu_baseline, F_OK) != 0) {
+        fp = fopen(config->gpu_baseline, "w");
+        if (fp) {
+            fprintf(fp, "# metric\tvalue\t(%s)\n", result.opencl_device);
+            for (i = 0; i < 5; i++) {
+                if (values[i] > 0) {
+                    fprintf(fp, "%s\t%.1f\n", metrics[i], values[i]);
+                }
+            }
+            fclose(fp);
+            snprintf(msg, sizeof(msg), "Saved as baseline: %s", config->gpu_baseline);
+            log_message("INFO", msg);
+        }
+    }
+    
+    log_message("SUCCESS", "GPU benchmark completed");
+    return 0;
+}
+
+// Write the --runtime-tune profile below root ("" for this system, a bundle
+// directory otherwise): a script that applies the cpufreq, devfreq and IRQ
+// settings, and a oneshot unit that reapplies them at every boot.
+int write_tuning_profile(build_config_t *config, const char *root) {
+    char path[MAX_PATH_LEN];
+    const char *governor, *big_min, *little_min, *devfreq_governor, *irq_cluster;
+    FILE *fp;
+    
+    if (strcmp(config->runtime_tune, "performance") == 0) {
+        governor = "performance";
+        big_min = "max";
+        little_min = "max";
+        devfreq_governor = "performance";
+        irq_cluster = "big";
+    } else if (strcmp(config->runtime_tune, "balanced") == 0) {
+        governor = "schedutil";
+        big_min = "half";
+        little_min = "min";
+        devfreq_governor = "simple_ondemand";
+        irq_cluster = "big";
+    } else {
+        governor = "powersave";
+        big_min = "min";
+        little_min = "min";
+        devfreq_governor = "powersave";
+        irq_cluster = "little";
+    }
+    
+    snprintf(path, sizeof(path), "%s%s", root, TUNE_SCRIPT);
+    *strrchr(path, '/') = '\0';
+    if (create_directory(path) != 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s%s", root, TUNE_SCRIPT);
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+            "#!/bin/sh\n"
+            "# Runtime tuning profile \"%s\" (builder %s)\n"
+            "GOVERNOR=%s\n"
+            "# Lowest clock of the Cortex-A76 (big) and A55 clusters: min, half or max\n"
+            "BIG_MIN=%s\n"
+            "LITTLE_MIN=%s\n"
+            "DEVFREQ_GOVERNOR=%s\n"
+            "# Cores that take the NIC/NVMe interrupts: big or little\n"
+            "IRQ_CLUSTER=%s\n"
+            "\n"
+            "# A76 cores report the full capacity (1024), the A55s well under half\n"
+            "is_big() { [ \"$(cat /sys/devices/system/cpu/cpu$1/cpu_capacity 2>/dev/null || echo 0)\" -gt 512 ]; }\n"
+            "\n"
+            "set_min() {\n"
+            "    lo=$(cat \"$1/cpuinfo_min_freq\"); hi=$(cat \"$1/cpuinfo_max_freq\"); f=$lo\n"
+            "    case $2 in\n"
+            "        max) f=$hi ;;\n"
+            "        half) for a in $(cat \"$1/scaling_available_frequencies\" 2>/dev/null); do\n"
+            "                  if [ \"$a\" -ge $((hi / 2)) ] && { [ \"$f\" -eq \"$lo\" ] || [ \"$a\" -lt \"$f\" ]; }; then f=$a; fi\n"
+            "              done ;;\n"
+            "    esac\n"
+            "    echo \"$f\" > \"$1/scaling_min_freq\"\n"
+            "}\n"
+            "\n"
+            "for p in /sys/devices/system/cpu/cpufreq/policy*; do\n"
+            "    [ -d \"$p\" ] || continue\n"
+            "    echo \"$GOVERNOR\" > \"$p/scaling_governor\" 2>/dev/null || echo \"${p##*/}: no $GOVERNOR governor\" >&2\n"
+            "    if is_big \"$(cut -d' ' -f1 \"$p/related_cpus\")\"; then set_min \"$p\" \"$BIG_MIN\"; else set_min \"$p\" \"$LITTLE_MIN\"; fi\n"
+            "done\n"
+            "\n"
+            "for d in %s %s; do\n"
+            "    [ -d \"$d\" ] || continue\n"
+            "    if grep -qw \"$DEVFREQ_GOVERNOR\" \"$d/available_governors\"; then\n"
+            "        echo \"$DEVFREQ_GOVERNOR\" > \"$d/governor\"\n"
+            "    else\n"
+            "        echo \"${d##*/}: no $DEVFREQ_GOVERNOR governor\" >&2\n"
+            "    fi\n"
+            "done\n"
+            "\n"
+            "mask=0\n"
+            "for c in /sys/devices/system/cpu/cpu[0-9]*; do\n"
+            "    n=${c##*cpu}\n"
+            "    if is_big \"$n\"; then cluster=big; else cluster=little; fi\n"
+            "    if [ \"$cluster\" = \"$IRQ_CLUSTER\" ]; then mask=$((mask | (1 << n))); fi\n"
+            "done\n"
+            "if [ $mask -ne 0 ]; then\n"
+            "    # Managed (per-queue NVMe) interrupts refuse new affinities; skip them\n"
+            "    for irq in $(grep -E '%s' /proc/interrupts | cut -d: -f1); do\n"
+            "        printf '%%x\\n' $mask > /proc/irq/$irq/smp_affinity 2>/dev/null || true\n"
+            "    done\n"
+            "fi\n"
+            "if pidof irqbalance > /dev/null; then echo \"irqbalance is running and may move these interrupts\" >&2; fi\n"
+            "exit 0\n",
+            config->runtime_tune, VERSION, governor, big_min, little_min, devfreq_governor, irq_cluster,
+            GPU_DEVFREQ, NPU_DEVFREQ, TUNE_IRQ_PATTERN);
+    fclose(fp);
+    chmod(path, 0755);
+    
+    snprintf(path, sizeof(path), "%s%s", root, TUNE_UNIT);
+    *strrchr(path, '/') = '\0';
+    if (create_directory(path) != 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s%s", root, TUNE_UNIT);
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+            "[Unit]\n"
+            "Description=Orange Pi 5 Plus runtime tuning (%s)\n"
+            "# Devfreq and NIC devices appear once udev has loaded their drivers\n"
+            "After=systemd-udev-trigger.service systemd-modules-load.service network.target\n"
+            "\n"
+            "[Service]\n"
+            "Type=oneshot\n"
+            "RemainAfterExit=yes\n"
+            "ExecStart=%s\n"
+            "\n"
+            "[Install]\n"
+            "WantedBy=multi-user.target\n",
+            config->runtime_tune, TUNE_SCRIPT);
+    fclose(fp);
+    return 0;
+}
+
+// Install the tuning profile on this system and apply it now
+int install_tuning_profile(build_config_t *config) {
+    char msg[128];
+    
+    snprintf(msg, sizeof(msg), "Installing runtime tuning profile (%s)...", config->runtime_tune);
+    log_message("INFO", msg);
+    
+    if (write_tuning_profile(config, "") != 0) {
+        log_message("ERROR", "Failed to write runtime tuning profile");
+        return -1;
+    }
+    if (access("/run/systemd/system", F_OK) != 0) {
+        log_message("WARNING", "systemd not running; applying once, run " TUNE_SCRIPT " at boot yourself");
+        return execute_command(TUNE_SCRIPT, 1) == 0 ? 0 : -1;
+    }
+    if (execute_command("systemctl daemon-reload && systemctl enable " TUNE_SERVICE
+                        " && systemctl restart " TUNE_SERVICE, 1) != 0) {
+        log_message("ERROR", "Failed to enable " TUNE_SERVICE);
+        return -1;
+    }
+    
+    log_message("SUCCESS", "Runtime tuning applied and enabled at boot");
+    return 0;
+}
+
+// Cleanup build artifacts
+int cleanup_build(build_config_t *config) {
+    char cmd[MAX_CMD_LEN];
+    
+    log_message("INFO", "Cleaning up build artifacts...");
+    
+    if (config->scratch_tmpfs) {
+        snprintf(cmd, sizeof(cmd), "umount %s", config->scratch_root);
+        if (execute_command(cmd, 0) != 0) {
+            log_message("WARNING", "Failed to unmount scratch tmpfs");
+        }
+    }
+    
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", config->build_dir);
+    if (execute_command(cmd, 0) != 0) {
+        log_message("WARNING", "Failed to cleanup build directory");
+    }
+    
+    // Cleanup Mali installation directory
+    if (execute_command("rm -rf /tmp/mali_install", 0) != 0) {
+        log_message("WARNING", "Failed to cleanup Mali install directory");
+    }
+    
+    log_message("SUCCESS", "Cleanup completed");
+    return 0;
+}
+
+// Check system dependencies
+int check_dependencies(void) {
+    struct stat st;
+    
+    // Check if we're on Ubuntu/Debian
+    if (stat("/etc/debian_version", &st) != 0) {
+        log_message("ERROR", "This tool is designed for Ubuntu/Debian systems");
+        return -1;
+    }
+    
+    // Check architecture
+    FILE *fp = popen("uname -m", "r");
+    if (fp) {
+        char arch[32];
+        if (fgets(arch, sizeof(arch), fp)) {
+            arch[strcspn(arch, "\n")] = '\0';
+            if (strcmp(arch, "aarch64") != 0 && strcmp(arch, "x86_64") != 0) {
+                log_message("WARNING", "Untested architecture detected");
+            }
+        }
+        pclose(fp);
+    }
+    
+    // Check available disk space (at least 10GB recommended)
+    fp = popen("df /tmp | tail -1 | awk '{print $4}'", "r");
+    if (fp) {
+        char space[32];
+        if (fgets(space, sizeof(space), fp)) {
+            long available_kb = atol(space);
+            if (available_kb < 10485760) { // 10GB in KB
+                log_message("WARNING", "Less than 10GB free space available in /tmp");
+            }
+        }
+        pclose(fp);
+    }
+    
+    return 0;
+}
+
+// Match a stage name against its base name; per-profile stages are named
+// <base>:<profile>
+static int stage_is(const char *stage, const char *base) {
+    size_t len = strlen(base);
+    return strncmp(stage, base, len) == 0 && (stage[len] == '\0' || stage[len] == ':');
+}
+
+// Compute the input digest of a pipeline stage. Stages whose inputs are
+// files on disk hash their contents, so a stage is re-run whenever an
+// upstream stage produced different output.
+unsigned long long compute_stage_digest(build_config_t *config, const char *stage) {
+    unsigned long long hash = digest_string(FNV_OFFSET_BASIS, stage);
+    const config_fragment_t *fragments[MAX_FRAGMENTS + 1];
+    char path[MAX_PATH_LEN + 128];
+    char commit[64];
+    int i, j, count;
+    
+    if (strcmp(stage, "mali-blobs") == 0) {
+        hash = digest_int(hash, config->enable_vulkan);
+        hash = digest_file(hash, "/tmp/mali_install/mali_csffw.bin");
+        hash = digest_file(hash, "/tmp/mali_install/libmali-valhall-g610-g6p0-x11-wayland-gbm.so");
+        if (config->enable_vulkan) {
+            hash = digest_file(hash, "/tmp/mali_install/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so");
+        }
+    } else if (strcmp(stage, "mali-drivers") == 0) {
+        hash = digest_int(hash, config->enable_opencl);
+        hash = digest_int(hash, config->enable_vulkan);
+        hash = digest_file(hash, "/tmp/mali_install/mali_csffw.bin");
+        hash = digest_file(hash, "/tmp/mali_install/libmali-valhall-g610-g6p0-x11-wayland-gbm.so");
+        hash = digest_file(hash, "/lib/firmware/mali_csffw.bin");
+        hash = digest_file(hash, "/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so");
+        if (config->enable_vulkan) {
+            hash = digest_file(hash, "/usr/lib/libmali-valhall-g610-g6p0-wayland-gbm-vulkan.so");
+        }
+    } else if (strcmp(stage, "source") == 0) {
+        get_source_commit(config, commit, sizeof(commit));
+        hash = digest_string(hash, config->kernel_version);
+        hash = digest_string(hash, config->kernel_ref);
+        hash = digest_string(hash, commit);
+    } else if (stage_is(stage, "configure")) {
+        get_source_commit(config, commit, sizeof(commit));
+        hash = digest_string(hash, commit);
+        hash = digest_string(hash, config->arch);
+        hash = digest_string(hash, config->cross_compile);
+        hash = digest_string(hash, config->defconfig);
+        hash = digest_string(hash, config->profile->name);
+        count = collect_fragments(config, fragments);
+        for (i = 0; i < count; i++) {
+            for (j = 0; fragments[i]->options[j] != NULL; j++) {
+                hash = digest_string(hash, fragments[i]->options[j]);
+            }
+        }
+        for (i = 0; i < config->user_fragment_count; i++) {
+            hash = digest_file(hash, config->user_fragments[i]);
+        }
+    } else if (stage_is(stage, "build")) {
+        get_source_commit(config, commit, sizeof(commit));
+        hash = digest_string(hash, commit);
+        hash = digest_string(hash, config->arch);
+        hash = digest_string(hash, config->cross_compile);
+        hash = digest_string(hash, config->profile->localversion);
+        hash = digest_int(hash, config->tune_cpu);
+        hash = digest_string(hash, config->toolchain);
+        hash = digest_string(hash, config->pgo);
+        if (strcmp(config->pgo, "use") == 0) {
+            hash = digest_file(hash, config->pgo_profile);
+        }
+        snprintf(path, sizeof(path), "%s/.config", config->objdir);
+        hash = digest_file(hash, path);
+    } else if (strcmp(stage, "tune") == 0) {
+        hash = digest_string(hash, config->runtime_tune);
+    } else if (strcmp(stage, "debug-info") == 0) {
+        snprintf(path, sizeof(path), "%s/arch/arm64/boot/Image", config->objdir);
+        hash = digest_file(hash, path);
+        snprintf(path, sizeof(path), "%s/.config", config->objdir);
+        hash = digest_file(hash, path);
+    } else if (stage_is(stage, "install") || strcmp(stage, "bundle") == 0 || strcmp(stage, "package") == 0) {
+        hash = digest_int(hash, config->deb);
+        hash = digest_string(hash, config->deb_compress);
+        hash = digest_string(hash, config->initramfs_compress);
+        hash = digest_string(hash, config->initramfs_modules);
+        hash = digest_int(hash, config->module_strip);
+        hash = digest_string(hash, config->module_compress);
+        if (strcmp(stage, "bundle") == 0) {
+            hash = digest_string(hash, config->runtime_tune);
+        }
+        hash = digest_string(hash, config->kernel_version);
+        hash = digest_string(hash, config->profile->image_suffix);
+        snprintf(path, sizeof(path), "%s/arch/arm64/boot/Image", config->objdir);
+        hash = digest_file(hash, path);
+        snprintf(path, sizeof(path), "%s/.config", config->objdir);
+        hash = digest_file(hash, path);
+    }
+    
+    return hash;
+}
+
+// Load the stage manifest from the build directory
+int load_stage_manifest(build_config_t *config) {
+    char path[MAX_PATH_LEN + 16];
+    char line[128];
+    FILE *fp;
+    
+    stage_manifest.count = 0;
+    snprintf(path, sizeof(path), "%s/%s", config->build_dir, STATE_FILE);
+    
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), fp) && stage_manifest.count < MAX_STAGES) {
+        stage_record_t *record = &stage_manifest.records[stage_manifest.count];
+        if (sscanf(line, "%31s %llx", record->name, &record->digest) == 2) {
+            stage_manifest.count++;
+        }
+    }
+    
+    fclose(fp);
+    return 0;
+}
+
+// Write the stage manifest atomically (temporary file + rename)
+int save_stage_manifest(build_config_t *config) {
+    char path[MAX_PATH_LEN + 16];
+    char tmp_path[MAX_PATH_LEN + 24];
+    FILE *fp;
+    int i;
+    
+    snprintf(path, sizeof(path), "%s/%s", config->build_dir, STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    
+    fp = fopen(tmp_path, "w");
+    if (!fp) {
+        log_message("WARNING", "Could not write stage manifest");
+        return -1;
+    }
+    
+    fprintf(fp, "# builder %s stage manifest: <stage> <input digest>\n", VERSION);
+    for (i = 0; i < stage_manifest.count; i++) {
+        fprintf(fp, "%s %016llx\n", stage_manifest.records[i].name, stage_manifest.records[i].digest);
+    }
+    fclose(fp);
+    
+    return rename(tmp_path, path);
+}
+
+// Decide whether a stage has to run. In incremental mode a stage is skipped
+// when its recorded digest matches the current inputs and its output exists.
+int stage_needs_run(build_config_t *config, const char *stage, const char *output) {
+    unsigned long long digest;
+    char msg[128];
+    int i;
+    
+    if (!config->incremental || config->clean_build) {
+        return 1;
+    }
+    
+    if (output && access(output, F_OK) != 0) {
+        return 1;
+    }
+    
+    digest = compute_stage_digest(config, stage);
+    for (i = 0; i < stage_manifest.count; i++) {
+        if (strcmp(stage_manifest.records[i].name, stage) == 0) {
+            if (stage_manifest.records[i].digest != digest) {
+                return 1;
+            }
+            snprintf(msg, sizeof(msg), "Skipping %s stage (inputs unchanged)", stage);
+            log_message("INFO", msg);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+// Record a successfully completed stage in the manifest
+void stage_completed(build_config_t *config, const char *stage) {
+    unsigned long long digest = compute_stage_digest(config, stage);
+    int i;
+    
+    for (i = 0; i < stage_manifest.count; i++) {
+        if (strcmp(stage_manifest.records[i].name, stage) == 0) {
+            break;
+        }
+    }
+    
+    if (i == stage_manifest.count) {
+        if (stage_manifest.count >= MAX_STAGES) {
+            return;
+        }
+        strncpy(stage_manifest.records[i].name, stage, sizeof(stage_manifest.records[i].name) - 1);
+        stage_manifest.count++;
+    }
+    
+    stage_manifest.records[i].digest = digest;
+    save_stage_manifest(config);
+}
+
+// Stage entry points for the pipeline graph
+static int stage_environment(build_config_t *config) {
+    return setup_build_environment(config);
+}
+
+static int stage_prerequisites(build_config_t *config) {
+    return install_prerequisites(config);
+}
+
+static int stage_toolchain(build_config_t *config) {
+    // Before the compiler cache: the distributed mode decides how it chains
+    if (setup_distributed_build(config) != 0) {
+        return -1;
+    }
+    if (setup_compiler_cache(config) != 0) {
+        return -1;
+    }
+    read_compiler_cache_stats(config, &compiler_cache_baseline);
+    return 0;
+}
+
+static int stage_mali_drivers(build_config_t *config) {
+    if (install_mali_drivers(config) != 0) {
+        return -1;
+    }
+    if (setup_opencl_support(config) != 0) {
+        return -1;
+    }
+    return setup_vulkan_support(config);
+}
+
+static int stage_source(build_config_t *config) {
+    char path[MAX_PATH_LEN + 16];
+    char cmd[MAX_CMD_LEN];
+    
+    if (download_kernel_source(config) != 0) {
+        return -1;
+    }
+    download_ubuntu_rockchip_patches(config); // Non-critical
+    
+    // O= builds refuse a source tree that still holds an in-tree build
+    snprintf(path, sizeof(path), "%s/linux/.config", config->build_dir);
+    if (access(path, F_OK) == 0) {
+        log_message("WARNING", "Removing in-tree build state; objects now live in per-profile directories");
+        snprintf(cmd, sizeof(cmd), "make -C %s/linux mrproper", config->build_dir);
+        if (execute_command(cmd, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int stage_verify_gpu(build_config_t *config) {
+    (void)config;
+    verify_gpu_installation(); // Informational only
+    return 0;
+}
+
+// Output whose absence forces a stage to run even when its inputs match
+void stage_output_path(build_config_t *config, const char *stage, char *path, size_t size) {
+    char release[128];
+    
+    path[0] = '\0';
+    if (strcmp(stage, "source") == 0) {
+        snprintf(path, size, "%s/linux/.git", config->build_dir);
+    } else if (stage_is(stage, "configure")) {
+        snprintf(path, size, "%s/.config", config->objdir);
+    } else if (stage_is(stage, "build")) {
+        snprintf(path, size, "%s/arch/arm64/boot/Image", config->objdir);
+    } else if (stage_is(stage, "install") && config->deb) {
+        // The image package installs under the kernel release
+        if (kernel_release(config, release, sizeof(release)) == 0) {
+            snprintf(path, size, "/boot/vmlinuz-%s", release);
+        }
+    } else if (stage_is(stage, "install")) {
+        snprintf(path, size, "/boot/vmlinuz-%s%s", config->kernel_version, config->profile->image_suffix);
+    } else if (strcmp(stage, "bundle") == 0 && bundle_path(config, path, size) != 0) {
+        path[0] = '\0';
+    } else if (strcmp(stage, "package") == 0 && kernel_release(config, release, sizeof(release)) == 0) {
+        snprintf(path, size, "%s/%s/%s", config->build_dir, DEB_DIR, release);
+    } else if (strcmp(stage, "tune") == 0) {
+        snprintf(path, size, "%s", TUNE_UNIT);
+    } else if (strcmp(stage, "debug-info") == 0 && kernel_release(config, release, sizeof(release)) == 0) {
+        snprintf(path, size, "%s/%s/%s.tar.zst", config->cache_dir, DEBUG_DIR, release);
+    }
+}
+
+// Echo a running stage's buffered output to the terminal. Only whole lines
+// are written unless the stage has finished.
+static void echo_stage_output(pipeline_stage_t *stage, int final) {
+    char buffer[4096];
+    size_t bytes;
+    long start;
+    
+    if (!stage->log) {
+        stage->log = fopen(stage->log_path, "r");
+        if (!stage->log) {
+            return;
+        }
+    }
+    
+    for (;;) {
+        start = ftell(stage->log);
+        if (!fgets(buffer, sizeof(buffer), stage->log)) {
+            break;
+        }
+        bytes = strlen(buffer);
+        if (!final && buffer[bytes - 1] != '\n' && bytes < sizeof(buffer) - 1) {
+            // Partial line: wait for the rest
+            fseek(stage->log, start, SEEK_SET);
+            break;
+        }
+        log_clear_status();
+        fwrite(buffer, 1, bytes, stdout);
+    }
+    clearerr(stage->log);
+    fflush(stdout);
+}
+
+// Returns 1 when every dependency of a stage has completed or was skipped,
+// -1 when a dependency failed
+static int stage_deps_ready(pipeline_stage_t *stages, int count, pipeline_stage_t *stage) {
+    int i, j;
+    
+    for (i = 0; i < MAX_STAGE_DEPS && stage->deps[i]; i++) {
+        for (j = 0; j < count; j++) {
+            if (strcmp(stages[j].name, stage->deps[i]) != 0) {
+                continue;
+            }
+            if (stages[j].state == STAGE_FAILED) {
+                return -1;
+            }
+            if (stages[j].state != STAGE_DONE && stages[j].state != STAGE_SKIPPED) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Start a stage: inline stages run to completion here, the rest are forked
+// with their output captured to a per-stage log
+static int launch_stage(build_config_t *config, pipeline_stage_t *stage) {
+    char output[MAX_PATH_LEN + 64];
+    struct rusage before, after;
+    int fd;
+    
+    select_profile(config, stage->profile);
+    stage_output_path(config, stage->name, output, sizeof(output));
+    if (stage->tracked && !stage_needs_run(config, stage->name, output[0] ? output : NULL)) {
+        stage->state = STAGE_SKIPPED;
+        return 0;
+    }
+    
+    // Commands run by this stage are recorded for the build report
+    snprintf(telemetry_file, sizeof(telemetry_file), "%s/%s/%s.stats",
+             config->build_dir, STAGE_LOG_DIR, stage->name);
+    fd = open(telemetry_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        close(fd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stage->started);
+    
+    if (stage->inline_stage) {
+        getrusage(RUSAGE_CHILDREN, &before);
+        stage->state = stage->run(config) == 0 ? STAGE_DONE : STAGE_FAILED;
+        getrusage(RUSAGE_CHILDREN, &after);
+        telemetry_file[0] = '\0';
+        stage->usage.wall_seconds = elapsed_seconds(&stage->started);
+        stage->usage.user_seconds = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) +
+                                    (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6;
+        stage->usage.sys_seconds = (after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+                                   (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+        stage->usage.max_rss_kb = after.ru_maxrss;
+        return 0;
+    }
+    
+    snprintf(stage->log_path, sizeof(stage->log_path), "%s/%s/%s.log",
+             config->build_dir, STAGE_LOG_DIR, stage->name);
+    
+    // Truncate here, not in the child, so the echo never sees a previous run
+    fd = open(stage->log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        close(fd);
+    }
+    
+    fflush(stdout);
+    
+    stage->pid = fork();
+    if (stage->pid < 0) {
+        log_message("ERROR", "Failed to start pipeline stage");
+        stage->state = STAGE_FAILED;
+        return -1;
+    }
+    
+    if (stage->pid == 0) {
+        fd = open(stage->log_path, O_WRONLY | O_APPEND);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        log_start_writer();
+        fd = stage->run(config);
+        fflush(stdout);
+        log_flush();
+        _exit(fd == 0 ? 0 : 1);
+    }
+    
+    telemetry_file[0] = '\0';
+    stage->state = STAGE_RUNNING;
+    return 0;
+}
+
+// Run the build pipeline as a dependency graph. Independent stages (the
+// Mali blob fetch/install and the kernel fetch/configure/build) run
+// concurrently; the terminal shows stage output in pipeline order, streaming
+// the earliest unfinished stage live and replaying the others once they
+// reach the front.
+int run_pipeline(build_config_t *config, int no_install, int verify_gpu) {
+    static char profile_stage_names[MAX_PROFILES][2][48];
+    pipeline_stage_t stages[MAX_STAGES] = {
+        // Untracked: both re-check dpkg and the apt lists themselves, which
+        // is cheap, and must notice removed packages and expired lists
+        { .name = "environment",   .run = stage_environment },
+        { .name = "prerequisites", .run = stage_prerequisites,
+          .deps = { "environment" } },
+        { .name = "toolchain",     .run = stage_toolchain,     .inline_stage = 1,
+          .deps = { "prerequisites" } },
+        { .name = "mali-blobs",    .run = download_mali_blobs, .tracked = 1,
+          .deps = { "prerequisites" } },
+        { .name = "mali-drivers",  .run = stage_mali_drivers,  .tracked = 1,
+          .deps = { "mali-blobs" } },
+        { .name = "source",        .run = stage_source,        .tracked = 1,
+          .deps = { "prerequisites" } },
+    };
+    int count = 6;
+    int p;
+    
+    // configure/build per profile; back to back unless --parallel-profiles
+    for (p = 0; p < config->profile_count; p++) {
+        char *configure_name = profile_stage_names[p][0];
+        char *build_name = profile_stage_names[p][1];
+        
+        snprintf(configure_name, sizeof(profile_stage_names[p][0]), "configure:%s", config->profile_list[p]->name);
+        snprintf(build_name, sizeof(profile_stage_names[p][1]), "build:%s", config->profile_list[p]->name);
+        stages[count++] = (pipeline_stage_t){ .name = configure_name, .run = configure_kernel,
+                                              .tracked = 1, .profile = p,
+                                              .deps = { "source", "toolchain" } };
+        stages[count++] = (pipeline_stage_t){ .name = build_name, .run = build_kernel,
+                                              .tracked = 1, .profile = p,
+                                              .deps = { configure_name,
+                                                        p > 0 && !config->parallel_profiles ?
+                                                        profile_stage_names[p - 1][1] : NULL } };
+    }
+    stages[count++] = (pipeline_stage_t){ .name = "package", .run = build_kernel_packages, .tracked = 1,
+                                          .deps = { profile_stage_names[0][1] } };
+    stages[count++] = (pipeline_stage_t){ .name = "install", .run = install_kernel, .tracked = 1,
+                                          .deps = { profile_stage_names[0][1], "package" } };
+    stages[count++] = (pipeline_stage_t){ .name = "tune", .run = install_tuning_profile, .tracked = 1,
+                                          .deps = { "install" } };
+    stages[count++] = (pipeline_stage_t){ .name = "verify-gpu", .run = stage_verify_gpu,
+                                          .deps = { "install", "mali-drivers" } };
+    stages[count++] = (pipeline_stage_t){ .name = "debug-info", .run = export_debug_info, .tracked = 1,
+                                          .deps = { profile_stage_names[0][1] } };
+    stages[count++] = (pipeline_stage_t){ .name = "bundle", .run = create_bundle, .tracked = 1,
+                                          .deps = { profile_stage_names[0][1] } };
+    stages[count++] = (pipeline_stage_t){ .name = "deploy", .run = deploy_bundle,
+                                          .deps = { "bundle" } };
+    struct timespec pipeline_start;
+    struct rusage ru;
+    char path[MAX_PATH_LEN + 16];
+    char msg[128];
+    const char *failed = NULL;
+    int console = 0; // Stage whose output currently owns the terminal
+    int running = 0;
+    int progress, ready, status, i;
+    pid_t pid;
+    
+    clock_gettime(CLOCK_MONOTONIC, &pipeline_start);
+    
+    // Fleet builds install on the boards, not on the build host
+    if (config->deploy_hosts[0]) {
+        no_install = 1;
+    }
+    
+    for (i = 0; i < count; i++) {
+        stages[i].enabled = 1;
+        if (!config->install_gpu_blobs &&
+            (strcmp(stages[i].name, "mali-blobs") == 0 || strcmp(stages[i].name, "mali-drivers") == 0)) {
+            stages[i].enabled = 0;
+        }
+        if ((no_install || !config->runtime_tune[0]) && strcmp(stages[i].name, "tune") == 0) {
+            stages[i].enabled = 0;
+        }
+        if (no_install && strcmp(stages[i].name, "install") == 0) {
+            stages[i].enabled = 0;
+        }
+        if ((strcmp(stages[i].name, "package") == 0 && !config->deb) ||
+            (strcmp(stages[i].name, "debug-info") == 0 && config->debug_info == &debug_info_fragments[0]) ||
+            (strcmp(stages[i].name, "bundle") == 0 && !config->bundle && !config->deploy_hosts[0]) ||
+            (strcmp(stages[i].name, "deploy") == 0 && !config->deploy_hosts[0])) {
+            stages[i].enabled = 0;
+        }
+        if ((no_install || !verify_gpu || !config->install_gpu_blobs || !config->profile_list[0]->gpu) &&
+            strcmp(stages[i].name, "verify-gpu") == 0) {
+            stages[i].enabled = 0;
+        }
+    }
+    
+    snprintf(path, sizeof(path), "%s/%s", config->build_dir, STAGE_LOG_DIR);
+    if (create_directory(path) != 0) {
+        return -1;
+    }
+    
+    for (;;) {
+        // Launch every stage whose dependencies are satisfied
+        do {
+            progress = 0;
+            for (i = 0; i < count && !failed; i++) {
+                if (stages[i].state != STAGE_PENDING) {
+                    continue;
+                }
+                ready = stage_deps_ready(stages, count, &stages[i]);
+                if (ready == 0) {
+                    continue;
+                }
+                if (ready < 0 || !stages[i].enabled) {
+                    stages[i].state = STAGE_SKIPPED;
+                    progress = 1;
+                    continue;
+                }
+                
+                // Inline stages print directly, so let earlier output drain first
+                if (stages[i].inline_stage && console < i) {
+                    continue;
+                }
+                
+                launch_stage(config, &stages[i]);
+                if (log_quiet() && stages[i].state != STAGE_PENDING) {
+                    snprintf(msg, sizeof(msg), "%s: %s", stages[i].name,
+                             stages[i].state == STAGE_SKIPPED ? "up to date" :
+                             stages[i].state == STAGE_FAILED ? "failed" :
+                             stages[i].state == STAGE_DONE ? "done" : "started");
+                    log_message("PROGRESS", msg);
+                }
+                if (stages[i].state == STAGE_RUNNING) {
+                    running++;
+                } else if (stages[i].state == STAGE_FAILED) {
+                    failed = stages[i].name;
+                } else if (stages[i].tracked && stages[i].state == STAGE_DONE) {
+                    select_profile(config, stages[i].profile);
+                    stage_completed(config, stages[i].name);
+                }
+                progress = 1;
+            }
+        } while (progress);
+        
+        // Stream the front stage and advance past everything that finished
+        while (console < count) {
+            pipeline_stage_t *front = &stages[console];
+            if (front->state == STAGE_RUNNING) {
+                echo_stage_output(front, 0);
+                break;
+            }
+            if (front->state == STAGE_PENDING) {
+                break;
+            }
+            if (front->pid > 0) {
+                echo_stage_output(front, 1);
+                if (front->log) {
+                    fclose(front->log);
+                    front->log = NULL;
+                }
+            }
+            console++;
+        }
+        
+        // Progress bar for the running builds, redrawn below their output
+        if (isatty(STDOUT_FILENO)) {
+            for (i = 0; i < count; i++) {
+                if (stages[i].state == STAGE_RUNNING && stage_is(stages[i].name, "build")) {
+                    draw_build_progress(config, &stages[i]);
+                    break;
+                }
+            }
+        }
+        
+        if (running == 0) {
+            log_clear_status();
+            if (console >= count || failed) {
+                break;
+            }
+            // Nothing running and nothing launchable: let inline stages start
+            // once the terminal has caught up, otherwise the graph is stuck
+            for (i = console; i < count; i++) {
+                if (stages[i].state == STAGE_PENDING && stage_deps_ready(stages, count, &stages[i]) != 0) {
+                    break;
+                }
+            }
+            if (i == count) {
+                break;
+            }
+            continue;
+        }
+        
+        // Reap finished stages
+        while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+            for (i = 0; i < count; i++) {
+                if (stages[i].pid != pid || stages[i].state != STAGE_RUNNING) {
+                    continue;
+                }
+                running--;
+                // Includes every command the stage waited for
+                stages[i].usage.wall_seconds = elapsed_seconds(&stages[i].started);
+                stages[i].usage.user_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+                stages[i].usage.sys_seconds = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+                stages[i].usage.max_rss_kb = ru.ru_maxrss;
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                    stages[i].state = STAGE_DONE;
+                    if (stages[i].tracked) {
+                        select_profile(config, stages[i].profile);
+                        stage_completed(config, stages[i].name);
+                    }
+                } else {
+                    stages[i].state = STAGE_FAILED;
+                    if (!failed) {
+                        failed = stages[i].name;
+                    }
+                }
+                if (log_quiet()) {
+                    snprintf(msg, sizeof(msg), "%s: %s in %.1fs", stages[i].name,
+                             stages[i].state == STAGE_DONE ? "done" : "failed", stages[i].usage.wall_seconds);
+                    log_message("PROGRESS", msg);
+                }
+            }
+        }
+        
+        usleep(100000);
+    }
+    
+    // Drain output of stages that never reached the front (after a failure)
+    for (i = console; i < count; i++) {
+        if (stages[i].pid > 0 && stages[i].state != STAGE_RUNNING) {
+            echo_stage_output(&stages[i], 1);
+            if (stages[i].log) {
+                fclose(stages[i].log);
+                stages[i].log = NULL;
+            }
+        }
+    }
+    
+    if (failed) {
+        snprintf(msg, sizeof(msg), "Pipeline stage '%s' failed", failed);
+        log_message("ERROR", msg);
+        write_build_report(config, stages, count, elapsed_seconds(&pipeline_start), 0);
+        return -1;
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (stages[i].state != STAGE_DONE && stages[i].state != STAGE_SKIPPED) {
+            snprintf(msg, sizeof(msg), "Pipeline stage '%s' did not run", stages[i].name);
+            log_message("ERROR", msg);
+            write_build_report(config, stages, count, elapsed_seconds(&pipeline_start), 0);
+            return -1;
+        }
+    }
+    
+    write_build_report(config, stages, count, elapsed_seconds(&pipeline_start), 1);
+    return 0;
+}
+
+// Per-stage wall times of one pipeline run, read back from its build report.
+// Slot 0 is the whole run.
+typedef struct {
+    char names[MAX_STAGES + 1][32];
+    double seconds[MAX_STAGES + 1];
+    int count;
+} bench_sample_t;
+
+static int read_bench_report(const char *path, bench_sample_t *sample) {
+    char line[1024];
+    char *p;
+    int indent;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp) {
+        return -1;
+    }
+    
+    memset(sample, 0, sizeof(*sample));
+    strcpy(sample->names[0], "total");
+    sample->count = 1;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        for (p = line; *p == ' '; p++) {
+        }
+        indent = (int)(p - line);
+        if (indent == 2 && sscanf(p, "\"wall_seconds\": %lf", &sample->seconds[0]) == 1) {
+            continue;
+        }
+        if (indent == 6 && strncmp(p, "\"name\": \"", 9) == 0 && sample->count <= MAX_STAGES) {
+            p += 9;
+            p[strcspn(p, "\"")] = '\0';
+            snprintf(sample->names[sample->count], sizeof(sample->names[0]), "%s", p);
+            sample->count++;
+        } else if (indent == 6 && strncmp(p, "\"status\": \"disabled\"", 20) == 0) {
+            sample->count--; // Not part of this configuration
+        } else if (indent == 6 && sample->count > 1) {
+            sscanf(p, "\"wall_seconds\": %lf", &sample->seconds[sample->count - 1]);
+        }
+    }
+    
+    fclose(fp);
+    return 0;
+}
+
+// Median and nearest-rank 95th percentile of n samples
+static void bench_percentiles(const double *values, int n, double *median, double *p95) {
+    double sorted[MAX_BENCH_RUNS];
+    int rank;
+    
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    *median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    rank = (95 * n + 99) / 100;
+    *p95 = sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Median for scenario/stage in a baseline file, or -1 if it is not listed
+static double bench_baseline_median(const char *path, const char *scenario, const char *stage) {
+    char line[256];
+    char row_scenario[32], row_stage[32];
+    double median, result = -1;
+    FILE *fp = fopen(path, "r");
+    
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] != '#' &&
+            sscanf(line, "%31s %31s %lf", row_scenario, row_stage, &median) == 3 &&
+            strcmp(row_scenario, scenario) == 0 && strcmp(row_stage, stage) == 0) {
+            result = median;
+            break;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+// Benchmark the pipeline end to end: re-run this builder as a child for a
+// cold build (--clean), a warm rebuild over existing objects and a no-op
+// --incremental rebuild, N times each, against one pinned kernel commit.
+// Per-stage medians/p95 come from the children's build reports and are
+// compared against a saved baseline.
+int run_benchmark(build_config_t *config, int argc, char *argv[]) {
+    static const char *scenarios[] = { "cold", "warm", "noop" };
+    static bench_sample_t samples[3][MAX_BENCH_RUNS];
+    char *child_argv[MAX_ARGS + 16];
+    char bench_dir[MAX_PATH_LEN + 8];
+    char report[MAX_PATH_LEN + 32];
+    char results[MAX_PATH_LEN + 24];
+    char msg[MAX_PATH_LEN + 64];
+    double values[MAX_BENCH_RUNS];
+    double median, p95, base;
+    int runs = config->bench_runs;
+    int failed = 0;
+    int base_argc = 0;
+    int run, sc, st, k, n, i;
+    FILE *fp;
+    
+    if (runs > MAX_BENCH_RUNS) {
+        runs = MAX_BENCH_RUNS;
+    }
+    
+    snprintf(bench_dir, sizeof(bench_dir), "%s/%s", config->build_dir, BENCH_DIR);
+    if (create_directory(bench_dir) != 0) {
+        return -1;
+    }
+    if (config->bench_baseline[0] == '\0' &&
+        snprintf(config->bench_baseline, sizeof(config->bench_baseline), "%s/%s",
+                 config->cache_dir, BENCH_BASELINE) >= (int)sizeof(config->bench_baseline)) {
+        log_message("ERROR", "Cache directory path is too long");
+        return -1;
+    }
+    
+    // Forward the user's options, minus the ones each scenario controls
+    child_argv[base_argc++] = "/proc/self/exe";
+    for (i = 1; i < argc && base_argc < MAX_ARGS; i++) {
+        if (strcmp(argv[i], "--bench") == 0 || strcmp(argv[i], "--bench-baseline") == 0 ||
+            strcmp(argv[i], "--report") == 0 || strcmp(argv[i], "--kernel-ref") == 0 ||
+            strcmp(argv[i], "--artifact-cache") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--clean") == 0 || strcmp(argv[i], "-c") == 0 ||
+            strcmp(argv[i], "--incremental") == 0 || strcmp(argv[i], "--cleanup") == 0 ||
+            strcmp(argv[i], "--no-install") == 0 || strcmp(argv[i], "--verify-gpu") == 0) {
+            continue;
+        }
+        child_argv[base_argc++] = argv[i];
+    }
+    child_argv[base_argc++] = "--no-install";
+    // A cache hit would time the unpack, not the build
+    child_argv[base_argc++] = "--artifact-cache";
+    child_argv[base_argc++] = "none";
+    
+    for (run = 0; run < runs && !failed; run++) {
+        for (sc = 0; sc < 3 && !failed; sc++) {
+            k = base_argc;
+            if (sc == 0) {
+                child_argv[k++] = "--clean";
+            } else if (sc == 2) {
+                child_argv[k++] = "--incremental";
+            }
+            if (config->kernel_ref[0]) {
+                child_argv[k++] = "--kernel-ref";
+                child_argv[k++] = config->kernel_ref;
+            }
+            snprintf(report, sizeof(report), "%s/%s-%d.json", bench_dir, scenarios[sc], run + 1);
+            child_argv[k++] = "--report";
+            child_argv[k++] = report;
+            child_argv[k] = NULL;
+            
+            snprintf(msg, sizeof(msg), "Benchmark run %d/%d: %s build", run + 1, runs, scenarios[sc]);
+            log_message("INFO", msg);
+            
+            unlink(report);
+            if (run_command(child_argv, config->verbose, NULL) != 0 ||
+                read_bench_report(report, &samples[sc][run]) != 0) {
+                snprintf(msg, sizeof(msg), "Benchmark %s build failed, see %s", scenarios[sc], LOG_FILE);
+                log_message("ERROR", msg);
+                failed = 1;
+                break;
+            }
+            
+            // Pin the commit the first build fetched so every run builds the same tree
+            if (config->kernel_ref[0] == '\0' &&
+                get_source_commit(config, config->kernel_ref, sizeof(config->kernel_ref)) == 0) {
+                snprintf(msg, sizeof(msg), "Benchmark pinned to kernel commit %s", config->kernel_ref);
+                log_message("INFO", msg);
+            }
+        }
+    }
+    
+    if (failed) {
+        return -1;
+    }
+    
+    snprintf(results, sizeof(results), "%s/results.tsv", bench_dir);
+    fp = fopen(results, "w");
+    if (!fp) {
+        log_message("ERROR", "Failed to write benchmark results");
+        return -1;
+    }
+    if (config->kernel_ref[0] == '\0') {
+        strcpy(config->kernel_ref, "unpinned");
+    }
+    fprintf(fp, "# scenario\tstage\tmedian_s\tp95_s\truns\t(kernel %s)\n", config->kernel_ref);
+    
+    printf("\n%sBenchmark (%d runs, kernel %s):%s\n", COLOR_BOLD, runs, config->kernel_ref, COLOR_RESET);
+    printf("  %-6s %-14s %10s %10s %10s\n", "run", "stage", "median", "p95", "baseline");
+    
+    for (sc = 0; sc < 3; sc++) {
+        for (st = 0; st < samples[sc][0].count; st++) {
+            for (n = 0; n < runs; n++) {
+                values[n] = samples[sc][n].seconds[st];
+            }
+            bench_percentiles(values, runs, &median, &p95);
+            fprintf(fp, "%s\t%s\t%.3f\t%.3f\t%d\n", scenarios[sc], samples[sc][0].names[st], median, p95, runs);
+            
+            base = bench_baseline_median(config->bench_baseline, scenarios[sc], samples[sc][0].names[st]);
+            printf("  %-6s %-14s %9.1fs %9.1fs", scenarios[sc], samples[sc][0].names[st], median, p95);
+            if (base > 0) {
+                double delta = (median - base) * 100.0 / base;
+                printf(" %9.1fs %s%+.1f%%%s\n", base,
+                       delta > BENCH_REGRESSION_PCT ? COLOR_RED :
+                       delta < -BENCH_REGRESSION_PCT ? COLOR_GREEN : COLOR_RESET,
+                       delta, COLOR_RESET);
+            } else {
+                printf(" %10s\n", "-");
+            }
+        }
+    }
+    fclose(fp);
+    printf("\n");
+    
+    snprintf(msg, sizeof(msg), "Benchmark results written to %s", results);
+    log_message("INFO", msg);
+    
+    // First benchmark on this machine becomes the baseline
+    if (access(config->bench_baseline, F_OK) != 0) {
+        if (copy_file(results, config->bench_baseline) == 0) {
+            snprintf(msg, sizeof(msg), "Saved as baseline: %s", config->bench_baseline);
+            log_message("INFO", msg);
+        }
+    }
+    
+    return 0;
+}
+
+// Build job queued by the --daemon service
+typedef struct {
+    int id;
+    char args[MAX_CMD_LEN];  // Client options, each NUL-terminated
+    size_t args_len;
+    int waiters[MAX_JOB_WAITERS];
+    int waiter_count;
+    pid_t pid;               // 0 while queued
+} daemon_job_t;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void stop_daemon(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+// Send a status line to every client waiting on a job
+static void notify_job_waiters(daemon_job_t *job, const char *line, int close_fds) {
+    int i;
+    
+    for (i = 0; i < job->waiter_count; i++) {
+        send(job->waiters[i], line, strlen(line), MSG_NOSIGNAL);
+        if (close_fds) {
+            close(job->waiters[i]);
+        }
+    }
+    if (close_fds) {
+        job->waiter_count = 0;
+    }
+}
+
+// Options a submitted job may set. The daemon runs jobs as root, so paths,
+// hosts and the cross-compiler prefix (which reaches a shell verbatim) are
+// left to the daemon's own command line. values lists the accepted values;
+// NULL accepts letters, digits and "._,:+-" only.
+static const struct {
+    const char *name;
+    int takes_value;
+    const char *values;
+} job_options[] = {
+    { "-v", 1, NULL }, { "--version", 1, NULL }, { "-j", 1, NULL }, { "--jobs", 1, NULL },
+    { "--defconfig", 1, NULL }, { "--profile", 1, NULL }, { "--kernel-ref", 1, NULL },
+    { "--compiler-cache", 1, "ccache sccache none" }, { "--compiler-cache-size", 1, NULL },
+    { "--toolchain", 1, "gcc llvm" }, { "--pgo", 1, "instrument" },
+    { "--preempt", 1, "none voluntary full" }, { "--debug-info", 1, "none reduced split" },
+    { "--initramfs-compress", 1, "lz4 zstd gzip xz" }, { "--initramfs-modules", 1, "most dep loaded" },
+    { "--module-compress", 1, "zstd xz none" }, { "--deb-compress", 1, "zstd xz gzip none" },
+    { "--runtime-tune", 1, "performance balanced powersave" }, { "--scratch", 1, "disk auto tmpfs" },
+    { "--apt-ttl", 1, NULL }, { "--zram-swap", 1, NULL },
+    { "-c", 0, NULL }, { "--clean", 0, NULL }, { "--incremental", 0, NULL }, { "--no-install", 0, NULL },
+    { "--single-make", 0, NULL }, { "--parallel-profiles", 0, NULL }, { "--tune-cpu", 0, NULL },
+    { "--no-module-strip", 0, NULL }, { "--deb", 0, NULL }, { "--bundle", 0, NULL },
+    { "--low-memory", 0, NULL }, { "--verbose", 0, NULL }, { "-q", 0, NULL }, { "--quiet", 0, NULL },
+    { "--enable-gpu", 0, NULL }, { "--disable-gpu", 0, NULL }, { "--enable-opencl", 0, NULL },
+    { "--disable-opencl", 0, NULL }, { "--enable-vulkan", 0, NULL }, { "--disable-vulkan", 0, NULL },
+    { "--verify-gpu", 0, NULL },
+    { NULL, 0, NULL }
+};
+
+// Whether value is one of the space-separated words in values, or with no
+// list, a plain token that cannot name a path or carry shell syntax
+static int job_value_allowed(const char *value, const char *values) {
+    size_t len = strlen(value);
+    const char *p;
+    
+    if (len == 0) {
+        return 0;
+    }
+    if (!values) {
+        if (value[0] == '-') {
+            return 0;
+        }
+        for (p = value; *p; p++) {
+            if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+                  strchr("._,:+-", *p))) {
+                return 0;
+            }
+        }
+        return strstr(value, "..") == NULL;
+    }
+    for (p = values; (p = strstr(p, value)) != NULL; p += len) {
+        if ((p == values || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Check a job's options against job_options. Returns 0, or -1 with the
+// reason in error.
+int check_job_options(char *const args[], int count, char *error, size_t size) {
+    int i, k;
+    
+    if (count > MAX_ARGS) {
+        snprintf(error, size, "more than %d arguments", MAX_ARGS);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        for (k = 0; job_options[k].name && strcmp(job_options[k].name, args[i]) != 0; k++) {
+        }
+        if (!job_options[k].name) {
+            snprintf(error, size, "%.64s cannot be set by a submitted job; give it to --daemon instead", args[i]);
+            return -1;
+        }
+        if (!job_options[k].takes_value) {
+            continue;
+        }
+        if (++i == count || !job_value_allowed(args[i], job_options[k].values)) {
+            snprintf(error, size, "invalid value for %s%s%s", job_options[k].name,
+                     job_options[k].values ? " (use " : "", job_options[k].values ? job_options[k].values : "");
+            if (job_options[k].values) {
+                strncat(error, ")", size - strlen(error) - 1);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Read one request: NUL-terminated arguments followed by an empty one
+static int read_job_request(int fd, char *buf, size_t size, size_t *len) {
+    struct timeval timeout = { 2, 0 };
+    ssize_t n;
+    
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    *len = 0;
+    while (*len < size) {
+        n = recv(fd, buf + *len, size - *len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        *len += n;
+        if (buf[*len - 1] == '\0' && (*len == 1 || buf[*len - 2] == '\0')) {
+            (*len)--;
+            return 0;
+        }
     }
+    return -1;
+}
+
+// Run a queued job as a child builder. Every job shares the daemon's build
+// directory and runs with --incremental, so the source tree, object dirs and
+// compiler cache stay warm from one job to the next.
+static int start_daemon_job(daemon_job_t *job, int argc, char *argv[]) {
+    char *child_argv[MAX_ARGS * 2 + 16];
+    char report[MAX_PATH_LEN];
+    char log_path[MAX_PATH_LEN];
+    size_t pos = 0;
+    int k = 0, i, fd;
+    pid_t pid;
     
-    // Update bootloader
-    if (execute_command("u-boot-update", 1) != 0) {
-        log_message("WARNING", "Failed to update u-boot configuration");
+    snprintf(report, sizeof(report), "%s/jobs/%d.json", DAEMON_DIR, job->id);
+    snprintf(log_path, sizeof(log_path), "%s/jobs/%d.log", DAEMON_DIR, job->id);
+    
+    // Daemon options are defaults; the client's come later and win. The
+    // report always goes to the daemon's job directory.
+    child_argv[k++] = "/proc/self/exe";
+    child_argv[k++] = "--build-dir";
+    child_argv[k++] = DAEMON_DIR "/build";
+    for (i = 1; i < argc && k < MAX_ARGS; i++) {
+        if (strcmp(argv[i], "--socket") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--daemon") != 0) {
+            child_argv[k++] = argv[i];
+        }
     }
+    while (pos < job->args_len && k < MAX_ARGS * 2 + 12) {
+        child_argv[k++] = job->args + pos;
+        pos += strlen(job->args + pos) + 1;
+    }
+    child_argv[k++] = "--incremental";
+    child_argv[k++] = "--report";
+    child_argv[k++] = report;
+    child_argv[k] = NULL;
     
-    log_message("SUCCESS", "Kernel installed successfully with Mali GPU support");
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        fd = open("/dev/null", O_RDONLY);
+        if (fd >= 0) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+        execv(child_argv[0], child_argv);
+        _exit(127);
+    }
+    job->pid = pid;
     return 0;
 }
 
-// Verify GPU installation and functionality
-int verify_gpu_installation(void) {
-    log_message("INFO", "Verifying Mali GPU installation...");
+// Accept one client request and queue it, or attach the client to an
+// identical job that has not started yet
+static void accept_job_request(int listen_fd, daemon_job_t *jobs, int *count, int *next_id) {
+    struct ucred cred = { 0 };
+    socklen_t cred_len = sizeof(cred);
+    char request[MAX_CMD_LEN];
+    char line[MAX_CMD_LEN + 64];
+    char error[256];
+    char *args[MAX_ARGS + 1];
+    daemon_job_t *job = NULL;
+    size_t len, pos;
+    int client, argn = 0, i;
     
-    // Check if Mali firmware exists
-    if (access("/lib/firmware/mali_csffw.bin", F_OK) != 0) {
-        log_message("ERROR", "Mali firmware not found");
-        return -1;
+    client = accept(listen_fd, NULL, NULL);
+    if (client < 0) {
+        return;
     }
+    getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len);
     
-    // Check if Mali driver library exists
-    if (access("/usr/lib/libmali-valhall-g610-g6p0-x11-wayland-gbm.so", F_OK) != 0) {
-        log_message("ERROR", "Mali driver library not found");
-        return -1;
+    if (read_job_request(client, request, sizeof(request), &len) != 0) {
+        close(client);
+        return;
+    }
+    for (pos = 0; pos < len && argn <= MAX_ARGS; pos += strlen(request + pos) + 1) {
+        args[argn++] = request + pos;
+    }
+    if (check_job_options(args, argn, error, sizeof(error)) != 0) {
+        snprintf(line, sizeof(line), "Job request from uid %d refused: %s", (int)cred.uid, error);
+        log_message("WARNING", line);
+        snprintf(line, sizeof(line), "error %s\n", error);
+        send(client, line, strlen(line), MSG_NOSIGNAL);
+        close(client);
+        return;
     }
     
-    // Test OpenCL if enabled
-    if (access("/etc/OpenCL/vendors/mali.icd", F_OK) == 0) {
-        log_message("INFO", "Testing OpenCL functionality...");
-        if (execute_command("clinfo 2>/dev/null | grep -i mali", 0) == 0) {
-            log_message("SUCCESS", "OpenCL Mali support detected");
-        } else {
-            log_message("WARNING", "OpenCL Mali support not detected (may need reboot)");
+    for (i = 0; i < *count; i++) {
+        if (jobs[i].pid == 0 && jobs[i].args_len == len && memcmp(jobs[i].args, request, len) == 0 &&
+            jobs[i].waiter_count < MAX_JOB_WAITERS) {
+            job = &jobs[i];
+            break;
+        }
+    }
+    if (!job) {
+        if (*count == MAX_QUEUED_JOBS) {
+            snprintf(line, sizeof(line), "error queue full (%d jobs)\n", MAX_QUEUED_JOBS);
+            send(client, line, strlen(line), MSG_NOSIGNAL);
+            close(client);
+            return;
         }
+        job = &jobs[(*count)++];
+        memset(job, 0, sizeof(*job));
+        job->id = (*next_id)++;
+        memcpy(job->args, request, len);
+        job->args_len = len;
     }
+    job->waiters[job->waiter_count++] = client;
     
-    // Test Vulkan if enabled
-    if (access("/usr/share/vulkan/icd.d/mali.json", F_OK) == 0) {
-        log_message("INFO", "Testing Vulkan functionality...");
-        if (execute_command("vulkaninfo 2>/dev/null | grep -i mali", 0) == 0) {
-            log_message("SUCCESS", "Vulkan Mali support detected");
-        } else {
-            log_message("WARNING", "Vulkan Mali support not detected (may need reboot)");
+    // Log the request with the arguments space-separated
+    for (pos = 0; pos < len; pos++) {
+        if (request[pos] == '\0') {
+            request[pos] = ' ';
         }
     }
+    request[len ? len - 1 : 0] = '\0';
+    snprintf(line, sizeof(line), "Job %d %s by uid %d: %s", job->id,
+             job->waiter_count > 1 ? "joined" : "queued", (int)cred.uid, len ? request : "(defaults)");
+    log_message("INFO", line);
     
-    log_message("SUCCESS", "GPU installation verification completed");
-    return 0;
+    snprintf(line, sizeof(line), "queued %d %d\n", job->id, (int)(job - jobs));
+    send(client, line, strlen(line), MSG_NOSIGNAL);
 }
 
-// Cleanup build artifacts
-int cleanup_build(build_config_t *config) {
-    char cmd[MAX_CMD_LEN];
+// Serve build requests on a local socket, one job at a time so installs
+// never overlap. Identical requests still queued share one build and every
+// waiting client gets its result.
+int run_daemon(const char *socket_path, int argc, char *argv[]) {
+    static daemon_job_t jobs[MAX_QUEUED_JOBS];
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct pollfd pfd;
+    struct group *group;
+    char line[MAX_PATH_LEN * 2 + 64];
+    int count = 0, next_id = 1;
+    int listen_fd, status, i;
     
-    log_message("INFO", "Cleaning up build artifacts...");
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log_message("ERROR", "Daemon socket path is too long");
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    if (create_directory(DAEMON_DIR "/jobs") != 0) {
+        return -1;
+    }
     
-    snprintf(cmd, sizeof(cmd), "rm -rf %s", config->build_dir);
-    if (execute_command(cmd, 0) != 0) {
-        log_message("WARNING", "Failed to cleanup build directory");
+    // Refuse to take over the socket of a daemon that is still running
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    if (connect(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        snprintf(line, sizeof(line), "A build daemon is already listening on %s", socket_path);
+        log_message("ERROR", line);
+        close(listen_fd);
+        return -1;
     }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, MAX_QUEUED_JOBS) != 0) {
+        snprintf(line, sizeof(line), "Cannot listen on %s: %s", socket_path, strerror(errno));
+        log_message("ERROR", line);
+        close(listen_fd);
+        return -1;
+    }
+    // Root and members of the builder group may submit jobs
+    group = getgrnam(DAEMON_GROUP);
+    if (group && chown(socket_path, 0, group->gr_gid) != 0) {
+        log_message("WARNING", "Could not give the daemon socket to group " DAEMON_GROUP);
+    }
+    chmod(socket_path, 0660);
     
-    // Cleanup Mali installation directory
-    if (execute_command("rm -rf /tmp/mali_install", 0) != 0) {
-        log_message("WARNING", "Failed to cleanup Mali install directory");
+    signal(SIGTERM, stop_daemon);
+    signal(SIGINT, stop_daemon);
+    
+    snprintf(line, sizeof(line), "Build daemon listening on %s, state in %s", socket_path, DAEMON_DIR);
+    log_message("INFO", line);
+    
+    while (!daemon_stop) {
+        if (count > 0 && jobs[0].pid == 0) {
+            if (start_daemon_job(&jobs[0], argc, argv) == 0) {
+                snprintf(line, sizeof(line), "Job %d started", jobs[0].id);
+                log_message("INFO", line);
+                snprintf(line, sizeof(line), "started %d\n", jobs[0].id);
+                notify_job_waiters(&jobs[0], line, 0);
+            } else {
+                notify_job_waiters(&jobs[0], "error could not start the build\n", 1);
+                memmove(&jobs[0], &jobs[1], (--count) * sizeof(jobs[0]));
+                continue;
+            }
+        }
+        
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) > 0 && (pfd.revents & POLLIN)) {
+            accept_job_request(listen_fd, jobs, &count, &next_id);
+        }
+        
+        if (count > 0 && jobs[0].pid > 0 && waitpid(jobs[0].pid, &status, WNOHANG) == jobs[0].pid) {
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            snprintf(line, sizeof(line), "Job %d %s (exit status %d)", jobs[0].id,
+                     status == 0 ? "finished" : "failed", status);
+            log_message(status == 0 ? "SUCCESS" : "ERROR", line);
+            snprintf(line, sizeof(line), "done %d %d %s/jobs/%d.log %s/jobs/%d.json\n",
+                     jobs[0].id, status, DAEMON_DIR, jobs[0].id, DAEMON_DIR, jobs[0].id);
+            notify_job_waiters(&jobs[0], line, 1);
+            memmove(&jobs[0], &jobs[1], (--count) * sizeof(jobs[0]));
+        }
     }
     
-    log_message("SUCCESS", "Cleanup completed");
+    log_message("INFO", "Build daemon stopping");
+    if (count > 0 && jobs[0].pid > 0) {
+        kill(-jobs[0].pid, SIGTERM);
+        waitpid(jobs[0].pid, &status, 0);
+    }
+    for (i = 0; i < count; i++) {
+        snprintf(line, sizeof(line), "cancelled %d\n", jobs[i].id);
+        notify_job_waiters(&jobs[i], line, 1);
+    }
+    close(listen_fd);
+    unlink(socket_path);
     return 0;
 }
 
-// Check system dependencies
-int check_dependencies(void) {
-    struct stat st;
+// Queue this build on a running daemon and wait for its result. Exits with
+// the job's status; every option except --submit/--socket goes to the job.
+int submit_build(const char *socket_path, int argc, char *argv[]) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char request[MAX_CMD_LEN];
+    char line[MAX_PATH_LEN * 2 + 64];
+    char log_path[MAX_PATH_LEN];
+    char report[MAX_PATH_LEN];
+    char msg[MAX_PATH_LEN * 2 + 128];
+    char error[256];
+    char *args[MAX_ARGS + 1];
+    size_t len = 0, n;
+    ssize_t sent;
+    int fd, id, position, status = -1, i, argn = 0;
+    FILE *fp;
     
-    // Check if we're on Ubuntu/Debian
-    if (stat("/etc/debian_version", &st) != 0) {
-        log_message("ERROR", "This tool is designed for Ubuntu/Debian systems");
-        return -1;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--submit") == 0) {
+            continue;
+        }
+        if (strcmp(argv[i], "--socket") == 0) {
+            i++;
+            continue;
+        }
+        n = strlen(argv[i]) + 1;
+        // An empty argument ends the request
+        if (n == 1 || len + n + 1 > sizeof(request)) {
+            log_message("ERROR", n == 1 ? "Empty arguments cannot be submitted" : "Build options are too long to submit");
+            return 1;
+        }
+        memcpy(request + len, argv[i], n);
+        len += n;
+        if (argn <= MAX_ARGS) {
+            args[argn++] = argv[i];
+        }
     }
+    request[len++] = '\0';
     
-    // Check architecture
-    FILE *fp = popen("uname -m", "r");
-    if (fp) {
-        char arch[32];
-        if (fgets(arch, sizeof(arch), fp)) {
-            arch[strcspn(arch, "\n")] = '\0';
-            if (strcmp(arch, "aarch64") != 0 && strcmp(arch, "x86_64") != 0) {
-                log_message("WARNING", "Untested architecture detected");
-            }
+    // The daemon applies the same check, but it would resolve a relative
+    // path against its own directory; refuse here with the real reason
+    if (check_job_options(args, argn, error, sizeof(error)) != 0) {
+        snprintf(msg, sizeof(msg), "Cannot submit: %s", error);
+        log_message("ERROR", msg);
+        return 1;
+    }
+    
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log_message("ERROR", "Daemon socket path is too long");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        snprintf(msg, sizeof(msg), "Cannot reach the build daemon at %s: %s", socket_path, strerror(errno));
+        log_message("ERROR", msg);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    for (n = 0; n < len; n += sent) {
+        sent = send(fd, request + n, len - n, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            log_message("ERROR", "Lost the connection to the build daemon");
+            close(fd);
+            return 1;
         }
-        pclose(fp);
     }
     
-    // Check available disk space (at least 10GB recommended)
-    fp = popen("df /tmp | tail -1 | awk '{print $4}'", "r");
-    if (fp) {
-        char space[32];
-        if (fgets(space, sizeof(space), fp)) {
-            long available_kb = atol(space);
-            if (available_kb < 10485760) { // 10GB in KB
-                log_message("WARNING", "Less than 10GB free space available in /tmp");
-            }
+    fp = fdopen(fd, "r");
+    while (fp && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "queued %d %d", &id, &position) == 2) {
+            snprintf(msg, sizeof(msg), position > 0 ? "Queued as job %d, %d ahead of it" : "Queued as job %d",
+                     id, position);
+            log_message("INFO", msg);
+        } else if (sscanf(line, "started %d", &id) == 1) {
+            snprintf(msg, sizeof(msg), "Job %d started", id);
+            log_message("INFO", msg);
+        } else if (sscanf(line, "done %d %d %511s %511[^\n]", &id, &status, log_path, report) == 4) {
+            snprintf(msg, sizeof(msg), "Job %d %s (exit status %d)", id, status == 0 ? "finished" : "failed", status);
+            log_message(status == 0 ? "SUCCESS" : "ERROR", msg);
+            snprintf(msg, sizeof(msg), "Log: %s", log_path);
+            log_message("INFO", msg);
+            snprintf(msg, sizeof(msg), "Report: %s", report);
+            log_message("INFO", msg);
+            break;
+        } else if (sscanf(line, "cancelled %d", &id) == 1) {
+            snprintf(msg, sizeof(msg), "Job %d was cancelled: the build daemon stopped", id);
+            log_message("ERROR", msg);
+            status = 1;
+            break;
+        } else if (strncmp(line, "error ", 6) == 0) {
+            snprintf(msg, sizeof(msg), "Build daemon rejected the job: %s", line + 6);
+            log_message("ERROR", msg);
+            status = 1;
+            break;
         }
-        pclose(fp);
+    }
+    if (fp) {
+        fclose(fp);
+    } else {
+        close(fd);
     }
     
-    return 0;
+    if (status < 0) {
+        log_message("ERROR", "Build daemon closed the connection without a result");
+        return 1;
+    }
+    return status;
 }
 
 // Print program header
@@ -833,21 +8063,68 @@ void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n\n", program_name);
     printf("Options:\n");
     printf("  -v, --version <version>    Kernel version to build (default: 6.8.0)\n");
-    printf("  -j, --jobs <number>        Number of parallel jobs (default: CPU cores)\n");
+    printf("  -j, --jobs <number|auto>   Number of parallel jobs (default: CPU cores)\n");
+    printf("                             'auto' sizes -j/-l from topology, cgroup quota, RAM and load\n");
     printf("  -d, --build-dir <path>     Build directory (default: /tmp/kernel_build)\n");
+    printf("  --cache-dir <path>        Persistent source cache (default: /var/cache/builder)\n");
     printf("  -c, --clean               Clean build (remove previous artifacts)\n");
     printf("  --defconfig <config>      Defconfig to use (default: rockchip_linux_defconfig)\n");
     printf("  --cross-compile <prefix>  Cross-compiler prefix (default: aarch64-linux-gnu-)\n");
+    printf("  --compiler-cache <tool>   Compiler cache: ccache, sccache or none (default: none)\n");
+    printf("  --compiler-cache-dir <p>  Compiler cache directory (default: <cache-dir>/<tool>)\n");
+    printf("  --compiler-cache-size <s> Compiler cache size limit (default: 20G)\n");
+    printf("  --single-make             Build Image, dtbs and modules in one make invocation\n");
+    printf("  --profile <a[,b]>         Kernel profiles: desktop, server, performance (default: desktop)\n");
+    printf("                             Each builds in <build-dir>/out/<profile>; the first is installed\n");
+    printf("  --parallel-profiles       Build several profiles at once, splitting the job count\n");
+    printf("  --config-fragment <file>  Extra Kconfig fragment merged after the profile's (repeatable)\n");
+    printf("  --preempt <model>         Preemption model: none, voluntary or full\n");
+    printf("  --debug-info <mode>       Kernel debug info: none, reduced or split (default: defconfig)\n");
+    printf("  --tune-cpu                Compile with KCFLAGS=%s\n", TUNE_CPU_FLAGS);
+    printf("  --initramfs-compress <c>  Initramfs compressor: lz4, zstd, gzip or xz (default: system)\n");
+    printf("  --initramfs-modules <m>   Initramfs modules: most, dep or loaded (only modules loaded now)\n");
+    printf("  --module-compress <type>  Installed module compression: zstd, xz or none (default: zstd)\n");
+    printf("  --no-module-strip         Install modules with their debug info\n");
+    printf("  --deb                     Build kernel .deb packages (bindeb-pkg) and install them with dpkg\n");
+    printf("  --deb-compress <type>     Package compression: zstd, xz, gzip or none (default: zstd)\n");
+    printf("  --bundle                  Package the kernel as a versioned bundle in <build-dir>/%s\n", BUNDLE_DIR);
+    printf("  --deploy <hosts|@file>    Install the bundle on these boards over ssh/rsync instead of locally\n");
+    printf("  --deploy-jobs <n>         Boards installed concurrently (default: %d)\n", DEFAULT_DEPLOY_JOBS);
+    printf("  --distributed <tool>      Distribute compiles with distcc or icecc\n");
+    printf("  --build-hosts <list>      Compile hosts: host[:port][/slots],... (default slots: %d)\n", DEFAULT_HOST_SLOTS);
+    printf("  --apt-ttl <hours>         Skip apt update when package lists are newer (default: %d)\n", APT_TTL_HOURS);
+    printf("  --scratch <mode>          Object directory placement: disk, auto, tmpfs or a path (default: disk)\n");
+    printf("  --low-memory             Fit a native build into 4 GB: fewer module link jobs, no BTF, peak memory report\n");
+    printf("  --zram-swap <MB|auto>    Add zstd zram swap for the build, removed afterwards (auto: half the RAM)\n");
+    printf("  --toolchain <gcc|llvm>    Kernel compiler; llvm builds with LLVM=1 and ThinLTO (default: gcc)\n");
+    printf("  --pgo <instrument|use>    Two-phase Clang AutoFDO build (requires --toolchain llvm)\n");
+    printf("  --pgo-profile <file>      AutoFDO profile for --pgo use\n");
     printf("  --verbose                 Verbose output\n");
+    printf("  -q, --quiet               Only show stage progress, warnings and errors (the log keeps everything)\n");
     printf("  --no-install             Build only, don't install\n");
     printf("  --cleanup                Cleanup build directory after completion\n");
+    printf("  --incremental            Skip pipeline stages whose inputs are unchanged\n");
     printf("  --enable-gpu             Install Mali G610 GPU blobs and drivers (default: on)\n");
     printf("  --disable-gpu            Skip Mali GPU blob installation\n");
     printf("  --enable-opencl          Enable OpenCL support for Mali GPU (default: on)\n");
     printf("  --disable-opencl         Disable OpenCL support\n");
     printf("  --enable-vulkan          Enable Vulkan support for Mali GPU (default: on)\n");
     printf("  --disable-vulkan         Disable Vulkan support\n");
+    printf("  --blob-manifest <file>   SHA-256 pins for Mali blobs (default: <cache-dir>/mali-blobs.sha256)\n");
+    printf("  --record-blob-pins       Pin Mali blobs that have no pin yet to what this run downloads\n");
+    printf("  --report <file>          JSON timing/resource report (default: <build-dir>/build-report.json)\n");
+    printf("  --kernel-ref <ref>       Build this branch, tag or commit of the Rockchip kernel\n");
+    printf("  --bench <runs>           Benchmark cold, warm and no-op builds <runs> times each\n");
+    printf("  --bench-baseline <file>  Baseline to compare against (default: <cache-dir>/bench-baseline.tsv)\n");
     printf("  --verify-gpu             Verify GPU installation after completion\n");
+    printf("  --runtime-tune <profile> Install a boot-time cpufreq/devfreq/IRQ profile: performance, balanced or powersave\n");
+    printf("  --gpu-bench              Benchmark OpenCL/Vulkan on the running system against a baseline, then exit\n");
+    printf("  --gpu-baseline <file>    GPU benchmark baseline (default: <cache-dir>/%s)\n", GPU_BASELINE);
+    printf("  --artifact-cache <dir>   Built kernels by input hash, may be shared; none to disable (default: <cache-dir>/%s)\n",
+           ARTIFACT_CACHE_DIR);
+    printf("  --daemon                 Serve queued builds on a local socket with warm state in %s\n", DAEMON_DIR);
+    printf("  --submit                 Queue this build on the daemon and wait for its result\n");
+    printf("  --socket <path>          Daemon socket (default: %s)\n", DAEMON_SOCKET);
     printf("  -h, --help               Show this help\n\n");
     printf("Examples:\n");
     printf("  %s                                    # Build with all defaults (GPU enabled)\n", program_name);
@@ -868,20 +8145,39 @@ int main(int argc, char *argv[]) {
     build_config_t config = {
         .kernel_version = "6.8.0",
         .build_dir = BUILD_DIR,
+        .cache_dir = CACHE_DIR,
         .cross_compile = "aarch64-linux-gnu-",
         .arch = "arm64",
         .defconfig = "rockchip_linux_defconfig",
         .jobs = 0,
+        .load_limit = 0,
         .verbose = 0,
         .clean_build = 0,
         .install_gpu_blobs = 1,  // Enable GPU by default
         .enable_opencl = 1,      // Enable OpenCL by default
-        .enable_vulkan = 1       // Enable Vulkan by default
+        .enable_vulkan = 1,      // Enable Vulkan by default
+        .incremental = 0,
+        .compiler_cache = "none",
+        .compiler_cache_dir = "",
+        .compiler_cache_size = "20G",
+        .single_make = 0,
+        .blob_manifest = "",
+        .toolchain = "gcc",
+        .scratch = "disk",
+        .apt_ttl_hours = APT_TTL_HOURS,
+        .deploy_jobs = DEFAULT_DEPLOY_JOBS,
+        .deb_compress = "zstd",
+        .module_strip = 1,
+        .module_compress = "zstd"
     };
     
     int no_install = 0;
     int cleanup = 0;
     int verify_gpu = 0;
+    int gpu_bench = 0;
+    int daemon_mode = 0;
+    int submit = 0;
+    char daemon_socket[MAX_PATH_LEN] = DAEMON_SOCKET;
     int i;
     
     print_header();
@@ -897,12 +8193,16 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
             if (++i < argc) {
-                config.jobs = atoi(argv[i]);
+                config.jobs = strcmp(argv[i], "auto") == 0 ? JOBS_AUTO : atoi(argv[i]);
             }
         } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--build-dir") == 0) {
             if (++i < argc) {
                 strncpy(config.build_dir, argv[i], sizeof(config.build_dir) - 1);
             }
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            if (++i < argc) {
+                strncpy(config.cache_dir, argv[i], sizeof(config.cache_dir) - 1);
+            }
         } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--clean") == 0) {
             config.clean_build = 1;
         } else if (strcmp(argv[i], "--defconfig") == 0) {
@@ -913,12 +8213,133 @@ int main(int argc, char *argv[]) {
             if (++i < argc) {
                 strncpy(config.cross_compile, argv[i], sizeof(config.cross_compile) - 1);
             }
+        } else if (strcmp(argv[i], "--compiler-cache") == 0) {
+            if (++i < argc) {
+                strncpy(config.compiler_cache, argv[i], sizeof(config.compiler_cache) - 1);
+            }
+        } else if (strcmp(argv[i], "--compiler-cache-dir") == 0) {
+            if (++i < argc) {
+                strncpy(config.compiler_cache_dir, argv[i], sizeof(config.compiler_cache_dir) - 1);
+            }
+        } else if (strcmp(argv[i], "--compiler-cache-size") == 0) {
+            if (++i < argc) {
+                strncpy(config.compiler_cache_size, argv[i], sizeof(config.compiler_cache_size) - 1);
+            }
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            if (++i < argc) {
+                strncpy(config.profiles, argv[i], sizeof(config.profiles) - 1);
+            }
+        } else if (strcmp(argv[i], "--config-fragment") == 0) {
+            if (++i < argc && config.user_fragment_count < MAX_USER_FRAGMENTS) {
+                // make runs from the object directory, so keep paths absolute
+                if (!realpath(argv[i], config.user_fragments[config.user_fragment_count])) {
+                    fprintf(stderr, "Config fragment not found: %s\n", argv[i]);
+                    return 1;
+                }
+                config.user_fragment_count++;
+            }
+        } else if (strcmp(argv[i], "--preempt") == 0) {
+            if (++i < argc) {
+                char fragment_name[48];
+                int k;
+                snprintf(fragment_name, sizeof(fragment_name), "preempt-%s", argv[i]);
+                for (k = 0; preempt_fragments[k].name && strcmp(preempt_fragments[k].name, fragment_name) != 0; k++) {
+                }
+                if (!preempt_fragments[k].name) {
+                    fprintf(stderr, "Unknown preemption model: %s (use none, voluntary or full)\n", argv[i]);
+                    return 1;
+                }
+                config.preempt = &preempt_fragments[k];
+            }
+        } else if (strcmp(argv[i], "--debug-info") == 0) {
+            if (++i < argc) {
+                char fragment_name[48];
+                int k;
+                snprintf(fragment_name, sizeof(fragment_name), "debug-%s", argv[i]);
+                for (k = 0; debug_info_fragments[k].name &&
+                            strcmp(debug_info_fragments[k].name, fragment_name) != 0; k++) {
+                }
+                if (!debug_info_fragments[k].name) {
+                    fprintf(stderr, "Unknown debug info mode: %s (use none, reduced or split)\n", argv[i]);
+                    return 1;
+                }
+                config.debug_info = &debug_info_fragments[k];
+            }
+        } else if (strcmp(argv[i], "--initramfs-compress") == 0) {
+            if (++i < argc) {
+                strncpy(config.initramfs_compress, argv[i], sizeof(config.initramfs_compress) - 1);
+            }
+        } else if (strcmp(argv[i], "--initramfs-modules") == 0) {
+            if (++i < argc) {
+                strncpy(config.initramfs_modules, argv[i], sizeof(config.initramfs_modules) - 1);
+            }
+        } else if (strcmp(argv[i], "--module-compress") == 0) {
+            if (++i < argc) {
+                strncpy(config.module_compress, argv[i], sizeof(config.module_compress) - 1);
+            }
+        } else if (strcmp(argv[i], "--no-module-strip") == 0) {
+            config.module_strip = 0;
+        } else if (strcmp(argv[i], "--deb") == 0) {
+            config.deb = 1;
+        } else if (strcmp(argv[i], "--deb-compress") == 0) {
+            if (++i < argc) {
+                strncpy(config.deb_compress, argv[i], sizeof(config.deb_compress) - 1);
+            }
+        } else if (strcmp(argv[i], "--bundle") == 0) {
+            config.bundle = 1;
+        } else if (strcmp(argv[i], "--deploy") == 0) {
+            if (++i < argc) {
+                strncpy(config.deploy_hosts, argv[i], sizeof(config.deploy_hosts) - 1);
+            }
+        } else if (strcmp(argv[i], "--deploy-jobs") == 0) {
+            if (++i < argc) {
+                config.deploy_jobs = atoi(argv[i]) > 0 ? atoi(argv[i]) : 1;
+            }
+        } else if (strcmp(argv[i], "--distributed") == 0) {
+            if (++i < argc) {
+                strncpy(config.distributed, argv[i], sizeof(config.distributed) - 1);
+            }
+        } else if (strcmp(argv[i], "--build-hosts") == 0) {
+            if (++i < argc) {
+                strncpy(config.build_hosts_spec, argv[i], sizeof(config.build_hosts_spec) - 1);
+            }
+        } else if (strcmp(argv[i], "--apt-ttl") == 0) {
+            if (++i < argc) {
+                config.apt_ttl_hours = atof(argv[i]);
+            }
+        } else if (strcmp(argv[i], "--scratch") == 0) {
+            if (++i < argc) {
+                strncpy(config.scratch, argv[i], sizeof(config.scratch) - 1);
+            }
+        } else if (strcmp(argv[i], "--toolchain") == 0) {
+            if (++i < argc) {
+                strncpy(config.toolchain, argv[i], sizeof(config.toolchain) - 1);
+            }
+        } else if (strcmp(argv[i], "--pgo") == 0) {
+            if (++i < argc) {
+                strncpy(config.pgo, argv[i], sizeof(config.pgo) - 1);
+            }
+        } else if (strcmp(argv[i], "--pgo-profile") == 0) {
+            if (++i < argc && !realpath(argv[i], config.pgo_profile)) {
+                fprintf(stderr, "PGO profile not found: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tune-cpu") == 0) {
+            config.tune_cpu = 1;
+        } else if (strcmp(argv[i], "--parallel-profiles") == 0) {
+            config.parallel_profiles = 1;
+        } else if (strcmp(argv[i], "--single-make") == 0) {
+            config.single_make = 1;
         } else if (strcmp(argv[i], "--verbose") == 0) {
             config.verbose = 1;
+        } else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0) {
+            log_set_quiet(1);
         } else if (strcmp(argv[i], "--no-install") == 0) {
             no_install = 1;
         } else if (strcmp(argv[i], "--cleanup") == 0) {
             cleanup = 1;
+        } else if (strcmp(argv[i], "--incremental") == 0) {
+            config.incremental = 1;
         } else if (strcmp(argv[i], "--enable-gpu") == 0) {
             config.install_gpu_blobs = 1;
         } else if (strcmp(argv[i], "--disable-gpu") == 0) {
@@ -933,25 +8354,167 @@ int main(int argc, char *argv[]) {
             config.enable_vulkan = 1;
         } else if (strcmp(argv[i], "--disable-vulkan") == 0) {
             config.enable_vulkan = 0;
+        } else if (strcmp(argv[i], "--blob-manifest") == 0) {
+            if (++i < argc) {
+                strncpy(config.blob_manifest, argv[i], sizeof(config.blob_manifest) - 1);
+            }
+        } else if (strcmp(argv[i], "--record-blob-pins") == 0) {
+            config.record_blob_pins = 1;
+        } else if (strcmp(argv[i], "--kernel-ref") == 0) {
+            if (++i < argc) {
+                strncpy(config.kernel_ref, argv[i], sizeof(config.kernel_ref) - 1);
+            }
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            if (++i < argc) {
+                config.bench_runs = atoi(argv[i]);
+            }
+        } else if (strcmp(argv[i], "--bench-baseline") == 0) {
+            if (++i < argc) {
+                strncpy(config.bench_baseline, argv[i], sizeof(config.bench_baseline) - 1);
+            }
+        } else if (strcmp(argv[i], "--report") == 0) {
+            if (++i < argc) {
+                strncpy(config.report_file, argv[i], sizeof(config.report_file) - 1);
+            }
         } else if (strcmp(argv[i], "--verify-gpu") == 0) {
             verify_gpu = 1;
+        } else if (strcmp(argv[i], "--low-memory") == 0) {
+            config.low_memory = 1;
+        } else if (strcmp(argv[i], "--zram-swap") == 0) {
+            if (++i < argc) {
+                strncpy(config.zram_swap, argv[i], sizeof(config.zram_swap) - 1);
+            }
+        } else if (strcmp(argv[i], "--runtime-tune") == 0) {
+            if (++i < argc) {
+                strncpy(config.runtime_tune, argv[i], sizeof(config.runtime_tune) - 1);
+            }
+        } else if (strcmp(argv[i], "--gpu-bench") == 0) {
+            gpu_bench = 1;
+        } else if (strcmp(argv[i], "--artifact-cache") == 0) {
+            if (++i < argc) {
+                strncpy(config.artifact_cache, argv[i], sizeof(config.artifact_cache) - 1);
+            }
+        } else if (strcmp(argv[i], "--gpu-baseline") == 0) {
+            if (++i < argc) {
+                strncpy(config.gpu_baseline, argv[i], sizeof(config.gpu_baseline) - 1);
+            }
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "--submit") == 0) {
+            submit = 1;
+        } else if (strcmp(argv[i], "--socket") == 0) {
+            if (++i < argc) {
+                strncpy(daemon_socket, argv[i], sizeof(daemon_socket) - 1);
+            }
         }
     }
     
+    if (strcmp(config.toolchain, "gcc") != 0 && strcmp(config.toolchain, "llvm") != 0) {
+        fprintf(stderr, "Unknown toolchain: %s (use gcc or llvm)\n", config.toolchain);
+        return 1;
+    }
+    if (config.pgo[0] && strcmp(config.pgo, "instrument") != 0 && strcmp(config.pgo, "use") != 0) {
+        fprintf(stderr, "Unknown PGO phase: %s (use instrument or use)\n", config.pgo);
+        return 1;
+    }
+    if (config.pgo[0] && strcmp(config.toolchain, "llvm") != 0) {
+        fprintf(stderr, "--pgo requires --toolchain llvm\n");
+        return 1;
+    }
+    if (strcmp(config.pgo, "use") == 0 && config.pgo_profile[0] == '\0') {
+        fprintf(stderr, "--pgo use requires --pgo-profile <file>\n");
+        return 1;
+    }
+    
+    if (config.initramfs_compress[0] && strcmp(config.initramfs_compress, "lz4") != 0 &&
+        strcmp(config.initramfs_compress, "zstd") != 0 && strcmp(config.initramfs_compress, "gzip") != 0 &&
+        strcmp(config.initramfs_compress, "xz") != 0) {
+        fprintf(stderr, "Unknown initramfs compression: %s (use lz4, zstd, gzip or xz)\n", config.initramfs_compress);
+        return 1;
+    }
+    if (config.initramfs_modules[0] && strcmp(config.initramfs_modules, "most") != 0 &&
+        strcmp(config.initramfs_modules, "dep") != 0 && strcmp(config.initramfs_modules, "loaded") != 0) {
+        fprintf(stderr, "Unknown initramfs module set: %s (use most, dep or loaded)\n", config.initramfs_modules);
+        return 1;
+    }
+    if (config.runtime_tune[0] && strcmp(config.runtime_tune, "performance") != 0 &&
+        strcmp(config.runtime_tune, "balanced") != 0 && strcmp(config.runtime_tune, "powersave") != 0) {
+        fprintf(stderr, "Unknown tuning profile: %s (use performance, balanced or powersave)\n", config.runtime_tune);
+        return 1;
+    }
+    if (strcmp(config.module_compress, "zstd") != 0 && strcmp(config.module_compress, "xz") != 0 &&
+        strcmp(config.module_compress, "none") != 0) {
+        fprintf(stderr, "Unknown module compression: %s (use zstd, xz or none)\n", config.module_compress);
+        return 1;
+    }
+    if (strcmp(config.deb_compress, "zstd") != 0 && strcmp(config.deb_compress, "xz") != 0 &&
+        strcmp(config.deb_compress, "gzip") != 0 && strcmp(config.deb_compress, "none") != 0) {
+        fprintf(stderr, "Unknown package compression: %s (use zstd, xz, gzip or none)\n", config.deb_compress);
+        return 1;
+    }
+    if (config.distributed[0] && strcmp(config.distributed, "distcc") != 0 &&
+        strcmp(config.distributed, "icecc") != 0) {
+        fprintf(stderr, "Unknown distributed compiler: %s (use distcc or icecc)\n", config.distributed);
+        return 1;
+    }
+    if (config.distributed[0] && config.build_hosts_spec[0] == '\0') {
+        fprintf(stderr, "--distributed requires --build-hosts <host[/slots],...>\n");
+        return 1;
+    }
+    if (config.zram_swap[0] && strcmp(config.zram_swap, "auto") != 0 && atol(config.zram_swap) <= 0) {
+        fprintf(stderr, "Invalid zram swap size: %s (use MB or auto)\n", config.zram_swap);
+        return 1;
+    }
+    
+    snprintf(config.scratch_root, sizeof(config.scratch_root), "%s/%s", config.build_dir, OBJ_DIR);
+    if (config.artifact_cache[0] == '\0') {
+        snprintf(config.artifact_cache, sizeof(config.artifact_cache), "%s/%s", config.cache_dir, ARTIFACT_CACHE_DIR);
+    }
+    if (parse_profiles(&config) != 0) {
+        return 1;
+    }
+    
     // Set default number of jobs to CPU cores
-    if (config.jobs == 0) {
+    if (config.jobs == JOBS_AUTO) {
+        auto_tune_jobs(&config);
+    } else if (config.jobs <= 0) {
         config.jobs = sysconf(_SC_NPROCESSORS_ONLN);
     }
     
+    if (config.low_memory) {
+        apply_low_memory(&config);
+    }
+    
     // Check dependencies and permissions
     if (check_dependencies() != 0) {
         return 1;
     }
     
+    // Measures the running system; nothing is built
+    if (gpu_bench) {
+        return run_gpu_benchmark(&config) == 0 ? 0 : 1;
+    }
+    
+    // The daemon runs the build; submit_build checks what a job may set
+    if (submit) {
+        return submit_build(daemon_socket, argc, argv);
+    }
+    
     if (check_root_permissions() != 0) {
         return 1;
     }
     
+    if (daemon_mode) {
+        return run_daemon(daemon_socket, argc, argv) == 0 ? 0 : 1;
+    }
+    
+    if (config.bench_runs == 0 && setup_scratch(&config) != 0) {
+        return 1;
+    }
+    if (config.bench_runs == 0) {
+        setup_zram_swap(&config);
+    }
+    
     // Build process
     log_message("INFO", "Starting Orange Pi 5 Plus kernel build process with Mali GPU support");
     
@@ -959,64 +8522,59 @@ int main(int argc, char *argv[]) {
     printf("\n%s%sBuild Configuration:%s\n", COLOR_BOLD, COLOR_YELLOW, COLOR_RESET);
     printf("  Kernel Version: %s\n", config.kernel_version);
     printf("  Build Directory: %s\n", config.build_dir);
-    printf("  Parallel Jobs: %d\n", config.jobs);
+    printf("  Source Cache: %s\n", config.cache_dir);
+    if (config.load_limit > 0) {
+        printf("  Parallel Jobs: %d (load limit %.1f)\n", config.jobs, config.load_limit);
+    } else {
+        printf("  Parallel Jobs: %d\n", config.jobs);
+    }
     printf("  Mali GPU Support: %s\n", config.install_gpu_blobs ? "Enabled" : "Disabled");
     printf("  OpenCL Support: %s\n", config.enable_opencl ? "Enabled" : "Disabled");
     printf("  Vulkan Support: %s\n", config.enable_vulkan ? "Enabled" : "Disabled");
     printf("  Clean Build: %s\n", config.clean_build ? "Yes" : "No");
-    printf("\n");
-    
-    if (setup_build_environment() != 0) {
-        goto error;
+    printf("  Incremental: %s\n", config.incremental ? "Yes" : "No");
+    printf("  Compiler Cache: %s\n", config.compiler_cache);
+    printf("  Artifact Cache: %s\n", config.artifact_cache);
+    if (config.distributed[0]) {
+        printf("  Distributed: %s (%s)\n", config.distributed, config.build_hosts_spec);
     }
-    
-    if (install_prerequisites() != 0) {
-        goto error;
+    printf("  Toolchain: %s%s%s\n", config.toolchain,
+           strcmp(config.toolchain, "llvm") == 0 ? " (ThinLTO)" : "",
+           strcmp(config.pgo, "instrument") == 0 ? ", AutoFDO phase 1" :
+           strcmp(config.pgo, "use") == 0 ? ", AutoFDO phase 2" : "");
+    printf("  Profiles: %s%s\n", config.profiles[0] ? config.profiles : config.profile->name,
+           config.profile_count > 1 ? (config.parallel_profiles ? " (parallel)" : " (sequential)") : "");
+    printf("  Object Directory: %s/<profile>%s\n", config.scratch_root, config.scratch_tmpfs ? " (tmpfs)" : "");
+    if (config.preempt || config.tune_cpu) {
+        printf("  Tuning: %s%s%s\n", config.preempt ? config.preempt->name : "",
+               config.preempt && config.tune_cpu ? ", " : "",
+               config.tune_cpu ? "KCFLAGS=" TUNE_CPU_FLAGS : "");
     }
-    
-    // Download and install Mali GPU blobs if enabled
-    if (config.install_gpu_blobs) {
-        if (download_mali_blobs(&config) != 0) {
-            goto error;
-        }
-        
-        if (install_mali_drivers(&config) != 0) {
-            goto error;
-        }
-        
-        if (setup_opencl_support(&config) != 0) {
-            goto error;
-        }
-        
-        if (setup_vulkan_support(&config) != 0) {
-            goto error;
-        }
+    if (config.debug_info) {
+        printf("  Debug Info: %s\n", config.debug_info->name + strlen("debug-"));
     }
-    
-    if (download_kernel_source(&config) != 0) {
-        goto error;
+    if (config.low_memory) {
+        printf("  Low Memory: module links -j%d, BTF off%s%s\n", config.link_jobs,
+               config.zram_device[0] ? ", zram swap " : "", config.zram_device);
     }
+    printf("\n");
     
-    download_ubuntu_rockchip_patches(); // Non-critical
-    
-    if (configure_kernel(&config) != 0) {
+    if (prepare_build_directory(&config) != 0) {
         goto error;
     }
     
-    if (build_kernel(&config) != 0) {
-        goto error;
+    if (config.bench_runs > 0) {
+        return run_benchmark(&config, argc, argv) == 0 ? 0 : 1;
     }
     
-    if (!no_install) {
-        if (install_kernel(&config) != 0) {
-            goto error;
-        }
-        
-        // Verify GPU installation if requested
-        if (verify_gpu && config.install_gpu_blobs) {
-            verify_gpu_installation();
-        }
+    load_stage_manifest(&config);
+    
+    if (run_pipeline(&config, no_install, verify_gpu) != 0) {
+        finish_build_host_monitor(&config);
+        goto error;
     }
+    finish_build_host_monitor(&config);
+    remove_zram_swap(&config);
     
     if (cleanup) {
         cleanup_build(&config);
@@ -1024,6 +8582,8 @@ int main(int argc, char *argv[]) {
     
     log_message("SUCCESS", "Kernel build process completed successfully!");
     
+    print_compiler_cache_summary(&config, &compiler_cache_baseline);
+    
     printf("\n%s%sNext steps:%s\n", COLOR_BOLD, COLOR_GREEN, COLOR_RESET);
     printf("1. Reboot your Orange Pi 5 Plus\n");
     printf("2. Select the new kernel from the boot menu\n");
@@ -1043,17 +8603,20 @@ int main(int argc, char *argv[]) {
         printf("• Check EGL: eglinfo | grep -i mali\n");
         printf("• GPU memory: cat /sys/kernel/debug/dri/*/gpu_memory\n");
         printf("• GPU load: cat /sys/class/devfreq/fb000000.gpu/load\n");
+        printf("• GPU benchmark: builder --gpu-bench\n");
+    }
+    if (config.runtime_tune[0]) {
+        printf("\nRuntime tuning (%s) is applied at boot by %s\n", config.runtime_tune, TUNE_SERVICE);
     }
     
     printf("\n");
     
-    if (log_fp) {
-        fclose(log_fp);
-    }
+    log_close();
     
     return 0;
     
 error:
+    remove_zram_swap(&config);
     log_message("ERROR", "Kernel build process failed!");
     printf("\n%s%sTroubleshooting:%s\n", COLOR_BOLD, COLOR_RED, COLOR_RESET);
     printf("• Check the build log: %s\n", LOG_FILE);
@@ -1062,8 +8625,6 @@ error:
     printf("• Try running with --clean flag\n");
     printf("• For GPU issues, try --disable-gpu flag\n");
     
-    if (log_fp) {
-        fclose(log_fp);
-    }
+    log_close();
     return 1;
 }
@@ -1,15 +1,20 @@
 
 // Orange Pi 5 Plus Cross-Platform Installer
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/utsname.h>
 #include <errno.h>
 #include <time.h>
 #include <dirent.h>
+#include <spawn.h>
 
 #define VERSION "1.0.0"
 #define INSTALLER_NAME "installer"
@@ -17,6 +22,9 @@
 #define MAX_CMD_LEN 2048
 #define MAX_PATH_LEN 512
 #define MAX_LINE_LEN 1024
+#define MAX_ARGS 64
+#define PREBUILT_DIR "prebuilt" // <source-dir>/prebuilt/builder-<arch>[.sha256], see make prebuilt
+#define BUILD_STAMP ".builder-build" // Inputs and SHA-256 of the binary the installer last compiled
 
 // Color codes for cross-platform output
 #define COLOR_RESET   "\033[0m"
@@ -35,13 +43,26 @@ typedef struct {
     int skip_shell;
     int verbose;
     int force_install;
+    int prebuilt;
 } installer_config_t;
 
+// Incremental SHA-256 state
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t used;
+} sha256_ctx_t;
+
 // Function prototypes
 int execute_command(const char *cmd, int show_output);
+int run_command(char *const argv[]);
 int check_system_requirements(void);
 int check_root_permissions(void);
+int find_in_path(const char *name);
 int detect_package_manager(char *pm_name, size_t size);
+int build_tools_present(void);
+int use_prebuilt_builder(installer_config_t *config);
 int install_build_dependencies(const char *package_manager);
 int compile_kernel_builder(installer_config_t *config);
 int install_kernel_builder(installer_config_t *config);
@@ -55,6 +76,10 @@ void log_message(const char *level, const char *message);
 int create_directory(const char *path);
 int file_exists(const char *path);
 int copy_file(const char *src, const char *dest);
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const unsigned char *data, size_t len);
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[32]);
+int sha256_file(const char *path, char *hex);
 int write_file(const char *path, const char *content);
 char* get_current_directory(void);
 int check_disk_space(const char *path, long required_mb);
@@ -86,15 +111,116 @@ void log_message(const char *level, const char *message) {
     }
 }
 
-// Cross-platform command execution
+// Run argv directly (no shell), copying its stdout/stderr to the terminal
+// and the install log. Returns the exit status, 128+signal if it was
+// killed, or -1 if it could not be started.
+int run_command(char *const argv[]) {
+    posix_spawn_file_actions_t actions;
+    struct timespec start, end;
+    char buffer[4096];
+    char msg[MAX_PATH_LEN];
+    ssize_t bytes;
+    pid_t pid;
+    int pipefd[2];
+    int status, err;
+    
+    if (pipe(pipefd) != 0) {
+        log_message("ERROR", "Failed to create command output pipe");
+        return -1;
+    }
+    
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+    
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+    
+    if (err != 0) {
+        close(pipefd[0]);
+        snprintf(msg, sizeof(msg), "Failed to start %s: %s", argv[0], strerror(err));
+        log_message("ERROR", msg);
+        return -1;
+    }
+    
+    while ((bytes = read(pipefd[0], buffer, sizeof(buffer))) != 0) {
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        fwrite(buffer, 1, bytes, stdout);
+        fflush(stdout);
+        if (log_fp) {
+            fwrite(buffer, 1, bytes, log_fp);
+        }
+    }
+    close(pipefd[0]);
+    
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            log_message("ERROR", "Failed to wait for command");
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    if (WIFEXITED(status)) {
+        status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        status = 128 + WTERMSIG(status);
+    }
+    
+    if (log_fp) {
+        fprintf(log_fp, "[exit %d after %.1fs] %s\n", status,
+                (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, argv[0]);
+        fflush(log_fp);
+    }
+    
+    return status;
+}
+
+// Cross-platform command execution. Plain commands are spawned directly;
+// anything using shell syntax goes through /bin/sh -c.
 int execute_command(const char *cmd, int show_output) {
+    char buffer[MAX_CMD_LEN];
+    char *argv[MAX_ARGS];
+    const char *first_space;
+    char *token;
+    int argc = 0;
     int result;
     
     if (show_output) {
         printf("%s%s%s\n", COLOR_BLUE, cmd, COLOR_RESET);
     }
     
-    result = system(cmd);
+    // Shell metacharacters, or a leading VAR=value assignment
+    first_space = strpbrk(cmd, " \t");
+    if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]{}~#\n") ||
+        (strchr(cmd, '=') && (!first_space || strchr(cmd, '=') < first_space)) ||
+        strlen(cmd) >= sizeof(buffer)) {
+        argv[argc++] = "/bin/sh";
+        argv[argc++] = "-c";
+        argv[argc++] = (char *)cmd;
+    } else {
+        strcpy(buffer, cmd);
+        for (token = strtok(buffer, " \t"); token && argc < MAX_ARGS - 1; token = strtok(NULL, " \t")) {
+            argv[argc++] = token;
+        }
+    }
+    argv[argc] = NULL;
+    
+    if (argc == 0) {
+        return 0;
+    }
+    
+    result = run_command(argv);
     
     if (result != 0) {
         char error_msg[512];
@@ -177,6 +303,124 @@ int copy_file(const char *src, const char *dest) {
     return 0;
 }
 
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(sha256_ctx_t *ctx, const unsigned char *block) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+    
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+void sha256_init(sha256_ctx_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const unsigned char *data, size_t len) {
+    ctx->length += len;
+    while (len > 0) {
+        size_t chunk = sizeof(ctx->buffer) - ctx->used;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(ctx->buffer + ctx->used, data, chunk);
+        ctx->used += chunk;
+        data += chunk;
+        len -= chunk;
+        if (ctx->used == sizeof(ctx->buffer)) {
+            sha256_transform(ctx, ctx->buffer);
+            ctx->used = 0;
+        }
+    }
+}
+
+void sha256_final(sha256_ctx_t *ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    unsigned char zero = 0;
+    unsigned char length_be[8];
+    int i;
+    
+    sha256_update(ctx, &pad, 1);
+    while (ctx->used != 56) {
+        sha256_update(ctx, &zero, 1);
+    }
+    for (i = 0; i < 8; i++) {
+        length_be[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha256_update(ctx, length_be, 8);
+    
+    for (i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+// SHA-256 of a file as 64 lowercase hex characters
+int sha256_file(const char *path, char *hex) {
+    unsigned char buffer[65536];
+    unsigned char digest[32];
+    sha256_ctx_t ctx;
+    size_t bytes;
+    int i;
+    FILE *fp = fopen(path, "rb");
+    
+    if (!fp) {
+        return -1;
+    }
+    
+    sha256_init(&ctx);
+    while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        sha256_update(&ctx, buffer, bytes);
+    }
+    fclose(fp);
+    sha256_final(&ctx, digest);
+    
+    for (i = 0; i < 32; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    return 0;
+}
+
 // Write content to file
 int write_file(const char *path, const char *content) {
     FILE *file = fopen(path, "w");
@@ -236,50 +480,127 @@ int check_disk_space(const char *path, long required_mb) {
     return 1;
 }
 
+// Check whether an executable is on PATH without forking a shell
+int find_in_path(const char *name) {
+    char path[MAX_PATH_LEN];
+    const char *dirs = getenv("PATH");
+    const char *end;
+    size_t len;
+    
+    if (!dirs) {
+        dirs = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+    }
+    while (*dirs) {
+        end = strchr(dirs, ':');
+        len = end ? (size_t)(end - dirs) : strlen(dirs);
+        snprintf(path, sizeof(path), "%.*s/%s", (int)len, len ? dirs : ".", name);
+        if (access(path, X_OK) == 0) {
+            return 1;
+        }
+        dirs += len + (end ? 1 : 0);
+    }
+    return 0;
+}
+
 // Detect package manager
 int detect_package_manager(char *pm_name, size_t size) {
-    if (system("which apt >/dev/null 2>&1") == 0) {
-        strncpy(pm_name, "apt", size - 1);
-        return 0;
-    } else if (system("which yum >/dev/null 2>&1") == 0) {
-        strncpy(pm_name, "yum", size - 1);
-        return 0;
-    } else if (system("which dnf >/dev/null 2>&1") == 0) {
-        strncpy(pm_name, "dnf", size - 1);
-        return 0;
-    } else if (system("which pacman >/dev/null 2>&1") == 0) {
-        strncpy(pm_name, "pacman", size - 1);
-        return 0;
-    } else if (system("which zypper >/dev/null 2>&1") == 0) {
-        strncpy(pm_name, "zypper", size - 1);
-        return 0;
+    static const char *managers[] = { "apt", "yum", "dnf", "pacman", "zypper", NULL };
+    int i;
+    
+    for (i = 0; managers[i] != NULL; i++) {
+        if (find_in_path(managers[i])) {
+            strncpy(pm_name, managers[i], size - 1);
+            pm_name[size - 1] = '\0';
+            return 0;
+        }
     }
     
     log_message("ERROR", "No supported package manager found (apt, yum, dnf, pacman, zypper)");
     return -1;
 }
 
+// True when the tools install_build_dependencies() would install are all
+// on PATH already
+int build_tools_present(void) {
+    static const char *tools[] = { "gcc", "g++", "make", "git", "wget", "curl", "flex", "bison", "openssl", NULL };
+    char msg[128];
+    int i;
+    
+    for (i = 0; tools[i] != NULL; i++) {
+        if (!find_in_path(tools[i])) {
+            snprintf(msg, sizeof(msg), "Missing build tool: %s", tools[i]);
+            log_message("INFO", msg);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --prebuilt: use <source-dir>/prebuilt/builder-<arch> if its SHA-256
+// matches the .sha256 file beside it. Returns 0 when it was installed as
+// the builder binary, 1 when there is none for this architecture and -1
+// on a checksum mismatch.
+int use_prebuilt_builder(installer_config_t *config) {
+    struct utsname host;
+    char binary[MAX_PATH_LEN + 128];
+    char sum_file[MAX_PATH_LEN + 136];
+    char dest[MAX_PATH_LEN + 64];
+    char expected[80] = "";
+    char actual[80] = "";
+    char msg[MAX_PATH_LEN + 192];
+    FILE *fp;
+    
+    if (uname(&host) != 0) {
+        return 1;
+    }
+    snprintf(binary, sizeof(binary), "%s/%s/%s-%s", config->source_dir, PREBUILT_DIR, KERNEL_BUILDER_NAME, host.machine);
+    snprintf(sum_file, sizeof(sum_file), "%s.sha256", binary);
+    if (!file_exists(binary) || !file_exists(sum_file)) {
+        snprintf(msg, sizeof(msg), "No prebuilt builder for %s; compiling from source", host.machine);
+        log_message("INFO", msg);
+        return 1;
+    }
+    
+    fp = fopen(sum_file, "r");
+    if (fp) {
+        if (fscanf(fp, "%64s", expected) != 1) {
+            expected[0] = '\0';
+        }
+        fclose(fp);
+    }
+    if (sha256_file(binary, actual) != 0) {
+        actual[0] = '\0';
+    }
+    if (!expected[0] || strcmp(expected, actual) != 0) {
+        snprintf(msg, sizeof(msg), "Checksum mismatch for %s", binary);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    
+    snprintf(dest, sizeof(dest), "%s/%s", config->source_dir, KERNEL_BUILDER_NAME);
+    if (copy_file(binary, dest) != 0) {
+        return -1;
+    }
+    snprintf(msg, sizeof(msg), "Using prebuilt builder for %s (SHA-256 verified)", host.machine);
+    log_message("SUCCESS", msg);
+    return 0;
+}
+
 // Check system requirements
 int check_system_requirements(void) {
-    char arch[64];
-    FILE *fp;
+    struct utsname host;
     
     log_message("INFO", "Checking system requirements...");
     
     // Check architecture
-    fp = popen("uname -m", "r");
-    if (fp) {
-        if (fgets(arch, sizeof(arch), fp)) {
-            arch[strcspn(arch, "\n")] = '\0';
-            char arch_msg[128];
-            snprintf(arch_msg, sizeof(arch_msg), "Detected architecture: %s", arch);
-            log_message("INFO", arch_msg);
-            
-            if (strcmp(arch, "aarch64") != 0 && strcmp(arch, "x86_64") != 0) {
-                log_message("WARNING", "Untested architecture detected");
-            }
+    if (uname(&host) == 0) {
+        char arch_msg[128];
+        snprintf(arch_msg, sizeof(arch_msg), "Detected architecture: %s", host.machine);
+        log_message("INFO", arch_msg);
+        
+        if (strcmp(host.machine, "aarch64") != 0 && strcmp(host.machine, "x86_64") != 0) {
+            log_message("WARNING", "Untested architecture detected");
         }
-        pclose(fp);
     }
     
     // Check OS
@@ -341,17 +662,29 @@ int install_build_dependencies(const char *package_manager) {
     return 0;
 }
 
-// Compile the kernel builder
+// Compile the kernel builder. The binary is reused only when the stamp
+// from our own last compile matches the source, host and compiler command
+// and the binary still hashes to what that compile produced; anything else
+// (a make build-all binary, one copied in from another machine) is rebuilt.
 int compile_kernel_builder(installer_config_t *config) {
     char cmd[MAX_CMD_LEN];
     char source_file[MAX_PATH_LEN];
     char binary_file[MAX_PATH_LEN];
+    char stamp_file[MAX_PATH_LEN + 16];
+    char inputs[MAX_CMD_LEN + 128] = "";
+    char line[MAX_CMD_LEN + 128];
+    char source_hash[80] = "";
+    char binary_hash[80] = "";
+    char stamped_hash[80] = "";
+    struct utsname host;
+    FILE *fp;
     
     log_message("INFO", "Compiling Orange Pi Kernel Builder...");
     
     // Construct paths
     snprintf(source_file, sizeof(source_file), "%s/builder.c", config->source_dir);
     snprintf(binary_file, sizeof(binary_file), "%s/%s", config->source_dir, KERNEL_BUILDER_NAME);
+    snprintf(stamp_file, sizeof(stamp_file), "%s/%s", config->source_dir, BUILD_STAMP);
     
     // Check if source file exists
     if (!file_exists(source_file)) {
@@ -363,9 +696,27 @@ int compile_kernel_builder(installer_config_t *config) {
     
     // Compile with appropriate flags
     snprintf(cmd, sizeof(cmd), 
-            "gcc -Wall -Wextra -O2 -std=c99 -o %s %s",
+            "gcc -Wall -Wextra -O2 -std=c99 -o %s %s -ldl -lpthread",
             binary_file, source_file);
     
+    if (sha256_file(source_file, source_hash) == 0 && uname(&host) == 0) {
+        snprintf(inputs, sizeof(inputs), "%s %s %s", source_hash, host.machine, cmd);
+    }
+    fp = inputs[0] ? fopen(stamp_file, "r") : NULL;
+    if (fp) {
+        if (fgets(line, sizeof(line), fp) && fscanf(fp, "%64s", stamped_hash) == 1) {
+            line[strcspn(line, "\n")] = '\0';
+            if (strcmp(line, inputs) == 0 && sha256_file(binary_file, binary_hash) == 0 &&
+                strcmp(binary_hash, stamped_hash) == 0) {
+                fclose(fp);
+                log_message("INFO", "Builder binary is up to date; skipping compilation");
+                return 0;
+            }
+        }
+        fclose(fp);
+    }
+    unlink(stamp_file);
+    
     if (execute_command(cmd, config->verbose) != 0) {
         log_message("ERROR", "Compilation failed");
         return -1;
@@ -377,6 +728,15 @@ int compile_kernel_builder(installer_config_t *config) {
         return -1;
     }
     
+    // Record what was built for the next run
+    if (inputs[0] && sha256_file(binary_file, binary_hash) == 0) {
+        fp = fopen(stamp_file, "w");
+        if (fp) {
+            fprintf(fp, "%s\n%s\n", inputs, binary_hash);
+            fclose(fp);
+        }
+    }
+    
     log_message("SUCCESS", "Compilation completed successfully");
     return 0;
 }
@@ -473,14 +833,14 @@ int create_desktop_entry(installer_config_t *config) {
 // Create bash completion file
 int create_completion_file(installer_config_t *config) {
     char completion_file[MAX_PATH_LEN];
-    char content[2048];
+    char content[8192];
     
     log_message("INFO", "Creating bash completion...");
     
     snprintf(completion_file, sizeof(completion_file), "/etc/bash_completion.d/%s", KERNEL_BUILDER_NAME);
     
-    // Create completion content
-    snprintf(content, sizeof(content),
+    // Create completion content; a cut-off script would break the shell
+    if (snprintf(content, sizeof(content),
             "# Orange Pi Kernel Builder bash completion\n"
             "\n"
             "_%s() {\n"
@@ -489,10 +849,15 @@ int create_completion_file(installer_config_t *config) {
             "    cur=\"${COMP_WORDS[COMP_CWORD]}\"\n"
             "    prev=\"${COMP_WORDS[COMP_CWORD-1]}\"\n"
             "    \n"
-            "    opts=\"--help --version --jobs --build-dir --clean --defconfig --cross-compile\n"
-            "          --verbose --no-install --cleanup --enable-gpu --disable-gpu\n"
+            "    opts=\"--help --version --jobs --build-dir --cache-dir --clean --defconfig --cross-compile\n"
+            "          --verbose --no-install --cleanup --incremental --enable-gpu --disable-gpu\n"
             "          --enable-opencl --disable-opencl --enable-vulkan --disable-vulkan\n"
-            "          --verify-gpu\"\n"
+            "          --verify-gpu --compiler-cache --compiler-cache-dir --compiler-cache-size\n"
+            "          --single-make --profile --parallel-profiles --config-fragment --preempt --tune-cpu --blob-manifest --record-blob-pins --report --kernel-ref --bench --bench-baseline\n"
+            "          --toolchain --pgo --pgo-profile --scratch --apt-ttl --distributed --build-hosts\n"
+            "          --bundle --deploy --deploy-jobs --deb --deb-compress --initramfs-compress --initramfs-modules\n"
+            "          --module-compress --no-module-strip --debug-info --gpu-bench --gpu-baseline --runtime-tune\n"
+            "          --low-memory --zram-swap --artifact-cache --quiet --daemon --submit --socket\"\n"
             "    \n"
             "    case ${prev} in\n"
             "        --version|-v)\n"
@@ -500,10 +865,70 @@ int create_completion_file(installer_config_t *config) {
             "            return 0\n"
             "            ;;\n"
             "        --jobs|-j)\n"
-            "            COMPREPLY=( $(compgen -W \"1 2 4 8 16\" -- ${cur}) )\n"
+            "            COMPREPLY=( $(compgen -W \"auto 1 2 4 8 16\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --profile)\n"
+            "            COMPREPLY=( $(compgen -W \"desktop server performance desktop,server\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --preempt)\n"
+            "            COMPREPLY=( $(compgen -W \"none voluntary full\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --compiler-cache)\n"
+            "            COMPREPLY=( $(compgen -W \"ccache sccache none\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --runtime-tune)\n"
+            "            COMPREPLY=( $(compgen -W \"performance balanced powersave\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --zram-swap)\n"
+            "            COMPREPLY=( $(compgen -W \"auto 2048 4096\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --debug-info)\n"
+            "            COMPREPLY=( $(compgen -W \"none reduced split\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --initramfs-compress)\n"
+            "            COMPREPLY=( $(compgen -W \"lz4 zstd gzip xz\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --initramfs-modules)\n"
+            "            COMPREPLY=( $(compgen -W \"most dep loaded\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --module-compress)\n"
+            "            COMPREPLY=( $(compgen -W \"zstd xz none\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --deb-compress)\n"
+            "            COMPREPLY=( $(compgen -W \"zstd xz gzip none\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --distributed)\n"
+            "            COMPREPLY=( $(compgen -W \"distcc icecc\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --scratch)\n"
+            "            COMPREPLY=( $(compgen -W \"disk auto tmpfs\" -- ${cur}) $(compgen -d -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --toolchain)\n"
+            "            COMPREPLY=( $(compgen -W \"gcc llvm\" -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --pgo)\n"
+            "            COMPREPLY=( $(compgen -W \"instrument use\" -- ${cur}) )\n"
             "            return 0\n"
             "            ;;\n"
-            "        --build-dir|-d)\n"
+            "        --config-fragment|--pgo-profile|--gpu-baseline|--socket)\n"
+            "            COMPREPLY=( $(compgen -f -- ${cur}) )\n"
+            "            return 0\n"
+            "            ;;\n"
+            "        --build-dir|-d|--cache-dir|--compiler-cache-dir|--artifact-cache)\n"
             "            COMPREPLY=( $(compgen -d -- ${cur}) )\n"
             "            return 0\n"
             "            ;;\n"
@@ -516,7 +941,10 @@ int create_completion_file(installer_config_t *config) {
             "}\n"
             "\n"
             "complete -F _%s %s\n",
-            KERNEL_BUILDER_NAME, KERNEL_BUILDER_NAME, KERNEL_BUILDER_NAME);
+            KERNEL_BUILDER_NAME, KERNEL_BUILDER_NAME, KERNEL_BUILDER_NAME) >= (int)sizeof(content)) {
+        log_message("WARNING", "Bash completion script is too long; skipping it");
+        return 0;
+    }
     
     if (write_file(completion_file, content) != 0) {
         log_message("WARNING", "Failed to create bash completion");
@@ -651,11 +1079,12 @@ void print_usage(const char *program_name) {
     printf("  --skip-shell            Skip shell integration setup\n");
     printf("  --verbose               Verbose output\n");
     printf("  --force                 Force installation even if checks fail\n");
+    printf("  --prebuilt              Use a checksum-verified prebuilt binary when one exists for this arch\n");
     printf("  -h, --help              Show this help\n\n");
     printf("This installer will:\n");
     printf("  1. Check system requirements and dependencies\n");
-    printf("  2. Install build tools using the system package manager\n");
-    printf("  3. Compile the Orange Pi Kernel Builder from source\n");
+    printf("  2. Install build tools using the system package manager (if any are missing)\n");
+    printf("  3. Compile the Orange Pi Kernel Builder from source (or use the prebuilt binary)\n");
     printf("  4. Install the tool system-wide\n");
     printf("  5. Setup shell integration and desktop entry\n");
     printf("  6. Verify the installation\n\n");
@@ -673,11 +1102,13 @@ int main(int argc, char *argv[]) {
         .skip_desktop = 0,
         .skip_shell = 0,
         .verbose = 0,
-        .force_install = 0
+        .force_install = 0,
+        .prebuilt = 0
     };
     
     char package_manager[32];
     char *current_dir;
+    int have_binary = 0;
     int i;
     
     print_header();
@@ -711,6 +1142,8 @@ int main(int argc, char *argv[]) {
             config.verbose = 1;
         } else if (strcmp(argv[i], "--force") == 0) {
             config.force_install = 1;
+        } else if (strcmp(argv[i], "--prebuilt") == 0) {
+            config.prebuilt = 1;
         } else {
             printf("Unknown option: %s\n", argv[i]);
             printf("Use --help for usage information\n");
@@ -731,31 +1164,45 @@ int main(int argc, char *argv[]) {
         goto error;
     }
     
-    // Detect package manager
-    if (detect_package_manager(package_manager, sizeof(package_manager)) != 0) {
-        if (!config.force_install) {
+    // A prebuilt binary needs no compiler; the builder installs the
+    // kernel build dependencies itself
+    if (config.prebuilt) {
+        int result = use_prebuilt_builder(&config);
+        if (result < 0) {
             goto error;
         }
-        log_message("WARNING", "Package manager detection failed, continuing anyway");
-        strcpy(package_manager, "unknown");
+        have_binary = (result == 0);
     }
     
-    char pm_msg[128];
-    snprintf(pm_msg, sizeof(pm_msg), "Using package manager: %s", package_manager);
-    log_message("INFO", pm_msg);
-    
-    // Install dependencies
-    if (strcmp(package_manager, "unknown") != 0) {
-        if (install_build_dependencies(package_manager) != 0) {
+    if (!have_binary && build_tools_present()) {
+        log_message("INFO", "Build tools already installed; skipping dependency installation");
+    } else if (!have_binary) {
+        // Detect package manager
+        if (detect_package_manager(package_manager, sizeof(package_manager)) != 0) {
             if (!config.force_install) {
                 goto error;
             }
-            log_message("WARNING", "Dependency installation failed, continuing anyway");
+            log_message("WARNING", "Package manager detection failed, continuing anyway");
+            strcpy(package_manager, "unknown");
+        }
+        
+        char pm_msg[128];
+        snprintf(pm_msg, sizeof(pm_msg), "Using package manager: %s", package_manager);
+        log_message("INFO", pm_msg);
+        
+        // Install dependencies
+        if (strcmp(package_manager, "unknown") != 0) {
+            if (install_build_dependencies(package_manager) != 0) {
+                if (!config.force_install) {
+                    goto error;
+                }
+                log_message("WARNING", "Dependency installation failed, continuing anyway");
+            }
         }
     }
     
     // Compile kernel builder
-    if (compile_kernel_builder(&config) != 0) {
+    if (!have_binary && compile_kernel_builder(&config) != 0) {
         goto error;
     }
     